@@ -0,0 +1,86 @@
+#ifndef COMPILER_IR_ALIAS_ANALYSIS_HPP
+#define COMPILER_IR_ALIAS_ANALYSIS_HPP
+
+#include <optional>
+#include <variant>
+
+#include "instruction.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// memory that instruction reads or writes: field of object, element of array or length of
+// array. lengths never change, so nothing writes them
+struct MemoryAccess {
+    enum Kind { NONE, FIELD, ELEMENT, LENGTH };
+    Kind kind = NONE;
+    Instruction *base = nullptr;       // nullptr if reference is not a value
+    Input offset = 0;                  // field or index
+    Types::Type type = Types::VOID_T;  // of value there, VOID_T if unknown
+    bool is_write = false;
+};
+
+inline MemoryAccess memory_access(Instruction *inst) {
+    MemoryAccess a;
+    switch (inst->opcode) {
+        case LoadField::opcode:
+        case StoreField::opcode:
+            a.kind = MemoryAccess::FIELD;
+            break;
+        case LoadArray::opcode:
+        case StoreArray::opcode:
+            a.kind = MemoryAccess::ELEMENT;
+            break;
+        case ArrayLength::opcode:
+            a.kind = MemoryAccess::LENGTH;
+            a.type = inst->type;
+            break;
+        default:
+            return a;
+    }
+    if (std::holds_alternative<Instruction *>(inst->inputs[0].data))
+        a.base = std::get<Instruction *>(inst->inputs[0].data);
+    if (a.kind == MemoryAccess::LENGTH) return a;
+
+    a.offset = inst->inputs[1];
+    a.is_write = inst->opcode == StoreField::opcode || inst->opcode == StoreArray::opcode;
+    if (!a.is_write)
+        a.type = inst->type;
+    else if (std::holds_alternative<Instruction *>(inst->inputs[2].data))
+        a.type = std::get<Instruction *>(inst->inputs[2].data)->type;
+    return a;
+}
+
+inline bool is_allocation(const Instruction *inst) {
+    return inst->opcode == NewObject::opcode || inst->opcode == NewArray::opcode;
+}
+
+enum class AliasResult { NO_ALIAS, MAY_ALIAS, MUST_ALIAS };
+
+// fields and elements are different memory, and so are values of different types.
+// distinct allocations are different objects, same reference with same offset is the
+// same place, different constant offsets are different places
+inline AliasResult alias(const MemoryAccess &a, const MemoryAccess &b) {
+    if (a.kind == MemoryAccess::NONE || b.kind == MemoryAccess::NONE || a.kind != b.kind)
+        return AliasResult::NO_ALIAS;
+    if (a.type != Types::VOID_T && b.type != Types::VOID_T && a.type != b.type)
+        return AliasResult::NO_ALIAS;
+    if (!a.base || !b.base) return AliasResult::MAY_ALIAS;
+    if (a.base != b.base)
+        return is_allocation(a.base) && is_allocation(b.base) ? AliasResult::NO_ALIAS
+                                                              : AliasResult::MAY_ALIAS;
+    if (a.kind == MemoryAccess::LENGTH || a.offset == b.offset)
+        return AliasResult::MUST_ALIAS;
+    auto x = constant_value(a.offset), y = constant_value(b.offset);
+    if (x && y) return *x == *y ? AliasResult::MUST_ALIAS : AliasResult::NO_ALIAS;
+    return AliasResult::MAY_ALIAS;
+}
+
+inline AliasResult alias(Instruction *a, Instruction *b) {
+    return alias(memory_access(a), memory_access(b));
+}
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_ALIAS_ANALYSIS_HPP
@@ -26,7 +26,7 @@ struct BasicBlock {
 
     std::vector<BasicBlock *> preds;
 
-    Graph *graph;
+    Graph *graph = nullptr;
 
     BasicBlock *idom = nullptr;
     int post_order_number = -1;
@@ -34,6 +34,10 @@ struct BasicBlock {
     int linear_from = -1;
     int linear_to = -1;
 
+    int64_t exec_count = -1;  // from profile, -1 if unknown
+    int64_t next1_count = -1;  // times edge to next1 was taken, -1 if unknown
+    int64_t next2_count = -1;
+
     BasicBlock() {}
 
     void add_next1(BasicBlock *other) {
@@ -64,6 +68,18 @@ struct BasicBlock {
         return newinst;
     }
 
+    // phi without inputs before the other phis
+    Instruction *prepend_phi(Types::Type type) {
+        Instruction *phi =
+            new Instruction(nullptr, nullptr, PHI_OPCODE, type, this, {}, {}, 0);
+        Instruction *first = first_phi ? first_phi : first_not_phi;
+        phi->next = first;
+        if (first) first->prev = phi;
+        first_phi = phi;
+        if (!last) last = phi;
+        return phi;
+    }
+
     void remove_instruction(Instruction *inst) {
         if (inst->prev) inst->prev->next = inst->next;
         if (inst->next) inst->next->prev = inst->prev;
@@ -119,6 +135,39 @@ struct BasicBlock {
     }
 };
 
+inline Instruction *insert_before(Instruction *target, opcode_t opcode, Types::Type type,
+                                  std::vector<Input> inputs) {
+    BasicBlock *bb = target->bb;
+    Instruction *inst = new Instruction(target->prev, target, opcode, type, bb, {}, {}, 0);
+    set_inputs(inst, inputs);
+    if (target->prev) target->prev->next = inst;
+    target->prev = inst;
+    if (bb->first_not_phi == target) bb->first_not_phi = inst;
+    return inst;
+}
+
+// users and inputs stay as they are
+inline void move_to_end(Instruction *inst, BasicBlock *bb) {
+    BasicBlock *from = inst->bb;
+    if (inst->prev) inst->prev->next = inst->next;
+    if (inst->next) inst->next->prev = inst->prev;
+    if (from->first_not_phi == inst) from->first_not_phi = inst->next;
+    if (from->last == inst) from->last = inst->prev;
+
+    inst->bb = bb;
+    inst->prev = bb->last;
+    inst->next = nullptr;
+    if (bb->last) bb->last->next = inst;
+    if (!bb->first_not_phi) bb->first_not_phi = inst;
+    bb->last = inst;
+}
+
+inline Instruction *insert_after(Instruction *target, opcode_t opcode, Types::Type type,
+                                 std::vector<Input> inputs) {
+    if (target->next) return insert_before(target->next, opcode, type, inputs);
+    return target->bb->add_instruction(opcode, type, inputs);
+}
+
 }  // namespace IR
 }  // namespace Compiler
 
@@ -0,0 +1,337 @@
+#ifndef COMPILER_IR_CFG_SIMPLIFICATION_HPP
+#define COMPILER_IR_CFG_SIMPLIFICATION_HPP
+
+#include <algorithm>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "doms.hpp"
+#include "graph.hpp"
+#include "loop_analyser.hpp"
+#include "pass_stats.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// cleans up control flow that inlining, if-conversion and folding leave behind. until
+// nothing changes:
+//  - unreachable blocks lose their instructions and edges
+//  - branches on constants become gotos
+//  - jumps are threaded: pred whose phi input decides the branch of a block that only
+//    computes that branch goes to the target right away
+//  - empty blocks that only go to the next one are removed
+//  - block is merged into its only pred if that pred only goes to it
+// then basic_blocks is compacted, so ids of blocks are 0..n-1 again. blocks move in
+// memory then, pointers to them from outside the graph are stale
+class CfgSimplification {
+   public:
+    int num_unreachable = 0;  // blocks that lost everything
+    int num_folded = 0;       // branches on constants
+    int num_threaded = 0;     // edges that go past a decided branch now
+    int num_forwarders = 0;   // empty blocks removed
+    int num_merged = 0;       // blocks merged into their pred
+    int num_removed = 0;      // blocks gone from basic_blocks
+
+    explicit CfgSimplification(Graph *graph_) : graph(graph_) {}
+
+    // number of changes of control flow
+    int run() {
+        if (!graph || !graph->first) return 0;
+        PassTimer timer("simplify cfg", graph);
+
+        bool changed = true;
+        while (changed) {
+            changed = remove_unreachable();
+            changed |= thread_jumps();
+            for (auto &bb : graph->basic_blocks) changed |= fold_branch(&bb);
+            for (auto &bb : graph->basic_blocks) changed |= remove_forwarder(&bb);
+            for (auto &bb : graph->basic_blocks) changed |= merge_into_pred(&bb);
+        }
+        compact();
+
+        timer.count("unreachable blocks", num_unreachable);
+        timer.count("branches folded", num_folded);
+        timer.count("jumps threaded", num_threaded);
+        timer.count("forwarders removed", num_forwarders);
+        timer.count("blocks merged", num_merged);
+        timer.count("blocks removed", num_removed);
+        int changes =
+            num_unreachable + num_folded + num_threaded + num_forwarders + num_merged;
+        if (changes || num_removed) graph->version++;
+        return changes;
+    }
+
+   private:
+    Graph *graph;
+
+    bool is_dead(BasicBlock *bb) const { return bb != graph->first && bb->preds.empty(); }
+
+    static void erase_user(Instruction *value, Instruction *user) {
+        auto it = std::find_if(value->users.begin(), value->users.end(),
+                               [user](const User &u) { return u.inst == user; });
+        if (it != value->users.end()) value->users.erase(it);
+    }
+
+    // drops one edge from pred and phi inputs that come with it
+    static void remove_pred(BasicBlock *bb, BasicBlock *pred) {
+        auto it = std::find(bb->preds.begin(), bb->preds.end(), pred);
+        if (it == bb->preds.end()) return;
+        bb->preds.erase(it);
+        for (auto phi = bb->first_phi; phi && phi->opcode == PHI_OPCODE; phi = phi->next)
+            for (auto inp = phi->inputs.begin(); inp != phi->inputs.end(); ++inp)
+                if (std::get<PhiInput>(inp->data).second == pred) {
+                    erase_user(std::get<PhiInput>(inp->data).first, phi);
+                    phi->inputs.erase(inp);
+                    break;
+                }
+    }
+
+    // edge from pred to from goes to to, phis of to get the values they get from like
+    static void redirect(BasicBlock *pred, BasicBlock *from, BasicBlock *to,
+                         BasicBlock *like) {
+        for (auto phi = to->first_phi; phi && phi->opcode == PHI_OPCODE;
+             phi = phi->next) {
+            Instruction *value = phi_input(phi, like);
+            if (!value) throw "simplify cfg: phi has no input for pred";
+            phi->add_input(PhiInput{value, pred});
+        }
+        to->preds.push_back(pred);
+        if (pred->next1 == from)
+            pred->next1 = to;
+        else
+            pred->next2 = to;
+        remove_pred(from, pred);
+    }
+
+    static void replace_pred(BasicBlock *succ, BasicBlock *old_pred, BasicBlock *new_pred) {
+        std::replace(succ->preds.begin(), succ->preds.end(), old_pred, new_pred);
+        for (auto phi = succ->first_phi; phi && phi->opcode == PHI_OPCODE; phi = phi->next)
+            for (auto &inp : phi->inputs)
+                if (std::get<PhiInput>(inp.data).second == old_pred)
+                    inp.data = PhiInput{std::get<PhiInput>(inp.data).first, new_pred};
+    }
+
+    bool remove_unreachable() {
+        std::vector<BasicBlock *> rpo = get_reverse_post_order(graph);
+        std::unordered_set<BasicBlock *> reachable(rpo.begin(), rpo.end());
+
+        // values of unreachable blocks are only used in unreachable blocks, so all of
+        // them are unlinked before any is deleted
+        std::vector<Instruction *> dead;
+        int removed = 0;
+        for (auto &bb : graph->basic_blocks) {
+            if (reachable.count(&bb)) continue;
+            if (!bb.first_phi && !bb.first_not_phi && !bb.next1 && bb.preds.empty())
+                continue;
+            for (BasicBlock *succ : {bb.next1, bb.next2})
+                if (succ) remove_pred(succ, &bb);
+            bb.next1 = bb.next2 = nullptr;
+            bb.preds.clear();
+            for (auto inst = bb.first_phi ? bb.first_phi : bb.first_not_phi; inst;
+                 inst = inst->next)
+                dead.push_back(inst);
+            removed++;
+        }
+        for (Instruction *inst : dead) inst->bb->remove_instruction(inst);
+        for (Instruction *inst : dead) delete inst;
+        num_unreachable += removed;
+        return removed > 0;
+    }
+
+    static std::optional<int64_t> known_value(Instruction *inst) {
+        if (inst->opcode == Const::opcode) return constant_value(inst->inputs[0]);
+        if (inst->opcode == Eq::opcode) {
+            auto a = constant_value(inst->inputs[0]), b = constant_value(inst->inputs[1]);
+            if (a && b) return *a == *b;
+        }
+        return std::nullopt;
+    }
+
+    bool fold_branch(BasicBlock *bb) {
+        if (is_dead(bb) || !bb->next2 || !bb->last) return false;
+        Instruction *cond = bb->last;
+        auto value = known_value(cond);
+        if (!value) return false;
+
+        BasicBlock *taken = *value ? bb->next1 : bb->next2;
+        remove_pred(*value ? bb->next2 : bb->next1, bb);
+        bb->next1 = taken;
+        bb->next2 = nullptr;
+        bb->next1_count = bb->exec_count;
+        bb->next2_count = -1;
+        if (cond->users.empty()) {
+            bb->remove_instruction(cond);
+            delete cond;
+        }
+        num_folded++;
+        return true;
+    }
+
+    // block has only phis and the branch, which is a phi or eq of a phi and a constant,
+    // and none of its values are used outside of it
+    static bool is_decided_by_phis(BasicBlock *bb) {
+        Instruction *cond = bb->last;
+        for (auto inst = bb->first_phi ? bb->first_phi : bb->first_not_phi; inst;
+             inst = inst->next) {
+            if (inst->opcode != PHI_OPCODE && inst != cond) return false;
+            for (auto &user : inst->users)
+                if (user.inst->bb != bb) return false;
+        }
+        if (cond->opcode == PHI_OPCODE) return true;
+        if (cond->opcode != Eq::opcode) return false;
+        for (auto &inp : cond->inputs)
+            if (!constant_value(inp) &&
+                std::get<Instruction *>(inp.data)->opcode != PHI_OPCODE)
+                return false;
+        return true;
+    }
+
+    static std::optional<bool> branch_from(BasicBlock *bb, BasicBlock *pred) {
+        auto value = [&](const Input &inp) -> std::optional<int64_t> {
+            if (std::holds_alternative<Instruction *>(inp.data)) {
+                Instruction *inst = std::get<Instruction *>(inp.data);
+                if (inst->opcode == PHI_OPCODE && inst->bb == bb)
+                    return constant_value(phi_input(inst, pred));
+            }
+            return constant_value(inp);
+        };
+        Instruction *cond = bb->last;
+        if (cond->opcode == PHI_OPCODE) {
+            auto v = value(cond);
+            if (v) return *v != 0;
+            return std::nullopt;
+        }
+        auto a = value(cond->inputs[0]), b = value(cond->inputs[1]);
+        if (a && b) return *a == *b;
+        return std::nullopt;
+    }
+
+    bool thread_jumps() {
+        LoopAnalyzer loops(graph);
+        std::set<std::pair<BasicBlock *, BasicBlock *>> back_edges(loops.back_edges.begin(),
+                                                                   loops.back_edges.end());
+        bool changed = false;
+        for (auto &block : graph->basic_blocks) {
+            BasicBlock *bb = &block;
+            if (is_dead(bb) || !bb->next2 || !bb->last || !is_decided_by_phis(bb)) continue;
+            // loop would get a second entry
+            if (std::any_of(bb->preds.begin(), bb->preds.end(),
+                            [&](BasicBlock *pred) { return back_edges.count({pred, bb}); }))
+                continue;
+
+            std::vector<BasicBlock *> preds = bb->preds;
+            for (BasicBlock *pred : preds) {
+                auto taken = branch_from(bb, pred);
+                if (!taken) continue;
+                BasicBlock *target = *taken ? bb->next1 : bb->next2;
+                if (target == bb ||
+                    std::count(target->preds.begin(), target->preds.end(), pred))
+                    continue;
+                redirect(pred, bb, target, bb);
+                num_threaded++;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    bool remove_forwarder(BasicBlock *bb) {
+        if (bb == graph->first || is_dead(bb) || bb->first_phi || bb->first_not_phi ||
+            bb->next2 || !bb->next1 || bb->next1 == bb)
+            return false;
+        // pred can't get two edges to succ, phis would not know which one is which
+        BasicBlock *succ = bb->next1;
+        std::unordered_set<BasicBlock *> seen;
+        for (BasicBlock *pred : bb->preds)
+            if (!seen.insert(pred).second ||
+                std::count(succ->preds.begin(), succ->preds.end(), pred))
+                return false;
+
+        std::vector<BasicBlock *> preds = bb->preds;
+        for (BasicBlock *pred : preds) redirect(pred, bb, succ, bb);
+        remove_pred(succ, bb);
+        bb->next1 = nullptr;
+        num_forwarders++;
+        return true;
+    }
+
+    bool merge_into_pred(BasicBlock *bb) {
+        if (bb == graph->first || bb->preds.size() != 1) return false;
+        BasicBlock *pred = bb->preds[0];
+        if (pred == bb || pred->next2 || pred->next1 != bb) return false;
+        // branch on a phi would be left without its condition
+        if (bb->next2 && bb->last && bb->last->opcode == PHI_OPCODE) return false;
+
+        while (bb->first_phi) {
+            Instruction *phi = bb->first_phi;
+            Instruction *value = phi_input(phi, pred);
+            if (!value) throw "simplify cfg: phi has no input for pred";
+            replace_uses(phi, value);
+            bb->remove_instruction(phi);
+            delete phi;
+        }
+        while (bb->first_not_phi) move_to_end(bb->first_not_phi, pred);
+
+        pred->next1 = bb->next1;
+        pred->next2 = bb->next2;
+        pred->next1_count = bb->next1_count;
+        pred->next2_count = bb->next2_count;
+        for (BasicBlock *succ : {bb->next1, bb->next2})
+            if (succ) replace_pred(succ, bb, pred);
+        bb->preds.clear();
+        bb->next1 = bb->next2 = nullptr;
+        num_merged++;
+        return true;
+    }
+
+    // reachable blocks move down into places of the rest in the same order, then all
+    // pointers to blocks are moved after them
+    void compact() {
+        std::vector<BasicBlock *> rpo = get_reverse_post_order(graph);
+        std::unordered_set<BasicBlock *> reachable(rpo.begin(), rpo.end());
+        std::vector<BasicBlock *> live;
+        for (auto &bb : graph->basic_blocks)
+            if (reachable.count(&bb)) live.push_back(&bb);
+        if (live.size() == graph->basic_blocks.size()) return;
+
+        std::unordered_map<BasicBlock *, BasicBlock *> moved;
+        for (size_t i = 0; i < live.size(); i++) moved[live[i]] = &graph->basic_blocks[i];
+        // live[i] is never below i, so place i is free when its turn comes
+        for (size_t i = 0; i < live.size(); i++)
+            if (live[i] != &graph->basic_blocks[i])
+                std::swap(graph->basic_blocks[i], *live[i]);
+
+        for (size_t i = 0; i < live.size(); i++) {
+            BasicBlock &bb = graph->basic_blocks[i];
+            bb.id = i;
+            bb.idom = nullptr;
+            if (bb.next1) bb.next1 = moved.at(bb.next1);
+            if (bb.next2) bb.next2 = moved.at(bb.next2);
+            for (BasicBlock *&pred : bb.preds) pred = moved.at(pred);
+            for (auto inst = bb.first_phi ? bb.first_phi : bb.first_not_phi; inst;
+                 inst = inst->next) {
+                inst->bb = &bb;
+                if (inst->opcode == PHI_OPCODE)
+                    for (auto &inp : inst->inputs) {
+                        PhiInput pi = std::get<PhiInput>(inp.data);
+                        inp.data = PhiInput{pi.first, moved.at(pi.second)};
+                    }
+            }
+        }
+        graph->first = moved.at(graph->first);
+        num_removed = graph->basic_blocks.size() - live.size();
+        graph->basic_blocks.resize(live.size());
+    }
+};
+
+inline int simplify_cfg(Graph *graph) { return CfgSimplification(graph).run(); }
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_CFG_SIMPLIFICATION_HPP
@@ -6,6 +6,7 @@
 
 #include "doms.hpp"
 #include "graph.hpp"
+#include "pass_stats.hpp"
 
 namespace Compiler {
 namespace IR {
@@ -14,6 +15,7 @@ inline bool is_check(Instruction *inst) { return inst->flags.test(IS_CHECK_FLAG)
 
 inline void optimize_dominated_checks(Graph *graph) {
     if (!graph || !graph->first) return;
+    PassTimer timer("check elimination", graph);
 
     compute_immediate_dominators(graph);
     auto rpo = get_reverse_post_order(graph);
@@ -68,6 +70,8 @@ inline void optimize_dominated_checks(Graph *graph) {
         inst->bb->remove_instruction(inst);
         delete inst;
     }
+    timer.count("checks removed", to_remove.size());
+    if (!to_remove.empty()) graph->version++;
 }
 
 }  // namespace IR
@@ -0,0 +1,176 @@
+#ifndef COMPILER_IR_DEOPT_HPP
+#define COMPILER_IR_DEOPT_HPP
+
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "basic_block.hpp"
+#include "doms.hpp"
+#include "graph.hpp"
+#include "instruction.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// state of unoptimized method at the start of resume_bb. tier 0 continues from there
+// with values[i] set to input i + 1 of deopt instruction
+struct FrameState {
+    Graph *method = nullptr;
+    BasicBlock *resume_bb = nullptr;
+    std::vector<Instruction *> values;  // values of method
+};
+
+// values of method that execution from the start of bb can't recompute: phis of bb and
+// everything used after it that is defined in strict dominators of bb. values defined
+// in blocks dominated by bb are computed again before any use
+inline std::vector<Instruction *> collect_frame_values(Graph *method, BasicBlock *bb) {
+    compute_immediate_dominators(method);
+
+    std::vector<BasicBlock *> region{bb};
+    std::unordered_set<BasicBlock *> visited{bb};
+    for (size_t i = 0; i < region.size(); i++)
+        for (BasicBlock *succ : {region[i]->next1, region[i]->next2})
+            if (succ && visited.insert(succ).second) region.push_back(succ);
+
+    std::vector<Instruction *> values;
+    std::unordered_set<Instruction *> added;
+    auto add = [&](Instruction *v) {
+        if (added.insert(v).second) values.push_back(v);
+    };
+
+    for (auto phi = bb->first_phi; phi && phi->opcode == PHI_OPCODE; phi = phi->next)
+        add(phi);
+
+    for (BasicBlock *block : region)
+        for (auto i = block->first_phi ? block->first_phi : block->first_not_phi; i;
+             i = i->next)
+            for (auto &inp : i->inputs) {
+                Instruction *v = nullptr;
+                if (std::holds_alternative<Instruction *>(inp.data))
+                    v = std::get<Instruction *>(inp.data);
+                else if (std::holds_alternative<PhiInput>(inp.data) &&
+                         visited.count(std::get<PhiInput>(inp.data).second))
+                    v = std::get<PhiInput>(inp.data).first;
+                if (v && v->bb != bb && dominates(v->bb, bb)) add(v);
+            }
+    return values;
+}
+
+// adds deopt point to the end of bb of optimized code: if condition is true, tier 0
+// continues in method from resume_bb. map_value gives optimized value for value of method
+inline Instruction *add_deopt_if(BasicBlock *bb, Instruction *condition, Graph *method,
+                                 BasicBlock *resume_bb,
+                                 const std::function<Instruction *(Instruction *)> &map_value) {
+    auto state = std::make_shared<FrameState>();
+    state->method = method;
+    state->resume_bb = resume_bb;
+    state->values = collect_frame_values(method, resume_bb);
+
+    std::vector<Input> inputs{condition};
+    for (auto v : state->values) inputs.push_back(map_value(v));
+
+    Instruction *deopt = bb->add_<DeoptIf>(inputs);
+    deopt->frame_state = state;
+    return deopt;
+}
+
+// method entered in the middle of loop: first block takes values of state as arguments
+// and jumps to the copy of loop header
+struct OsrEntry {
+    Graph graph;
+    std::vector<Instruction *> state;  // values of method, i-th one is passed as arg i
+
+    OsrEntry(int bbnum, std::vector<Types::Type> args) : graph(bbnum, args) {}
+};
+
+// copies blocks reachable from header. values from outside of loop become arguments,
+// values of outer loops get phis in header as they are both passed and recomputed
+inline std::unique_ptr<OsrEntry> build_osr_entry(Graph *method, BasicBlock *header) {
+    std::vector<Instruction *> state = collect_frame_values(method, header);
+
+    std::vector<BasicBlock *> region;
+    std::unordered_map<BasicBlock *, int> block_idx;  // in osr graph, 0 is entry
+    block_idx[header] = 1;
+    region.push_back(header);
+    for (size_t i = 0; i < region.size(); i++)
+        for (BasicBlock *succ : {region[i]->next1, region[i]->next2})
+            if (succ && block_idx.emplace(succ, region.size() + 1).second)
+                region.push_back(succ);
+
+    std::vector<Types::Type> arg_types;
+    for (auto v : state) arg_types.push_back(v->type);
+    auto osr = std::make_unique<OsrEntry>(region.size() + 1, arg_types);
+    osr->state = state;
+    Graph &g = osr->graph;
+    BasicBlock *entry = &g.basic_blocks[0];
+    BasicBlock *new_header = &g.basic_blocks[1];
+
+    std::unordered_map<Instruction *, Instruction *> args;  // for outside values
+    std::unordered_map<Instruction *, Instruction *> outer_phis;
+    for (size_t i = 0; i < state.size(); i++) {
+        args[state[i]] = entry->add_instruction(GetArg::opcode, state[i]->type, {(int)i});
+        if (block_idx.count(state[i]->bb) && state[i]->bb != header)
+            outer_phis[state[i]] = new_header->add_instruction(PHI_OPCODE, state[i]->type, {});
+    }
+
+    std::unordered_map<Instruction *, Instruction *> clones;
+    for (BasicBlock *bb : region) {
+        BasicBlock *copy = &g.basic_blocks[block_idx[bb]];
+        copy->exec_count = bb->exec_count;
+        for (auto i = bb->first_phi ? bb->first_phi : bb->first_not_phi; i; i = i->next)
+            clones[i] = copy->add_instruction(i->opcode, i->type, {}, i->flags);
+    }
+
+    // value of v seen at the end of block bb of method
+    auto map_value = [&](Instruction *v, BasicBlock *bb) {
+        if (!block_idx.count(v->bb)) return args.at(v);
+        auto outer = outer_phis.find(v);
+        if (outer != outer_phis.end() && dominates(header, bb)) return outer->second;
+        return clones.at(v);
+    };
+
+    for (BasicBlock *bb : region)
+        for (auto i = bb->first_phi ? bb->first_phi : bb->first_not_phi; i; i = i->next) {
+            Instruction *copy = clones[i];
+            copy->frame_state = i->frame_state;
+            for (auto &inp : i->inputs) {
+                if (std::holds_alternative<Instruction *>(inp.data)) {
+                    copy->add_input(map_value(std::get<Instruction *>(inp.data), bb));
+                } else if (std::holds_alternative<PhiInput>(inp.data)) {
+                    PhiInput pi = std::get<PhiInput>(inp.data);
+                    if (!block_idx.count(pi.second)) continue;  // edge is not copied
+                    copy->add_input(PhiInput(map_value(pi.first, pi.second),
+                                             &g.basic_blocks[block_idx[pi.second]]));
+                } else {
+                    copy->add_input(std::get<int>(inp.data));
+                }
+            }
+        }
+
+    entry->add_next1(new_header);
+    for (BasicBlock *bb : region) {
+        BasicBlock *copy = &g.basic_blocks[block_idx[bb]];
+        if (bb->next1) copy->add_next1(&g.basic_blocks[block_idx[bb->next1]]);
+        if (bb->next2) copy->add_next2(&g.basic_blocks[block_idx[bb->next2]]);
+    }
+
+    for (auto phi = header->first_phi; phi && phi->opcode == PHI_OPCODE; phi = phi->next)
+        clones[phi]->add_input(PhiInput(args.at(phi), entry));
+    // pred under header is still in the same iteration of outer loop, it passes the phi on
+    for (auto &[v, phi] : outer_phis) {
+        phi->add_input(PhiInput(args.at(v), entry));
+        for (BasicBlock *pred : header->preds)
+            if (block_idx.count(pred))
+                phi->add_input(
+                    PhiInput(map_value(v, pred), &g.basic_blocks[block_idx[pred]]));
+    }
+    return osr;
+}
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_DEOPT_HPP
@@ -116,6 +116,7 @@ struct DominatorTree {
             assert((int)i == block.id);
 
             nodes[i].block = &block;
+            if (!block.idom) continue;  // unreachable, e.g. left after inlining
             if (block.idom != &block) {
                 nodes[block.idom->id].childs.push_back(&nodes[i]);
                 nodes[i].parent = &nodes[block.idom->id];
@@ -0,0 +1,279 @@
+#ifndef COMPILER_IR_ESCAPE_ANALYSIS_HPP
+#define COMPILER_IR_ESCAPE_ANALYSIS_HPP
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+#include "alias_analysis.hpp"
+#include "doms.hpp"
+#include "graph.hpp"
+#include "pass_stats.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// allocation doesn't escape if its reference is only a base of loads and stores with
+// constant offsets, a null check input or an array length input. such allocations are
+// replaced with ssa values of their slots: phis go to merge blocks under allocation,
+// stores set current value on the way down dominator tree, loads take it. allocation
+// itself becomes const 0, that is what slots start with. null checks of any allocation
+// go away, reference is never null
+class EscapeAnalysis {
+   public:
+    static constexpr int max_slots = 64;  // bigger allocations stay
+
+    int num_replaced = 0;
+    int num_checks_removed = 0;
+
+    explicit EscapeAnalysis(Graph *graph_) : graph(graph_) {}
+
+    // number of replaced allocations
+    int run() {
+        if (!graph || !graph->first) return 0;
+        PassTimer timer("escape analysis", graph);
+
+        DominatorTree tree(*graph);
+        std::vector<Instruction *> allocations;
+        for (auto &bb : graph->basic_blocks)
+            for (auto inst = bb.first_not_phi; inst; inst = inst->next)
+                if (is_allocation(inst)) allocations.push_back(inst);
+
+        for (Instruction *alloc : allocations) {
+            remove_null_checks(alloc);
+            if (escapes(alloc)) continue;
+            replace(alloc, tree);
+            num_replaced++;
+        }
+
+        timer.count("allocations removed", num_replaced);
+        timer.count("null checks removed", num_checks_removed);
+        if (num_replaced || num_checks_removed) graph->version++;
+        return num_replaced;
+    }
+
+    // number of fields or length of array, -1 if not constant
+    static int num_slots(Instruction *alloc) {
+        auto n = constant_value(alloc->inputs[0]);
+        return n && *n >= 0 ? *n : -1;
+    }
+
+    static bool escapes(Instruction *alloc) {
+        int size = num_slots(alloc);
+        if (size < 0 || size > max_slots) return true;
+        bool object = alloc->opcode == NewObject::opcode;
+        for (auto &user : alloc->users) {
+            Instruction *inst = user.inst;
+            if (inst->opcode == NullCheck::opcode) continue;
+            if (inst->opcode == ArrayLength::opcode && !object) continue;
+
+            MemoryAccess access = memory_access(inst);
+            if (access.kind != (object ? MemoryAccess::FIELD : MemoryAccess::ELEMENT))
+                return true;
+            // stored reference goes to memory we don't follow
+            if (access.is_write && inst->inputs[2] == Input(alloc)) return true;
+            auto offset = constant_value(access.offset);
+            if (access.base != alloc || !offset || *offset < 0 || *offset >= size)
+                return true;
+        }
+        // slot that is read and written as different types is not one ssa value
+        return size > 0 && slot_types(alloc).empty();
+    }
+
+    // type of value in each slot, INT64_T where only immediates are stored. empty if
+    // some slot is accessed as different types
+    static std::vector<Types::Type> slot_types(Instruction *alloc) {
+        std::vector<Types::Type> types(num_slots(alloc), Types::VOID_T);
+        for (auto &user : alloc->users) {
+            MemoryAccess access = memory_access(user.inst);
+            if (access.base != alloc || access.kind == MemoryAccess::NONE ||
+                access.kind == MemoryAccess::LENGTH || access.type == Types::VOID_T)
+                continue;
+            Types::Type &type = types[*constant_value(access.offset)];
+            if (type != Types::VOID_T && type != access.type) return {};
+            type = access.type;
+        }
+        for (auto &type : types)
+            if (type == Types::VOID_T) type = Types::INT64_T;
+        return types;
+    }
+
+   private:
+    Graph *graph;
+
+    void remove_null_checks(Instruction *alloc) {
+        std::vector<Instruction *> checks;
+        for (auto &user : alloc->users)
+            if (user.inst->opcode == NullCheck::opcode) checks.push_back(user.inst);
+        for (Instruction *check : checks) {
+            check->bb->remove_instruction(check);
+            delete check;
+            num_checks_removed++;
+        }
+    }
+
+    void replace(Instruction *alloc, DominatorTree &tree) {
+        int size = num_slots(alloc);
+        std::vector<Types::Type> types = slot_types(alloc);
+        BasicBlock *home = alloc->bb;
+
+        // slot that is never stored keeps its zero everywhere, it needs no phis
+        std::vector<bool> stored(size);
+        for (auto &user : alloc->users) {
+            MemoryAccess access = memory_access(user.inst);
+            if (access.is_write) stored[*constant_value(access.offset)] = true;
+        }
+
+        std::unordered_map<BasicBlock *, std::vector<Instruction *>> phis;
+        std::vector<Instruction *> all_phis;
+        for (auto &bb : graph->basic_blocks) {
+            if (bb.preds.size() < 2 || &bb == home || !bb.idom || !dominates(home, &bb))
+                continue;
+            std::vector<Instruction *> &slots = phis[&bb];
+            for (int i = 0; i < size; i++) {
+                slots.push_back(stored[i] ? bb.prepend_phi(types[i]) : nullptr);
+                if (slots.back()) all_phis.push_back(slots.back());
+            }
+        }
+
+        // zero of its type is in slots that are read before any store, allocation itself
+        // is the one of INT64_T
+        std::unordered_map<Types::Type, Instruction *> zeros = {{Types::INT64_T, alloc}};
+        std::vector<Instruction *> current;
+        for (Types::Type type : types) {
+            if (!zeros.count(type))
+                zeros[type] = insert_after(alloc, Const::opcode, type, {0});
+            current.push_back(zeros[type]);
+        }
+        rename(&tree.nodes[home->id], alloc, types, current, phis);
+
+        // length has no users left
+        if (std::holds_alternative<Instruction *>(alloc->inputs[0].data))
+            remove_user(std::get<Instruction *>(alloc->inputs[0].data), alloc);
+        alloc->opcode = Const::opcode;
+        alloc->type = Types::INT64_T;
+        alloc->inputs = {0};
+
+        remove_trivial_phis(all_phis);
+    }
+
+    void rename(DomTreeNode *node, Instruction *alloc,
+                const std::vector<Types::Type> &types, std::vector<Instruction *> current,
+                std::unordered_map<BasicBlock *, std::vector<Instruction *>> &phis) {
+        BasicBlock *bb = node->block;
+        if (phis.count(bb))
+            for (size_t i = 0; i < current.size(); i++)
+                if (phis[bb][i]) current[i] = phis[bb][i];
+
+        Instruction *inst = bb == alloc->bb ? alloc->next : bb->first_not_phi;
+        while (inst) {
+            Instruction *next = inst->next;
+            MemoryAccess access = memory_access(inst);
+            if (inst->opcode == ArrayLength::opcode && access.base == alloc) {
+                remove_user(alloc, inst);
+                inst->opcode = Const::opcode;
+                inst->inputs = {num_slots(alloc)};
+            } else if (access.kind != MemoryAccess::NONE && access.base == alloc) {
+                int slot = *constant_value(access.offset);
+                if (!access.is_write) {
+                    replace_uses(inst, current[slot]);
+                } else if (std::holds_alternative<int>(inst->inputs[2].data)) {
+                    // stored immediate is kept as const in place of store
+                    int value = std::get<int>(inst->inputs[2].data);
+                    remove_inputs(inst);
+                    inst->opcode = Const::opcode;
+                    inst->type = types[slot];
+                    inst->inputs = {value};
+                    current[slot] = inst;
+                    inst = next;
+                    continue;
+                } else {
+                    current[slot] = std::get<Instruction *>(inst->inputs[2].data);
+                }
+                bb->remove_instruction(inst);
+                delete inst;
+            }
+            inst = next;
+        }
+
+        for (BasicBlock *succ : {bb->next1, bb->next2})
+            if (succ && phis.count(succ))
+                for (size_t i = 0; i < current.size(); i++)
+                    if (phis[succ][i]) phis[succ][i]->add_input(PhiInput{current[i], bb});
+        for (DomTreeNode *child : node->childs)
+            rename(child, alloc, types, current, phis);
+    }
+
+    // phis that merge one value go away, then ones that only other phis of slots use
+    void remove_trivial_phis(std::vector<Instruction *> &phis) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (Instruction *&phi : phis) {
+                if (!phi) continue;
+                Instruction *same = nullptr;
+                bool trivial = true;
+                for (auto &inp : phi->inputs) {
+                    Instruction *value = std::get<PhiInput>(inp.data).first;
+                    if (value == phi || value == same) continue;
+                    if (same) trivial = false;
+                    same = value;
+                }
+                if (!trivial || !same) continue;
+                replace_uses(phi, same);
+                remove(phi);
+                changed = true;
+            }
+        }
+
+        std::unordered_set<Instruction *> own(phis.begin(), phis.end()), live;
+        std::vector<Instruction *> work;
+        for (Instruction *phi : phis)
+            if (phi)
+                for (auto &user : phi->users)
+                    if (!own.count(user.inst) && live.insert(phi).second) work.push_back(phi);
+        while (!work.empty()) {
+            Instruction *phi = work.back();
+            work.pop_back();
+            for (auto &inp : phi->inputs) {
+                Instruction *value = std::get<PhiInput>(inp.data).first;
+                if (own.count(value) && live.insert(value).second) work.push_back(value);
+            }
+        }
+
+        // dead ones can use each other, so inputs go first
+        for (Instruction *phi : phis)
+            if (phi && !live.count(phi)) remove_inputs(phi);
+        for (Instruction *&phi : phis)
+            if (phi && !live.count(phi)) remove(phi);
+    }
+
+    static void remove(Instruction *&inst) {
+        inst->bb->remove_instruction(inst);
+        delete inst;
+        inst = nullptr;
+    }
+
+    static void remove_user(Instruction *value, Instruction *user) {
+        auto &users = value->users;
+        users.erase(std::remove_if(users.begin(), users.end(),
+                                   [user](const User &u) { return u.inst == user; }),
+                    users.end());
+    }
+
+    static void remove_inputs(Instruction *inst) {
+        for (auto &inp : inst->inputs)
+            if (std::holds_alternative<Instruction *>(inp.data))
+                remove_user(std::get<Instruction *>(inp.data), inst);
+            else if (std::holds_alternative<PhiInput>(inp.data))
+                remove_user(std::get<PhiInput>(inp.data).first, inst);
+        inst->inputs.clear();
+    }
+};
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_ESCAPE_ANALYSIS_HPP
@@ -1,8 +1,11 @@
 #ifndef COMPILER_IR_GRAPH
 #define COMPILER_IR_GRAPH
 
+#include <algorithm>
 #include <iostream>
 #include <deque>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "basic_block.hpp"
@@ -17,13 +20,17 @@ struct Graph {
     inline static int counter = 0;
 
     const int id;
+    int version = 0;  // passes bump it on change, so cached data knows it is stale
     std::deque<Types::Type> args;
     std::deque<BasicBlock> basic_blocks;
     BasicBlock *first = nullptr;
 
     Graph(int bbnum = 1, std::vector<Types::Type> args_ = {})
         : id(counter++), args(args_.begin(), args_.end()), basic_blocks(bbnum), first(&basic_blocks[0]) {
-        for (size_t i = 0; i < basic_blocks.size(); i++) basic_blocks[i].id = i;
+        for (size_t i = 0; i < basic_blocks.size(); i++) {
+            basic_blocks[i].id = i;
+            basic_blocks[i].graph = this;
+        }
     }
 
     void dump() {
@@ -34,6 +41,73 @@ struct Graph {
     }
 };
 
+// empty block at the end of graph, not connected to anything
+inline BasicBlock *add_block(Graph *graph) {
+    graph->basic_blocks.emplace_back();
+    BasicBlock *bb = &graph->basic_blocks.back();
+    bb->id = graph->basic_blocks.size() - 1;
+    bb->graph = graph;
+    return bb;
+}
+
+// new block on edge from pred to succ, phis of succ take their inputs from it
+inline BasicBlock *split_edge(Graph *graph, BasicBlock *pred, BasicBlock *succ) {
+    BasicBlock *bb = add_block(graph);
+    if (pred->next1 == succ)
+        pred->next1 = bb;
+    else
+        pred->next2 = bb;
+    bb->preds.push_back(pred);
+    bb->next1 = succ;
+    *std::find(succ->preds.begin(), succ->preds.end(), pred) = bb;
+
+    for (auto phi = succ->first_phi; phi && phi->opcode == PHI_OPCODE; phi = phi->next)
+        for (auto &inp : phi->inputs) {
+            PhiInput &pi = std::get<PhiInput>(inp.data);
+            if (pi.second == pred) pi.second = bb;
+        }
+    return bb;
+}
+
+// copy with its own blocks and instructions, passes can change it while graph stays as it
+// is. clones maps instructions of graph to their copies
+inline std::unique_ptr<Graph> clone_graph(Graph *graph,
+                                          std::unordered_map<Instruction *, Instruction *> &clones) {
+    auto copy = std::make_unique<Graph>(
+        graph->basic_blocks.size(),
+        std::vector<Types::Type>(graph->args.begin(), graph->args.end()));
+    copy->version = graph->version;
+    auto block = [&](BasicBlock *bb) { return bb ? &copy->basic_blocks[bb->id] : nullptr; };
+    copy->first = block(graph->first);
+
+    for (BasicBlock &bb : graph->basic_blocks) {
+        BasicBlock *to = block(&bb);
+        to->next1 = block(bb.next1);
+        to->next2 = block(bb.next2);
+        for (BasicBlock *pred : bb.preds) to->preds.push_back(block(pred));
+        to->exec_count = bb.exec_count;
+        to->next1_count = bb.next1_count;
+        to->next2_count = bb.next2_count;
+        for (auto i = bb.first_phi ? bb.first_phi : bb.first_not_phi; i; i = i->next) {
+            clones[i] = to->add_instruction(i->opcode, i->type, {}, i->flags);
+            clones[i]->frame_state = i->frame_state;
+        }
+    }
+
+    for (BasicBlock &bb : graph->basic_blocks)
+        for (auto i = bb.first_phi ? bb.first_phi : bb.first_not_phi; i; i = i->next)
+            for (auto &inp : i->inputs) {
+                if (std::holds_alternative<Instruction *>(inp.data))
+                    clones[i]->add_input(clones.at(std::get<Instruction *>(inp.data)));
+                else if (std::holds_alternative<PhiInput>(inp.data))
+                    clones[i]->add_input(PhiInput{clones.at(std::get<PhiInput>(inp.data).first),
+                                                  block(std::get<PhiInput>(inp.data).second)});
+                else
+                    clones[i]->add_input(std::get<int>(inp.data));
+            }
+    return copy;
+}
+
 }  // namespace IR
 }  // namespace Compiler
 
@@ -0,0 +1,277 @@
+#ifndef COMPILER_IR_GRAPH_COLORING_ALLOCATOR_HPP
+#define COMPILER_IR_GRAPH_COLORING_ALLOCATOR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "basic_block.hpp"
+#include "instruction.hpp"
+#include "linear_scan_allocator.hpp"
+#include "liveness_analyzer.hpp"
+#include "pass_stats.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// Chaitin-Briggs allocator for aot tier, slower than linear scan but looks at the whole
+// method: values interfere if their intervals intersect, phi and its input are merged
+// when Briggs test says it doesn't make coloring harder, then nodes are simplified and
+// colored optimistically. interval is never split, uncolored one lives on stack or is
+// rematerialized. locations are set like LinearScanAllocator does, so LinearScanRewriter
+// works after it. registers that calling convention takes are never given to values
+// live there, operands of calls, returns and arguments get their fixed registers if free.
+// values get only registers of their class
+class GraphColoringAllocator {
+   public:
+    int R;
+    int next_stack_location = 0;
+    int num_spilled = 0;    // values on stack
+    int num_coalesced = 0;  // phi copies that are gone
+
+    GraphColoringAllocator(LivenessAnalyzer &liveness, int num_registers)
+        : GraphColoringAllocator(liveness, RegisterConfig::uniform(num_registers)) {}
+
+    GraphColoringAllocator(LivenessAnalyzer &liveness, const RegisterConfig &config_)
+        : R(config_.num_registers),
+          config(config_),
+          fixed(fixed_intervals(liveness, config_)) {
+        PassTimer timer("graph coloring", liveness.get_graph());
+        for (auto &pair : liveness.intervals)
+            if (!pair.second.ranges.empty()) nodes.push_back(&pair.second);
+        // deterministic order
+        std::sort(nodes.begin(), nodes.end(), [](LiveInterval *a, LiveInterval *b) {
+            return a->reg->id < b->reg->id;
+        });
+        for (size_t i = 0; i < nodes.size(); i++) index[nodes[i]] = i;
+        leader.resize(nodes.size());
+        std::iota(leader.begin(), leader.end(), 0);
+        for (size_t i = 0; i < nodes.size(); i++) {
+            group.push_back({(int)i});
+            weight.push_back(nodes[i]->spill_weight(config.has_calling_convention()));
+        }
+
+        build_interference();
+        if (config.has_calling_convention()) collect_fixed_registers(liveness);
+        coalesce(liveness);
+        std::vector<int> order = simplify();
+        select(order);
+        for (auto &[inst, interval] : liveness.intervals) inst->loc = interval.loc;
+        timer.count("spilled", num_spilled);
+        timer.count("coalesced", num_coalesced);
+    }
+
+   private:
+    RegisterConfig config;
+    std::vector<LiveInterval> fixed;
+    std::unordered_map<int, int> wanted;  // node to register it is copied from or to
+    std::vector<LiveInterval *> nodes;
+    std::unordered_map<LiveInterval *, int> index;
+    std::vector<int> leader;                         // merged nodes point to one of them
+    std::vector<std::unordered_set<int>> adjacent;  // only for leaders
+    std::vector<std::vector<int>> group;             // members of leaders
+    std::vector<double> weight;                      // spill weight of whole group
+
+    int find(int n) { return leader[n] == n ? n : leader[n] = find(leader[n]); }
+
+    void build_interference() {
+        adjacent.resize(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+            for (size_t j = i + 1; j < nodes.size(); j++)
+                if (nodes[i]->next_intersection(*nodes[j]) >= 0) {
+                    adjacent[i].insert(j);
+                    adjacent[j].insert(i);
+                }
+    }
+
+    int degree(int n) const { return adjacent[n].size(); }
+
+    void collect_fixed_registers(LivenessAnalyzer &liveness) {
+        auto want = [&](const Input &value, int reg) {
+            if (!std::holds_alternative<Instruction *>(value.data)) return;
+            LiveInterval *interval =
+                liveness.get_live_interval(std::get<Instruction *>(value.data));
+            if (interval && index.count(interval)) wanted.emplace(index[interval], reg);
+        };
+        for (BasicBlock *bb : liveness.linear_order)
+            for (auto inst = bb->first_not_phi; inst; inst = inst->next)
+                if (inst->opcode == Call::opcode) {
+                    want(inst, config.return_reg);
+                    for (size_t i = 1; i < inst->inputs.size(); i++)
+                        if (i - 1 < config.arg_regs.size())
+                            want(inst->inputs[i], config.arg_regs[i - 1]);
+                } else if (inst->opcode == Ret::opcode && !inst->inputs.empty()) {
+                    want(inst->inputs[0], config.return_reg);
+                } else if (inst->opcode == GetArg::opcode) {
+                    size_t idx = std::get<int>(inst->inputs[0].data);
+                    if (idx < config.arg_regs.size()) want(inst, config.arg_regs[idx]);
+                }
+    }
+
+    // register is taken by calling convention somewhere in a member of n or is of other
+    // class. members are of the same type
+    bool is_fixed(int n, int reg) {
+        if (!config.can_hold(reg, nodes[n]->reg->type)) return true;
+        if (fixed[reg].ranges.empty()) return false;
+        for (int m : members(n))
+            if (fixed[reg].next_intersection(*nodes[m]) >= 0) return true;
+        return false;
+    }
+
+    // copies in hot loops go first
+    void coalesce(LivenessAnalyzer &liveness) {
+        std::unordered_map<BasicBlock *, int> depth;
+        for (size_t i = 0; i < liveness.linear_order.size(); i++)
+            depth[liveness.linear_order[i]] = liveness.loop_depth[i];
+
+        struct Copy {
+            int a, b, depth;
+        };
+        std::vector<Copy> copies;
+        for (BasicBlock *bb : liveness.linear_order)
+            for (auto phi = bb->first_phi; phi && phi->opcode == PHI_OPCODE; phi = phi->next) {
+                LiveInterval *phi_interval = liveness.get_live_interval(phi);
+                if (!phi_interval || !index.count(phi_interval)) continue;
+                for (auto &inp : phi->inputs) {
+                    PhiInput pi = std::get<PhiInput>(inp.data);
+                    LiveInterval *input = liveness.get_live_interval(pi.first);
+                    if (!input || !index.count(input) || !depth.count(pi.second)) continue;
+                    copies.push_back({index[phi_interval], index[input], depth[pi.second]});
+                }
+            }
+        std::stable_sort(copies.begin(), copies.end(),
+                         [](const Copy &x, const Copy &y) { return x.depth > y.depth; });
+
+        for (const Copy &c : copies) {
+            int a = find(c.a), b = find(c.b);
+            if (a == b || adjacent[a].count(b) || !briggs_test(a, b)) continue;
+            merge(a, b);
+            num_coalesced++;
+        }
+    }
+
+    // merged node has less than R neighbours of significant degree
+    bool briggs_test(int a, int b) const {
+        std::unordered_set<int> neighbours(adjacent[a].begin(), adjacent[a].end());
+        neighbours.insert(adjacent[b].begin(), adjacent[b].end());
+        int significant = 0;
+        for (int n : neighbours) {
+            // neighbour of both loses one edge after merge
+            int d = degree(n) - (adjacent[a].count(n) && adjacent[b].count(n) ? 1 : 0);
+            if (d >= R) significant++;
+        }
+        return significant < R;
+    }
+
+    void merge(int a, int b) {
+        leader[b] = a;
+        for (int n : adjacent[b]) {
+            adjacent[n].erase(b);
+            adjacent[n].insert(a);
+            adjacent[a].insert(n);
+        }
+        adjacent[b].clear();
+        group[a].insert(group[a].end(), group[b].begin(), group[b].end());
+        group[b].clear();
+        weight[a] += weight[b];
+    }
+
+    // n is a leader
+    const std::vector<int> &members(int n) const { return group[n]; }
+
+    double spill_cost(int n) const { return weight[n] / std::max(1, degree(n)); }
+
+    // removes nodes of low degree first, when there are none removes cheapest one and
+    // hopes it will get color anyway. returns order of coloring. degree is low when it is
+    // less than registers that calling convention leaves to the node
+    std::vector<int> simplify() {
+        std::vector<int> degrees(nodes.size()), colors(nodes.size());
+        std::vector<bool> removed(nodes.size());
+        size_t left = 0;
+        for (size_t i = 0; i < nodes.size(); i++)
+            if (find(i) == (int)i) {
+                degrees[i] = degree(i);
+                for (int r = 0; r < R; r++) colors[i] += !is_fixed(i, r);
+                left++;
+            } else {
+                removed[i] = true;
+            }
+
+        std::vector<int> stack;
+        while (left > 0) {
+            int next = -1;
+            for (size_t i = 0; i < nodes.size() && next < 0; i++)
+                if (!removed[i] && degrees[i] < colors[i]) next = i;
+            if (next < 0)
+                for (size_t i = 0; i < nodes.size(); i++)
+                    if (!removed[i] && (next < 0 || spill_cost(i) < spill_cost(next))) next = i;
+
+            removed[next] = true;
+            left--;
+            stack.push_back(next);
+            for (int n : adjacent[next]) degrees[n]--;
+        }
+        std::reverse(stack.begin(), stack.end());
+        return stack;
+    }
+
+    void select(const std::vector<int> &order) {
+        std::vector<int> color(nodes.size(), -1);
+        std::vector<int> spilled;
+        for (int n : order) {
+            std::vector<bool> used(R);
+            for (int m : adjacent[n])
+                if (color[m] >= 0) used[color[m]] = true;
+            for (int r = 0; r < R; r++)
+                if (!used[r] && is_fixed(n, r)) used[r] = true;
+            auto free = std::find(used.begin(), used.end(), false);
+            if (free == used.end()) {
+                spilled.push_back(n);
+                continue;
+            }
+            color[n] = free - used.begin();
+            for (int m : members(n))
+                if (wanted.count(m) && !used[wanted[m]]) color[n] = wanted[m];
+            for (int m : members(n)) nodes[m]->loc = {LocationType::REGISTER, color[n]};
+        }
+
+        // stack slots are colored the same way, phis are written at the end of preds
+        std::vector<std::vector<LiveRange>> slot_busy;
+        for (int n : spilled)
+            for (int m : members(n)) {
+                LiveInterval *interval = nodes[m];
+                num_spilled++;
+                if (is_rematerializable(interval->reg, config.has_calling_convention())) {
+                    interval->loc = {LocationType::REMAT, 0};
+                    continue;
+                }
+                std::vector<LiveRange> busy = interval->ranges;
+                if (interval->reg->opcode == PHI_OPCODE)
+                    for (BasicBlock *pred : interval->reg->bb->preds)
+                        if (pred->linear_from >= 0)
+                            busy.push_back({pred->linear_to - 1, pred->linear_to});
+
+                size_t slot = 0;
+                auto overlaps = [&](const std::vector<LiveRange> &other) {
+                    for (const LiveRange &a : busy)
+                        for (const LiveRange &b : other)
+                            if (a.start < b.end && b.start < a.end) return true;
+                    return false;
+                };
+                while (slot < slot_busy.size() && overlaps(slot_busy[slot])) slot++;
+                if (slot == slot_busy.size()) slot_busy.emplace_back();
+                slot_busy[slot].insert(slot_busy[slot].end(), busy.begin(), busy.end());
+                interval->spill_slot = slot;
+                interval->loc = {LocationType::STACK, (int)slot};
+            }
+        next_stack_location = slot_busy.size();
+    }
+};
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_GRAPH_COLORING_ALLOCATOR_HPP
@@ -0,0 +1,181 @@
+#ifndef COMPILER_IR_IF_CONVERSION_HPP
+#define COMPILER_IR_IF_CONVERSION_HPP
+
+#include <algorithm>
+#include <variant>
+#include <vector>
+
+#include "doms.hpp"
+#include "graph.hpp"
+#include "pass_stats.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// if-conversion. diamond or triangle whose arms only compute values is replaced with
+// selects in the block that branches:
+//   head: if t, f   t: a = ...   f: b = ...   join: x = phi [a, t], [b, f]
+// becomes
+//   head: a = ... b = ... x = select c, a, b   goto join
+// where c is the condition of head. both arms are executed then, so they must be short,
+// without side effects and unable to fail. branches that profile shows as biased stay,
+// they are predicted well anyway. join that is left with head as its only pred is merged
+// into it, so diamonds nested in arms go too. arm blocks stay in graph without
+// instructions and edges
+class IfConversion {
+   public:
+    static constexpr int max_arm_size = 4;        // instructions in one arm
+    static constexpr double biased_ratio = 0.05;  // rarer side of branches that stay
+
+    int num_converted = 0;  // diamonds and triangles
+    int num_selects = 0;
+
+    explicit IfConversion(Graph *graph_) : graph(graph_) {}
+
+    // number of removed branches
+    int run() {
+        if (!graph || !graph->first) return 0;
+        PassTimer timer("if conversion", graph);
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            // post order, so inner diamonds go before the ones around them
+            std::vector<BasicBlock *> rpo = get_reverse_post_order(graph);
+            for (auto it = rpo.rbegin(); it != rpo.rend(); ++it)
+                if (convert(*it)) {
+                    num_converted++;
+                    changed = true;
+                }
+        }
+
+        timer.count("branches converted", num_converted);
+        timer.count("selects", num_selects);
+        if (num_converted) graph->version++;
+        return num_converted;
+    }
+
+   private:
+    Graph *graph;
+
+    static bool is_speculatable(Instruction *inst) {
+        if (Types::is_vector(inst->type)) return false;
+        switch (inst->opcode) {
+            case Const::opcode:
+            case GetArg::opcode:
+            case Add::opcode:
+            case Sub::opcode:
+            case Mul::opcode:
+            case And::opcode:
+            case Shr::opcode:
+            case Shl::opcode:
+            case Eq::opcode:
+            case Select::opcode:
+                return true;
+        }
+        return false;
+    }
+
+    // block with head as its only pred that goes to one block
+    static bool is_arm(BasicBlock *bb, BasicBlock *head) {
+        if (bb == head || bb->preds.size() != 1 || bb->next2 || !bb->next1 ||
+            bb->first_phi)
+            return false;
+        int size = 0;
+        for (auto inst = bb->first_not_phi; inst; inst = inst->next)
+            if (++size > max_arm_size || !is_speculatable(inst)) return false;
+        return true;
+    }
+
+    static bool is_biased(BasicBlock *head) {
+        if (head->next1_count < 0 || head->next2_count < 0) return false;
+        int64_t total = head->next1_count + head->next2_count;
+        return total > 0 &&
+               std::min(head->next1_count, head->next2_count) < total * biased_ratio;
+    }
+
+    bool convert(BasicBlock *head) {
+        if (!head->next2 || !head->last || head->next1 == head->next2 || is_biased(head))
+            return false;
+
+        // t or f is nullptr if that side goes to join directly
+        BasicBlock *t = head->next1, *f = head->next2, *join;
+        if (is_arm(t, head) && is_arm(f, head) && t->next1 == f->next1) {
+            join = t->next1;
+        } else if (is_arm(t, head) && t->next1 == f) {
+            join = f;
+            f = nullptr;
+        } else if (is_arm(f, head) && f->next1 == t) {
+            join = t;
+            t = nullptr;
+        } else {
+            return false;
+        }
+        if (join == head || join->preds.size() != 2) return false;
+        for (auto phi = join->first_phi; phi && phi->opcode == PHI_OPCODE; phi = phi->next)
+            if (Types::is_vector(phi->type)) return false;
+
+        Instruction *cond = head->last;
+        for (BasicBlock *arm : {t, f})
+            if (arm)
+                while (arm->first_not_phi) move_to_end(arm->first_not_phi, head);
+
+        while (join->first_phi) {
+            Instruction *phi = join->first_phi;
+            Instruction *a = phi_input(phi, t ? t : head);
+            Instruction *b = phi_input(phi, f ? f : head);
+            if (!a || !b) throw "if conversion: phi has no input for pred";
+            Instruction *value = a;
+            if (a != b) {
+                value = head->add_instruction(Select::opcode, phi->type, {cond, a, b});
+                num_selects++;
+            }
+            replace_uses(phi, value);
+            join->remove_instruction(phi);
+            delete phi;
+        }
+
+        for (BasicBlock *arm : {t, f})
+            if (arm) {
+                arm->preds.clear();
+                arm->next1 = nullptr;
+                arm->exec_count = arm->next1_count = -1;
+            }
+        head->next1 = join;
+        head->next2 = nullptr;
+        head->next1_count = head->exec_count;
+        head->next2_count = -1;
+        join->preds = {head};
+        merge(head, join);
+        return true;
+    }
+
+    // join has head as its only pred and no phis
+    void merge(BasicBlock *head, BasicBlock *join) {
+        if (join == graph->first) return;
+        while (join->first_not_phi) move_to_end(join->first_not_phi, head);
+        head->next1 = join->next1;
+        head->next2 = join->next2;
+        head->next1_count = join->next1_count;
+        head->next2_count = join->next2_count;
+        for (BasicBlock *succ : {join->next1, join->next2}) {
+            if (!succ) continue;
+            std::replace(succ->preds.begin(), succ->preds.end(), join, head);
+            for (auto phi = succ->first_phi; phi && phi->opcode == PHI_OPCODE;
+                 phi = phi->next)
+                for (auto &inp : phi->inputs)
+                    if (std::get<PhiInput>(inp.data).second == join)
+                        inp.data = PhiInput{std::get<PhiInput>(inp.data).first, head};
+        }
+        join->preds.clear();
+        join->next1 = join->next2 = nullptr;
+        join->exec_count = join->next1_count = join->next2_count = -1;
+    }
+};
+
+inline int convert_ifs(Graph *graph) { return IfConversion(graph).run(); }
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_IF_CONVERSION_HPP
@@ -2,71 +2,373 @@
 #define COMPILER_IR_INLINER
 
 #include <algorithm>
+#include <cmath>
 #include <functional>
+#include <memory>
+#include <queue>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "basic_block.hpp"
 #include "graph.hpp"
 #include "instruction.hpp"
+#include "loop_analyser.hpp"
+#include "optimizer.hpp"
+#include "pass_stats.hpp"
+#include "profile.hpp"
 
 namespace Compiler {
 namespace IR {
 
+// callee body flattened into a form that is cheap to clone: blocks and instructions
+// are numbered densely, so remapping on clone is done with arrays, not hash maps
+struct CalleeTemplate {
+    struct InputTemplate {
+        enum Kind { INST, INT, PHI } kind;
+        int value;       // instruction index or immediate
+        int block = -1;  // predecessor block index for phi inputs
+    };
+
+    struct InstTemplate {
+        opcode_t opcode;
+        Types::Type type;
+        std::bitset<8> flags;
+        int first_input = 0;  // slice of inputs
+        int num_inputs = 0;
+    };
+
+    struct BlockTemplate {
+        int first_inst = 0;  // slice of insts
+        int num_insts = 0;
+        int next1 = -1;
+        int next2 = -1;
+        int64_t exec_count = -1;
+        int loop_depth = 0;
+    };
+
+    int version = -1;  // version of graph this template was built from
+    int entry = -1;
+    int64_t entry_count = -1;
+    bool has_deopts = false;  // frame states are per method, they can't be cloned
+
+    std::vector<BlockTemplate> blocks;
+    std::vector<InstTemplate> insts;
+    std::vector<InputTemplate> inputs;
+
+    size_t size() const { return insts.size(); }
+
+    CalleeTemplate() = default;
+
+    explicit CalleeTemplate(Graph *g) : version(g->version) {
+        // only place where hash map is needed, it is done once per callee version
+        std::unordered_map<Instruction *, int> inst_idx;
+        for (auto &bb : g->basic_blocks)
+            for (auto i = bb.first_phi ? bb.first_phi : bb.first_not_phi; i; i = i->next)
+                inst_idx.emplace(i, inst_idx.size());
+
+        LoopAnalyzer loops(g);
+        entry = g->first->id;
+        entry_count = g->first->exec_count;
+
+        for (auto &bb : g->basic_blocks) {
+            BlockTemplate block;
+            block.first_inst = insts.size();
+            block.next1 = bb.next1 ? bb.next1->id : -1;
+            block.next2 = bb.next2 ? bb.next2->id : -1;
+            block.exec_count = bb.exec_count;
+            block.loop_depth = loops.get_loop_depth(&bb);
+
+            for (auto i = bb.first_phi ? bb.first_phi : bb.first_not_phi; i; i = i->next) {
+                InstTemplate inst{i->opcode, i->type, i->flags, (int)inputs.size(),
+                                  (int)i->inputs.size()};
+                if (i->opcode == Deopt::opcode) has_deopts = true;
+                for (auto &inp : i->inputs) {
+                    if (std::holds_alternative<Instruction *>(inp.data)) {
+                        inputs.push_back({InputTemplate::INST,
+                                          inst_idx.at(std::get<Instruction *>(inp.data))});
+                    } else if (std::holds_alternative<PhiInput>(inp.data)) {
+                        PhiInput pi = std::get<PhiInput>(inp.data);
+                        inputs.push_back(
+                            {InputTemplate::PHI, inst_idx.at(pi.first), pi.second->id});
+                    } else {
+                        inputs.push_back({InputTemplate::INT, std::get<int>(inp.data)});
+                    }
+                }
+                insts.push_back(inst);
+            }
+            block.num_insts = insts.size() - block.first_inst;
+            blocks.push_back(block);
+        }
+    }
+};
+
 class Inliner {
    public:
-    size_t max_callee_size = 50;
+    size_t max_callee_size = 50;       // for ordinary call sites
+    size_t max_hot_callee_size = 200;  // for call sites at least hot_threshold hot
     size_t max_total_size = 1000;
 
+    double hot_threshold = 10;     // expected executions per caller invocation
+    double loop_frequency = 10;    // assumed iterations of a loop if there is no profile
+    size_t const_arg_bonus = 5;    // instructions expected to fold per constant argument
+
     // used to get method graph by id. ideally by method table, in tests some lambda
     std::function<Graph *(int)> resolve_callee;
 
+    // targets seen by indirect call in tier 0, may be empty or return nullptr
+    std::function<CallTargetProfile *(Instruction *)> call_profile;
+    double speculation_ratio = 0.9;  // share of calls profiled target needs for guard
+
     Inliner(std::function<Graph *(int)> resolver) : resolve_callee(resolver) {}
 
+    bool optimize_callees = true;  // run Optimizer on callee before it is inlined
+    int max_inline_depth = 8;      // limit for nested (e.g. recursive) inlining
+
+    struct CallSite {
+        Instruction *call = nullptr;
+        Graph *callee = nullptr;
+        double hotness = 0;   // expected executions per caller invocation
+        double priority = 0;  // benefit per instruction of growth
+        int depth = 0;        // 0 for calls of caller itself, +1 per inlined body
+        int target = -1;      // profiled callee of indirect call, inlined under guard
+
+        bool operator<(const CallSite &other) const { return priority < other.priority; }
+    };
+
     bool run(Graph *caller) {
+        PassTimer timer("inline", caller);
+        in_progress.insert(caller);
         bool modified = false;
-        bool changed_in_iteration = false;
-
-        // this weird loop because inliner may invalidate iterator
-        do {
-            changed_in_iteration = false;
-            std::vector<Instruction *> calls_to_inline;
-
-            // 1. find calls
-            for (auto &bb : caller->basic_blocks) {
-                Instruction *curr = bb.first_phi ? bb.first_phi : bb.first_not_phi;
-                while (curr) {
-                    if (curr->opcode == Call::opcode && !curr->inputs.empty() &&
-                        std::holds_alternative<int>(curr->inputs[0].data)) {
-                        int callee_id = std::get<int>(curr->inputs[0].data);
-                        Graph *callee = resolve_callee(callee_id);
-
-                        // 2. if possible, inline
-                        if (callee && can_inline(caller, callee)) {
-                            inline_call(caller, callee, curr);
-                            changed_in_iteration = true;
-                            modified = true;
-                            break;
-                        }
-                    }
-                    curr = curr->next;
-                }
-                if (changed_in_iteration) break;
+        size_t caller_size = compute_graph_size(caller);
+
+        // call sites are collected once and calls from inlined bodies are added when
+        // they appear. hottest and cheapest go first, so they get the budget
+        std::priority_queue<CallSite> queue;
+        LoopAnalyzer loops(caller);
+        for (auto &bb : caller->basic_blocks) {
+            double estimate = std::pow(loop_frequency, loops.get_loop_depth(&bb));
+            add_call_sites(queue, caller, &bb, get_hotness(caller, &bb, estimate), 0);
+        }
+
+        while (!queue.empty()) {
+            CallSite site = queue.top();
+            queue.pop();
+            if (!can_inline(site, caller_size)) continue;
+
+            caller_size += get_template(site.callee).size();
+            Instruction *call = site.call;
+            if (site.target >= 0) {
+                call = speculate_call(caller, call, site.target);
+                caller_size += guard_size;
             }
-        } while (changed_in_iteration);
+            std::vector<BasicBlock *> cloned = inline_call(caller, site.callee, call);
+            modified = true;
+            timer.count(site.target >= 0 ? "speculative inlines" : "inlines");
+
+            if (site.depth + 1 >= max_inline_depth) continue;
+            const CalleeTemplate &tmpl = get_template(site.callee);
+            for (size_t i = 0; i < cloned.size(); i++) {
+                double estimate =
+                    site.hotness * std::pow(loop_frequency, tmpl.blocks[i].loop_depth);
+                add_call_sites(queue, caller, cloned[i],
+                               get_hotness(caller, cloned[i], estimate), site.depth + 1);
+            }
+        }
 
+        in_progress.erase(caller);
+        if (modified) caller->version++;
         return modified;
     }
 
+    // templates are rebuilt when graph version changes, this is for changes that did
+    // not bump it
+    void invalidate(Graph *g) { templates.erase(g); }
+
+    size_t templates_built = 0;  // how many times callees were prepared
+
    private:
-    bool can_inline(Graph *caller, Graph *callee) {
-        if (get_graph_size(callee) > max_callee_size) return false;
-        if (get_graph_size(caller) + get_graph_size(callee) > max_total_size)
+    // prepared callees, shared by all callers this inliner runs on
+    std::unordered_map<Graph *, CalleeTemplate> templates;
+    std::unordered_set<Graph *> in_progress;  // graphs on the stack, to break cycles
+    std::unordered_map<Graph *, Graph *> copied_from;  // copies that templates are built of
+
+    static const size_t guard_size = 4;  // const, compare, direct call and phi
+
+    void add_call_sites(std::priority_queue<CallSite> &queue, Graph *caller,
+                        BasicBlock *bb, double hotness, int depth) {
+        for (Instruction *curr = bb->first_phi ? bb->first_phi : bb->first_not_phi; curr;
+             curr = curr->next) {
+            if (curr->opcode != Call::opcode || curr->inputs.empty()) continue;
+            devirtualize(curr);
+
+            CallSite site;
+            site.call = curr;
+            site.hotness = hotness;
+            site.depth = depth;
+
+            if (std::holds_alternative<int>(curr->inputs[0].data)) {
+                site.callee = resolve_callee(std::get<int>(curr->inputs[0].data));
+            } else if (CallTargetProfile *profile = call_profile ? call_profile(curr)
+                                                                 : nullptr) {
+                auto target = profile->dominant_target(speculation_ratio);
+                if (!target) continue;
+                site.callee = resolve_callee(*target);
+                site.target = *target;
+                site.hotness *= profile->get_ratio(*target);
+            }
+
+            auto copy = copied_from.find(caller);
+            if (!site.callee || site.callee == caller || !site.callee->first ||
+                (copy != copied_from.end() && site.callee == copy->second))
+                continue;
+            get_template(site.callee);
+
+            site.priority = site.hotness / get_cost(site);
+            queue.push(site);
+        }
+    }
+
+    // indirect call of constant is just a direct call
+    static void devirtualize(Instruction *call) {
+        auto &data = call->inputs[0].data;
+        if (!std::holds_alternative<Instruction *>(data)) return;
+        Instruction *target = std::get<Instruction *>(data);
+        if (target->opcode != Const::opcode ||
+            !std::holds_alternative<int>(target->inputs[0].data))
+            return;
+
+        data = std::get<int>(target->inputs[0].data);
+        auto &users = target->users;
+        auto it = std::find_if(users.begin(), users.end(),
+                               [call](User &u) { return u.inst == call; });
+        if (it != users.end()) users.erase(it);
+    }
+
+    // call_bb: ... guard = target == expected
+    //   true -> fast: direct call of expected target -> cont
+    //   false -> slow: original indirect call -> cont
+    // cont: phi(fast result, slow result) ...
+    // returns direct call, so it can be inlined as any other one
+    Instruction *speculate_call(Graph *caller, Instruction *call, int expected) {
+        BasicBlock *call_bb = call->bb;
+        BasicBlock *cont = split_block_after(caller, call);
+        BasicBlock *fast = add_block(caller);
+        BasicBlock *slow = add_block(caller);
+
+        CallTargetProfile *profile = call_profile(call);
+        if (call_bb->exec_count >= 0) {
+            double ratio = profile->get_ratio(expected);
+            fast->exec_count = call_bb->exec_count * ratio;
+            slow->exec_count = call_bb->exec_count - fast->exec_count;
+        }
+
+        // move indirect call to slow path, it is the last one in call_bb after split
+        call_bb->last = call->prev;
+        if (call->prev) call->prev->next = nullptr;
+        if (call_bb->first_not_phi == call) call_bb->first_not_phi = nullptr;
+        if (call_bb->first_phi == call) call_bb->first_phi = nullptr;
+        call->prev = nullptr;
+        call->bb = slow;
+        slow->first_not_phi = slow->last = call;
+
+        Instruction *direct = fast->add_instruction(call->opcode, call->type, {expected},
+                                                    call->flags);
+        for (size_t i = 1; i < call->inputs.size(); i++) {
+            auto &data = call->inputs[i].data;
+            if (std::holds_alternative<Instruction *>(data))
+                direct->add_input(std::get<Instruction *>(data));
+            else
+                direct->add_input(std::get<int>(data));
+        }
+
+        Instruction *target = std::get<Instruction *>(call->inputs[0].data);
+        Instruction *expected_inst =
+            call_bb->add_instruction(Const::opcode, target->type, {expected});
+        call_bb->add_<EqBool>({target, expected_inst});
+        call_bb->add_next1(fast);
+        call_bb->add_next2(slow);
+        fast->add_next1(cont);
+        slow->add_next1(cont);
+
+        if (!call->users.empty()) {
+            Instruction *phi = cont->prepend_phi(call->type);
+            replace_uses(call, phi);
+            phi->add_input(PhiInput{direct, fast});
+            phi->add_input(PhiInput{call, slow});
+        }
+        return direct;
+    }
+
+    // bottom-up over call graph: copy of callee gets its own calls inlined and is optimized
+    // once, before it is inlined anywhere. callee itself is not changed, resolver may give
+    // it to others. callees on the stack (recursion) are taken as is
+    const CalleeTemplate &get_template(Graph *callee) {
+        auto it = templates.find(callee);
+        if (it != templates.end() && it->second.version == callee->version)
+            return it->second;
+
+        templates_built++;
+        if (in_progress.count(callee)) return templates[callee] = CalleeTemplate(callee);
+
+        std::unordered_map<Instruction *, Instruction *> clones, originals;
+        std::unique_ptr<Graph> copy = clone_graph(callee, clones);
+        for (auto &[original, clone] : clones) originals[clone] = original;
+        // profiles are recorded for instructions of callee
+        auto profile = call_profile;
+        if (profile)
+            call_profile = [&](Instruction *call) {
+                auto original = originals.find(call);
+                return profile(original != originals.end() ? original->second : call);
+            };
+        in_progress.insert(callee);
+        copied_from[copy.get()] = callee;
+        run(copy.get());
+        copied_from.erase(copy.get());
+        in_progress.erase(callee);
+        call_profile = profile;
+        if (optimize_callees) Optimizer::optimize(copy.get());
+
+        CalleeTemplate tmpl(copy.get());
+        tmpl.version = callee->version;
+        return templates[callee] = std::move(tmpl);
+    }
+
+    // expected executions of bb per invocation of graph
+    double get_hotness(Graph *graph, BasicBlock *bb, double estimate) const {
+        // prefer real block counts, fall back to static estimation
+        if (graph->first->exec_count > 0 && bb->exec_count >= 0)
+            return double(bb->exec_count) / graph->first->exec_count;
+        return estimate;
+    }
+
+    // constant arguments are likely to fold after inlining, so they make callee cheaper
+    size_t get_cost(const CallSite &site) {
+        size_t const_args = 0;
+        for (size_t i = 1; i < site.call->inputs.size(); i++) {
+            auto &data = site.call->inputs[i].data;
+            if (std::holds_alternative<int>(data) ||
+                (std::holds_alternative<Instruction *>(data) &&
+                 std::get<Instruction *>(data)->opcode == Const::opcode))
+                const_args++;
+        }
+
+        size_t size = get_template(site.callee).size();
+        if (size <= 1) return 1;
+        return size - std::min(const_args * const_arg_bonus, size - 1);
+    }
+
+    bool can_inline(const CallSite &site, size_t caller_size) {
+        size_t limit =
+            site.hotness >= hot_threshold ? max_hot_callee_size : max_callee_size;
+        if (get_template(site.callee).has_deopts) return false;
+        if (get_cost(site) > limit) return false;
+        if (caller_size + get_template(site.callee).size() > max_total_size)
             return false;
         return true;
     }
 
-    size_t get_graph_size(Graph *g) {
+    static size_t compute_graph_size(Graph *g) {
         size_t size = 0;
         for (auto &bb : g->basic_blocks) {
             Instruction *curr = bb.first_phi ? bb.first_phi : bb.first_not_phi;
@@ -78,42 +380,38 @@ class Inliner {
         return size;
     }
 
-    void inline_call(Graph *caller, Graph *callee, Instruction *call_inst) {
-        BasicBlock *call_bb = call_inst->bb;
-
-        // 1. split block with call
-        caller->basic_blocks.emplace_back();
-        BasicBlock *call_cont_block = &caller->basic_blocks.back();
-        call_cont_block->id = caller->basic_blocks.size() - 1;
-        call_cont_block->graph = caller;
+    // moves instructions after inst and successors of its block to a new block
+    BasicBlock *split_block_after(Graph *graph, Instruction *inst) {
+        BasicBlock *bb = inst->bb;
+        BasicBlock *cont = add_block(graph);
+        cont->exec_count = bb->exec_count;
 
-        // move instructions after call_inst to call_cont_block
-        Instruction *curr = call_inst->next;
-        call_inst->next = nullptr;
-        call_bb->last = call_inst;
+        // move instructions after inst to cont
+        Instruction *curr = inst->next;
+        inst->next = nullptr;
+        bb->last = inst;
 
         if (curr) curr->prev = nullptr;
         while (curr) {
             Instruction *next = curr->next;
-            curr->bb = call_cont_block;
-            curr->prev = call_cont_block->last;
+            curr->bb = cont;
+            curr->prev = cont->last;
 
-            if (call_cont_block->last) call_cont_block->last->next = curr;
+            if (cont->last) cont->last->next = curr;
 
             if (curr->opcode == PHI_OPCODE) {
-                if (!call_cont_block->first_phi) call_cont_block->first_phi = curr;
+                if (!cont->first_phi) cont->first_phi = curr;
             } else {
-                if (!call_cont_block->first_not_phi)
-                    call_cont_block->first_not_phi = curr;
+                if (!cont->first_not_phi) cont->first_not_phi = curr;
             }
 
-            call_cont_block->last = curr;
+            cont->last = curr;
             curr = next;
         }
 
         // transfer successors
-        call_cont_block->next1 = call_bb->next1;
-        call_cont_block->next2 = call_bb->next2;
+        cont->next1 = bb->next1;
+        cont->next2 = bb->next2;
 
         auto replace_pred = [&](BasicBlock *succ, BasicBlock *old_pred,
                                 BasicBlock *new_pred) {
@@ -133,31 +431,44 @@ class Inliner {
             }
         };
 
-        replace_pred(call_cont_block->next1, call_bb, call_cont_block);
-        replace_pred(call_cont_block->next2, call_bb, call_cont_block);
-        call_bb->next1 = nullptr;
-        call_bb->next2 = nullptr;
+        replace_pred(cont->next1, bb, cont);
+        replace_pred(cont->next2, bb, cont);
+        bb->next1 = nullptr;
+        bb->next2 = nullptr;
+        return cont;
+    }
+
+    // returns cloned blocks in order of callee's blocks
+    std::vector<BasicBlock *> inline_call(Graph *caller, Graph *callee,
+                                          Instruction *call_inst) {
+        BasicBlock *call_bb = call_inst->bb;
+        // block that branches on the call directly has no user of it, it branches on last
+        // instruction. returned value becomes last instruction of call_cont_block then
+        bool branches_on_call = call_bb->next2 && call_bb->last == call_inst;
+
+        // 1. split block with call
+        BasicBlock *call_cont_block = split_block_after(caller, call_inst);
 
         remove_instruction(call_inst);
 
-        // 2. clone callee blocks and instructions
-        std::unordered_map<BasicBlock *, BasicBlock *> bb_map;
-        std::unordered_map<Instruction *, Instruction *> inst_map;
-
-        for (auto &callee_bb : callee->basic_blocks) {
-            caller->basic_blocks.emplace_back();
-            BasicBlock *cloned_bb = &caller->basic_blocks.back();
-            cloned_bb->id = caller->basic_blocks.size() - 1;
-            cloned_bb->graph = caller;
-            bb_map[&callee_bb] = cloned_bb;
-
-            Instruction *c =
-                callee_bb.first_phi ? callee_bb.first_phi : callee_bb.first_not_phi;
-            while (c) {
-                Instruction *cloned_inst =
-                    cloned_bb->add_instruction(c->opcode, c->type, {}, c->flags);
-                inst_map[c] = cloned_inst;
-                c = c->next;
+        // 2. clone callee blocks and instructions from prepared template
+        const CalleeTemplate &tmpl = get_template(callee);
+        std::vector<BasicBlock *> cloned_blocks(tmpl.blocks.size());
+        std::vector<Instruction *> cloned_insts(tmpl.insts.size());
+
+        for (size_t b = 0; b < tmpl.blocks.size(); b++) {
+            auto &block = tmpl.blocks[b];
+            BasicBlock *cloned_bb = add_block(caller);
+            cloned_blocks[b] = cloned_bb;
+            // scale callee's own profile to this call site
+            if (call_bb->exec_count >= 0 && block.exec_count >= 0 && tmpl.entry_count > 0)
+                cloned_bb->exec_count =
+                    call_bb->exec_count * block.exec_count / tmpl.entry_count;
+
+            for (int i = block.first_inst; i < block.first_inst + block.num_insts; i++) {
+                auto &inst = tmpl.insts[i];
+                cloned_insts[i] =
+                    cloned_bb->add_instruction(inst.opcode, inst.type, {}, inst.flags);
             }
         }
 
@@ -165,35 +476,30 @@ class Inliner {
         std::vector<Instruction *> cloned_args;
         std::vector<Instruction *> cloned_rets;
 
-        for (auto &callee_bb : callee->basic_blocks) {
-            Instruction *c =
-                callee_bb.first_phi ? callee_bb.first_phi : callee_bb.first_not_phi;
-            while (c) {
-                Instruction *cloned_inst = inst_map[c];
-                if (cloned_inst->opcode == GetArg::opcode)
+        for (size_t b = 0; b < tmpl.blocks.size(); b++) {
+            auto &block = tmpl.blocks[b];
+            for (int i = block.first_inst; i < block.first_inst + block.num_insts; i++) {
+                auto &inst = tmpl.insts[i];
+                Instruction *cloned_inst = cloned_insts[i];
+                if (inst.opcode == GetArg::opcode)
                     cloned_args.push_back(cloned_inst);
-                else if (cloned_inst->opcode == Ret::opcode ||
-                         cloned_inst->opcode == RetVoid::opcode)
+                else if (inst.opcode == Ret::opcode)
                     cloned_rets.push_back(cloned_inst);
 
-                for (auto &inp : c->inputs) {
-                    if (std::holds_alternative<Instruction *>(inp.data)) {
+                for (int k = inst.first_input; k < inst.first_input + inst.num_inputs; k++) {
+                    auto &inp = tmpl.inputs[k];
+                    if (inp.kind == CalleeTemplate::InputTemplate::INST)
+                        cloned_inst->add_input(cloned_insts[inp.value]);
+                    else if (inp.kind == CalleeTemplate::InputTemplate::PHI)
                         cloned_inst->add_input(
-                            inst_map[std::get<Instruction *>(inp.data)]);
-                    } else if (std::holds_alternative<PhiInput>(inp.data)) {
-                        PhiInput pi = std::get<PhiInput>(inp.data);
-                        cloned_inst->add_input(
-                            PhiInput{inst_map[pi.first], bb_map[pi.second]});
-                    } else {
-                        cloned_inst->add_input(std::get<int>(inp.data));
-                    }
+                            PhiInput{cloned_insts[inp.value], cloned_blocks[inp.block]});
+                    else
+                        cloned_inst->add_input(inp.value);
                 }
-                c = c->next;
             }
 
-            BasicBlock *cloned_bb = bb_map[&callee_bb];
-            if (callee_bb.next1) cloned_bb->add_next1(bb_map[callee_bb.next1]);
-            if (callee_bb.next2) cloned_bb->add_next2(bb_map[callee_bb.next2]);
+            if (block.next1 >= 0) cloned_blocks[b]->add_next1(cloned_blocks[block.next1]);
+            if (block.next2 >= 0) cloned_blocks[b]->add_next2(cloned_blocks[block.next2]);
         }
 
         // 3. update dataflow for parameters
@@ -212,26 +518,7 @@ class Inliner {
                     caller_arg_input = Input(const_inst);
                 }
 
-                // probably storing mapping would be more efficient but whatever
-                for (auto &user : arg_inst->users) {
-                    for (auto &inp : user.inst->inputs) {
-                        if (std::holds_alternative<Instruction *>(inp.data) &&
-                            std::get<Instruction *>(inp.data) == arg_inst) {
-                            inp.data = caller_arg_input.data;
-                            std::get<Instruction *>(caller_arg_input.data)
-                                ->users.push_back(user.inst);
-                        } else if (std::holds_alternative<PhiInput>(inp.data)) {
-                            PhiInput pi = std::get<PhiInput>(inp.data);
-                            if (pi.first == arg_inst) {
-                                inp.data = PhiInput{
-                                    std::get<Instruction *>(caller_arg_input.data),
-                                    pi.second};
-                                std::get<Instruction *>(caller_arg_input.data)
-                                    ->users.push_back(user.inst);
-                            }
-                        }
-                    }
-                }
+                replace_uses(arg_inst, std::get<Instruction *>(caller_arg_input.data));
             }
             remove_instruction(arg_inst);
         }
@@ -239,7 +526,7 @@ class Inliner {
         // 4. update dataflow for returns
         Instruction *return_val = nullptr;
 
-        if (cloned_rets.size() == 1) {
+        if (cloned_rets.size() == 1 && !branches_on_call) {
             if (!cloned_rets[0]->inputs.empty()) {
                 if (std::holds_alternative<Instruction *>(
                         cloned_rets[0]->inputs[0].data)) {
@@ -250,8 +537,9 @@ class Inliner {
                         Const::opcode, call_inst->type, {val});
                 }
             }
-        } else if (cloned_rets.size() > 1 && !call_inst->users.empty()) {
-            std::vector<Input> phi_inputs;
+        } else if (!cloned_rets.empty() &&
+                   (branches_on_call || !call_inst->users.empty())) {
+            std::vector<PhiInput> phi_inputs;
             for (auto ret_inst : cloned_rets) {
                 if (ret_inst->inputs.empty()) continue;
 
@@ -267,31 +555,16 @@ class Inliner {
                 if (ret_val_inst)
                     phi_inputs.push_back(PhiInput{ret_val_inst, ret_inst->bb});
             }
-            if (!phi_inputs.empty())
-                return_val = prepend_phi(call_cont_block, call_inst->type, phi_inputs);
-        }
-
-        if (return_val && !call_inst->users.empty()) {
-            for (auto &user : call_inst->users) {
-                for (auto &inp : user.inst->inputs) {
-                    if (std::holds_alternative<Instruction *>(inp.data) &&
-                        std::get<Instruction *>(inp.data) == call_inst) {
-                        inp.data = return_val;
-                        return_val->users.push_back(user.inst);
-                    } else if (std::holds_alternative<PhiInput>(inp.data)) {
-                        PhiInput pi = std::get<PhiInput>(inp.data);
-                        if (pi.first == call_inst) {
-                            inp.data = PhiInput{return_val, pi.second};
-                            return_val->users.push_back(user.inst);
-                        }
-                    }
-                }
+            if (!phi_inputs.empty()) {
+                return_val = call_cont_block->prepend_phi(call_inst->type);
+                for (PhiInput &pi : phi_inputs) return_val->add_input(pi);
             }
-            call_inst->users.clear();
         }
 
+        if (return_val) replace_uses(call_inst, return_val);
+
         // 5. jmp to and from function
-        if (callee->first) call_bb->add_next1(bb_map[callee->first]);
+        call_bb->add_next1(cloned_blocks[tmpl.entry]);
         for (auto ret_inst : cloned_rets) {
             BasicBlock *ret_bb = ret_inst->bb;
             ret_bb->add_next1(call_cont_block);
@@ -324,6 +597,7 @@ class Inliner {
             call_cont_block->next1 = nullptr;
             call_cont_block->next2 = nullptr;
         }
+        return cloned_blocks;
     }
 
     void remove_instruction(Instruction *inst) {
@@ -354,30 +628,6 @@ class Inliner {
             }
         }
     }
-
-    Instruction *prepend_phi(BasicBlock *bb, Types::Type type,
-                             std::vector<Input> inputs) {
-        Instruction *new_phi =
-            new Instruction(nullptr, nullptr, PHI_OPCODE, type, bb, inputs, {}, 0);
-        for (auto &i : inputs) {
-            if (std::holds_alternative<Instruction *>(i.data))
-                std::get<Instruction *>(i.data)->users.push_back(new_phi);
-            else if (std::holds_alternative<PhiInput>(i.data))
-                std::get<PhiInput>(i.data).first->users.push_back(new_phi);
-        }
-
-        if (bb->first_phi) {
-            new_phi->next = bb->first_phi;
-            bb->first_phi->prev = new_phi;
-            bb->first_phi = new_phi;
-        } else {
-            new_phi->next = bb->first_not_phi;
-            if (bb->first_not_phi) bb->first_not_phi->prev = new_phi;
-            bb->first_phi = new_phi;
-            if (!bb->last) bb->last = new_phi;
-        }
-        return new_phi;
-    }
 };
 
 }  // namespace IR
@@ -1,10 +1,13 @@
 #ifndef COMPILER_IR_INSTRUCTION
 #define COMPILER_IR_INSTRUCTION
 
+#include <algorithm>
 #include <atomic>
 #include <bitset>
 #include <cstdint>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <variant>
 #include <vector>
 
@@ -15,20 +18,29 @@ namespace IR {
 
 struct BasicBlock;
 struct Instruction;
+struct FrameState;
 
 constexpr int IS_CHECK_FLAG = 1;
 
-enum class LocationType { UNASSIGNED, REGISTER, STACK };
+// REMAT: value is not kept anywhere, its definition is repeated where it is needed
+enum class LocationType { UNASSIGNED, REGISTER, STACK, REMAT };
 
 struct Location {
     LocationType type = LocationType::UNASSIGNED;
     int value = -1;  // either the Register ID or Stack Slot ID
 
+    bool operator==(const Location &other) const {
+        return type == other.type && value == other.value;
+    }
+    bool operator!=(const Location &other) const { return !(*this == other); }
+
     void dump() const {
         if (type == LocationType::REGISTER)
             std::cout << "Reg(" << value << ")";
         else if (type == LocationType::STACK)
             std::cout << "Stack(" << value << ")";
+        else if (type == LocationType::REMAT)
+            std::cout << "Remat";
         else
             std::cout << "Unassigned";
     }
@@ -55,8 +67,10 @@ using Sub = OpTrait<'SUB'>;
 using Mul = OpTrait<'MUL'>;
 using And = OpTrait<'AND'>;
 using Shr = OpTrait<'SHR'>;
+using Shl = OpTrait<'SHL'>;
 using Phi = OpTrait<PHI_OPCODE>;
 using Eq = OpTrait<'EQ'>;
+using Select = OpTrait<'SEL'>;  // inputs[0] ? inputs[1] : inputs[2]
 using Ret = OpTrait<'RET'>;
 using Const = OpTrait<'CNST'>;
 using GetArg = OpTrait<'ARG'>;
@@ -65,21 +79,59 @@ using Spill = OpTrait<'SPIL'>;
 using Fill = OpTrait<'FILL'>;
 using Move = OpTrait<'MOVE'>;
 
+// vector ops. add, sub, mul, and, shifts and const of vector type work on every lane,
+// int inputs of them are taken for every lane
+using Broadcast = OpTrait<'BCST'>;  // every lane is inputs[0]
+using Iota = OpTrait<'IOTA'>;       // lane k is inputs[0] + k * inputs[1]
+using ReduceAdd = OpTrait<'RADD'>;  // scalar from all lanes of inputs[0]
+using ReduceMul = OpTrait<'RMUL'>;
+using ReduceAnd = OpTrait<'RAND'>;
+
 using Call = OpTrait<'CALL'>;
 using Call64 = TypedInst<Call, Types::INT64_T>;
 
+// memory. references are i64, 0 is null. type of load is type of value it reads
+using NewObject = OpTrait<'NEW'>;     // inputs: number of fields
+using NewArray = OpTrait<'NEWA'>;     // inputs: length
+using LoadField = OpTrait<'LDF'>;     // inputs: object, field
+using StoreField = OpTrait<'STF'>;    // inputs: object, field, value
+using LoadArray = OpTrait<'LDA'>;     // inputs: array, index
+using StoreArray = OpTrait<'STA'>;    // inputs: array, index, value
+using ArrayLength = OpTrait<'ALEN'>;  // inputs: array
+
+using NewObject64 = TypedInst<NewObject, Types::INT64_T>;
+using NewArray64 = TypedInst<NewArray, Types::INT64_T>;
+using LoadField64 = TypedInst<LoadField, Types::INT64_T>;
+using LoadField32 = TypedInst<LoadField, Types::INT32_T>;
+using LoadArray64 = TypedInst<LoadArray, Types::INT64_T>;
+using LoadArray32 = TypedInst<LoadArray, Types::INT32_T>;
+using StoreFieldVoid = TypedInst<StoreField, Types::VOID_T>;
+using StoreArrayVoid = TypedInst<StoreArray, Types::VOID_T>;
+using ArrayLength64 = TypedInst<ArrayLength, Types::INT64_T>;
+
 using Add64 = TypedInst<Add, Types::INT64_T>;
 using Sub64 = TypedInst<Sub, Types::INT64_T>;
 using Mul64 = TypedInst<Mul, Types::INT64_T>;
 using And64 = TypedInst<And, Types::INT64_T>;
 using Shr64 = TypedInst<Shr, Types::INT64_T>;
+using Shl64 = TypedInst<Shl, Types::INT64_T>;
 using Phi64 = TypedInst<Phi, Types::INT64_T>;
 using Const64 = TypedInst<Const, Types::INT64_T>;
 using Arg64 = TypedInst<GetArg, Types::INT64_T>;
 using EqBool = TypedInst<Eq, Types::BOOL_T>;
+using Select64 = TypedInst<Select, Types::INT64_T>;
 using RetVoid = TypedInst<Ret, Types::VOID_T>;
 using Ret64 = TypedInst<Ret, Types::INT64_T>;
 
+using Add4x64 = TypedInst<Add, Types::VEC4_INT64_T>;
+using Sub4x64 = TypedInst<Sub, Types::VEC4_INT64_T>;
+using Mul4x64 = TypedInst<Mul, Types::VEC4_INT64_T>;
+using And4x64 = TypedInst<And, Types::VEC4_INT64_T>;
+using Shr4x64 = TypedInst<Shr, Types::VEC4_INT64_T>;
+using Broadcast4x64 = TypedInst<Broadcast, Types::VEC4_INT64_T>;
+using Iota4x64 = TypedInst<Iota, Types::VEC4_INT64_T>;
+using ReduceAdd64 = TypedInst<ReduceAdd, Types::INT64_T>;
+
 using SpillVoid = TypedInst<Spill, Types::VOID_T>;
 using Fill64 = TypedInst<Fill, Types::INT64_T>;
 
@@ -92,6 +144,10 @@ using ZeroCheck = TypedInst<ZC, Types::VOID_T>;
 using NullCheck = TypedInst<NC, Types::VOID_T>;
 using BoundsCheck = TypedInst<BC, Types::VOID_T>;
 
+// leaves optimized code if inputs[0] is true, inputs[1..] are values for frame state
+using Deopt = OpTrait<'DOPT'>;
+using DeoptIf = TypedInst<Deopt, Types::VOID_T>;
+
 struct User {
     Instruction *inst;
     // other info
@@ -131,6 +187,9 @@ struct Instruction {
 
     Location loc;
 
+    // for deopt points: where tier 0 continues and what inputs mean there
+    std::shared_ptr<FrameState> frame_state;
+
     void add_input(PhiInput inp) {
         inputs.emplace_back(inp);
         inp.first->users.push_back(this);
@@ -182,6 +241,69 @@ struct Instruction {
     }
 };
 
+// users of from take to instead, phi inputs too
+inline void replace_uses(Instruction *from, Instruction *to) {
+    for (auto &user : from->users)
+        for (auto &inp : user.inst->inputs) {
+            if (std::holds_alternative<Instruction *>(inp.data) &&
+                std::get<Instruction *>(inp.data) == from) {
+                inp.data = to;
+                to->users.push_back(user.inst);
+            } else if (std::holds_alternative<PhiInput>(inp.data) &&
+                       std::get<PhiInput>(inp.data).first == from) {
+                inp.data = PhiInput{to, std::get<PhiInput>(inp.data).second};
+                to->users.push_back(user.inst);
+            }
+        }
+    from->users.clear();
+}
+
+// inputs of inst are replaced, users of old and new ones follow
+inline void set_inputs(Instruction *inst, std::vector<Input> inputs) {
+    for (auto &inp : inst->inputs)
+        if (std::holds_alternative<Instruction *>(inp.data)) {
+            auto &users = std::get<Instruction *>(inp.data)->users;
+            users.erase(std::remove_if(users.begin(), users.end(),
+                                       [inst](const User &u) { return u.inst == inst; }),
+                        users.end());
+        }
+    inst->inputs = inputs;
+    for (auto &inp : inst->inputs)
+        if (std::holds_alternative<Instruction *>(inp.data))
+            std::get<Instruction *>(inp.data)->users.push_back(inst);
+}
+
+// one input of user takes def instead of what it had
+inline void set_input(Instruction *user, Input &inp, Instruction *def) {
+    Instruction *old = std::get<Instruction *>(inp.data);
+    if (old == def) return;
+    auto it = std::find_if(old->users.begin(), old->users.end(),
+                           [&](const User &u) { return u.inst == user; });
+    if (it != old->users.end()) old->users.erase(it);
+    inp.data = def;
+    def->users.emplace_back(user);
+}
+
+// immediate or int of const instruction
+inline std::optional<int64_t> constant_value(const Input &inp) {
+    if (std::holds_alternative<int>(inp.data)) return std::get<int>(inp.data);
+    if (!std::holds_alternative<Instruction *>(inp.data)) return std::nullopt;
+    Instruction *inst = std::get<Instruction *>(inp.data);
+    if (inst && inst->opcode == Const::opcode &&
+        std::holds_alternative<int>(inst->inputs[0].data))
+        return std::get<int>(inst->inputs[0].data);
+    return std::nullopt;
+}
+
+// input of phi coming from pred, nullptr if there is none
+inline Instruction *phi_input(Instruction *phi, BasicBlock *pred) {
+    for (auto &inp : phi->inputs) {
+        PhiInput pi = std::get<PhiInput>(inp.data);
+        if (pi.second == pred) return pi.first;
+    }
+    return nullptr;
+}
+
 }  // namespace IR
 }  // namespace Compiler
 
@@ -0,0 +1,397 @@
+#ifndef COMPILER_IR_INTERPRETER_HPP
+#define COMPILER_IR_INTERPRETER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "basic_block.hpp"
+#include "deopt.hpp"
+#include "graph.hpp"
+#include "instruction.hpp"
+#include "loop_analyser.hpp"
+#include "profile.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// tier 0: executes ir directly. it collects profile for the optimizing tier, takes
+// deopts from optimized code and jumps into osr code from hot loops.
+// conditional branch goes to next1 if last instruction of block is true
+class Interpreter {
+   public:
+    std::function<Graph *(int)> resolve_callee;
+
+    // block counts and targets of indirect calls
+    bool profile = false;
+    std::unordered_map<Instruction *, CallTargetProfile> call_profiles;
+
+    // after that many back edges to a header compile_osr is asked for code entered at
+    // that header, it may return nullptr to stay in tier 0
+    int64_t osr_threshold = 1000;
+    std::function<OsrEntry *(Graph *, BasicBlock *)> compile_osr;
+
+    // after register allocation: values are kept in locations of instructions and phis
+    // are done by moves on edges. calls overwrite clobbered registers with garbage.
+    // arguments are put to arg_registers on entry and allocated GetArg reads them there
+    bool use_locations = false;
+    std::vector<int> clobbered_registers;
+    std::vector<int> arg_registers;
+
+    // objects and arrays of all frames, reference to heap[i] is i + 1
+    std::vector<std::vector<int64_t>> heap;
+
+    int64_t executed = 0;  // instructions
+    int64_t spills = 0;    // executed spill instructions
+    int64_t fills = 0;
+    int64_t moves = 0;
+    int64_t deopts = 0;
+    int64_t osr_entries = 0;
+    int64_t branches = 0;     // conditional ones
+    int64_t mispredicts = 0;  // by 2 bit saturating counter of every branch
+
+    explicit Interpreter(std::function<Graph *(int)> resolver = nullptr)
+        : resolve_callee(resolver) {}
+
+    int64_t run(Graph *graph, const std::vector<int64_t> &args) {
+        Frame frame(graph, args);
+        if (use_locations)
+            for (size_t i = 0; i < args.size() && i < arg_registers.size(); i++)
+                frame.registers[arg_registers[i]] = args[i];
+        return execute(frame, graph->first, nullptr);
+    }
+
+   private:
+    using Lanes = std::vector<int64_t>;
+
+    // state of one activation: ssa values before allocation, registers and stack slots
+    // after it. values of vector types are kept apart, in the same locations
+    struct Frame {
+        Frame(Graph *graph_, const std::vector<int64_t> &args_)
+            : graph(graph_), args(args_) {}
+
+        Graph *graph;
+        std::vector<int64_t> args;
+        std::unordered_map<Instruction *, int64_t> values;
+        std::unordered_map<int, int64_t> registers, stack;
+        std::unordered_map<Instruction *, Lanes> vectors;
+        std::unordered_map<int, Lanes> vector_registers, vector_stack;
+    };
+
+    std::unordered_set<Graph *> profiled;
+    std::unordered_map<Graph *, std::set<std::pair<BasicBlock *, BasicBlock *>>> back_edges;
+    std::unordered_map<BasicBlock *, int64_t> back_edge_counts;
+    std::unordered_map<BasicBlock *, OsrEntry *> osr_code;  // nullptr if refused
+    std::unordered_set<Graph *> osr_graphs;                 // no osr out of osr code
+    std::unordered_map<BasicBlock *, int> predictors;       // taken if >= 2
+
+    int64_t get(Frame &frame, const Input &inp) {
+        if (std::holds_alternative<int>(inp.data)) return std::get<int>(inp.data);
+        return value_of(frame, std::get<Instruction *>(inp.data));
+    }
+
+    int64_t value_of(Frame &frame, Instruction *inst) {
+        if (use_locations && inst->loc.type == LocationType::REGISTER)
+            return frame.registers.at(inst->loc.value);
+        if (use_locations && inst->loc.type == LocationType::STACK)
+            return frame.stack.at(inst->loc.value);
+        return frame.values.at(inst);
+    }
+
+    void set(Frame &frame, Instruction *inst, int64_t value) {
+        if (use_locations && inst->loc.type == LocationType::REGISTER)
+            frame.registers[inst->loc.value] = value;
+        else if (use_locations && inst->loc.type == LocationType::STACK)
+            frame.stack[inst->loc.value] = value;
+        else
+            frame.values[inst] = value;
+    }
+
+    // int inputs and scalar values go to every lane
+    Lanes get_lanes(Frame &frame, const Input &inp, int n) {
+        if (std::holds_alternative<int>(inp.data)) return Lanes(n, std::get<int>(inp.data));
+        Instruction *inst = std::get<Instruction *>(inp.data);
+        if (!Types::is_vector(inst->type)) return Lanes(n, value_of(frame, inst));
+        return lanes_of(frame, inst);
+    }
+
+    Lanes lanes_of(Frame &frame, Instruction *inst) {
+        if (use_locations && inst->loc.type == LocationType::REGISTER)
+            return frame.vector_registers.at(inst->loc.value);
+        if (use_locations && inst->loc.type == LocationType::STACK)
+            return frame.vector_stack.at(inst->loc.value);
+        return frame.vectors.at(inst);
+    }
+
+    void set_lanes(Frame &frame, Instruction *inst, Lanes value) {
+        if (use_locations && inst->loc.type == LocationType::REGISTER)
+            frame.vector_registers[inst->loc.value] = std::move(value);
+        else if (use_locations && inst->loc.type == LocationType::STACK)
+            frame.vector_stack[inst->loc.value] = std::move(value);
+        else
+            frame.vectors[inst] = std::move(value);
+    }
+
+    // pred is nullptr on method entry and after deopt, phis are already set then
+    int64_t execute(Frame &frame, BasicBlock *bb, BasicBlock *pred) {
+        if (profile && profiled.insert(frame.graph).second)
+            for (auto &block : frame.graph->basic_blocks)
+                block.exec_count = block.next1_count = block.next2_count = 0;
+
+        while (bb) {
+            if (profile) bb->exec_count++;
+            if (pred) {
+                if (!use_locations) eval_phis(frame, bb, pred);
+                if (compile_osr && !osr_graphs.count(frame.graph) &&
+                    is_back_edge(frame.graph, pred, bb) &&
+                    ++back_edge_counts[bb] >= osr_threshold)
+                    if (OsrEntry *osr = get_osr_entry(frame.graph, bb)) {
+                        osr_entries++;
+                        std::vector<int64_t> args;
+                        for (auto v : osr->state) args.push_back(frame.values.at(v));
+                        return run(&osr->graph, args);
+                    }
+            }
+
+            for (auto inst = bb->first_not_phi; inst; inst = inst->next) {
+                executed++;
+                if (inst->opcode == Spill::opcode) spills++;
+                if (inst->opcode == Fill::opcode) fills++;
+                if (inst->opcode == Move::opcode) moves++;
+                if (inst->opcode == Ret::opcode)
+                    return inst->inputs.empty() ? 0 : get(frame, inst->inputs[0]);
+                if (inst->opcode == Deopt::opcode) {
+                    if (get(frame, inst->inputs[0])) return deoptimize(frame, inst);
+                    continue;
+                }
+                if (Types::is_vector(inst->type))
+                    set_lanes(frame, inst, eval_vector(frame, inst));
+                else
+                    set(frame, inst, eval(frame, inst));
+            }
+
+            pred = bb;
+            bool taken = !bb->next2 || value_of(frame, bb->last);
+            if (profile && bb->next1) (taken ? bb->next1_count : bb->next2_count)++;
+            if (bb->next2) {
+                int &state = predictors[bb];
+                branches++;
+                if ((state >= 2) != taken) mispredicts++;
+                state = taken ? std::min(state + 1, 3) : std::max(state - 1, 0);
+            }
+            bb = taken ? bb->next1 : bb->next2;
+        }
+        return 0;
+    }
+
+    void eval_phis(Frame &frame, BasicBlock *bb, BasicBlock *pred) {
+        // phis are parallel, so read everything before writing
+        std::vector<std::pair<Instruction *, int64_t>> results;
+        std::vector<std::pair<Instruction *, Lanes>> vector_results;
+        for (auto phi = bb->first_phi; phi && phi->opcode == PHI_OPCODE; phi = phi->next)
+            for (auto &inp : phi->inputs) {
+                PhiInput pi = std::get<PhiInput>(inp.data);
+                if (pi.second != pred) continue;
+                if (Types::is_vector(phi->type))
+                    vector_results.push_back({phi, frame.vectors.at(pi.first)});
+                else
+                    results.push_back({phi, frame.values.at(pi.first)});
+                break;
+            }
+        for (auto &[phi, value] : results) frame.values[phi] = value;
+        for (auto &[phi, value] : vector_results) frame.vectors[phi] = std::move(value);
+    }
+
+    // negative counts shift everything out too, as big ones do
+    static bool shift_out(int64_t count) { return uint64_t(count) >= 64; }
+
+    int64_t eval(Frame &frame, Instruction *inst) {
+        auto arg = [&](size_t i) { return get(frame, inst->inputs[i]); };
+        switch (inst->opcode) {
+            case Const::opcode:
+                return arg(0);
+            case GetArg::opcode: {
+                size_t idx = std::get<int>(inst->inputs[0].data);
+                if (use_locations && idx < arg_registers.size() &&
+                    inst->loc.type != LocationType::UNASSIGNED)
+                    return frame.registers.at(arg_registers[idx]);
+                return frame.args.at(idx);
+            }
+            case Add::opcode:
+                return arg(0) + arg(1);
+            case Sub::opcode:
+                return arg(0) - arg(1);
+            case Mul::opcode:
+                return arg(0) * arg(1);
+            case And::opcode:
+                return arg(0) & arg(1);
+            case Shr::opcode:
+                return shift_out(arg(1)) ? 0 : arg(0) >> arg(1);
+            case Shl::opcode:
+                return shift_out(arg(1)) ? 0 : int64_t(uint64_t(arg(0)) << arg(1));
+            case Eq::opcode:
+                return arg(0) == arg(1);
+            case Select::opcode:
+                return arg(0) ? arg(1) : arg(2);
+            case Spill::opcode:
+            case Fill::opcode:
+            case Move::opcode:
+                return arg(0);
+            case ZC::opcode:
+            case NC::opcode:
+                if (!arg(0)) throw "check failed :(";
+                return 0;
+            case BC::opcode:
+                if (arg(0) < 0 || arg(0) >= arg(1)) throw "bounds check failed :(";
+                return 0;
+            case Call::opcode:
+                return call(frame, inst);
+            case NewObject::opcode:
+            case NewArray::opcode:
+                if (arg(0) < 0) throw "negative array length :(";
+                heap.emplace_back(arg(0));
+                return heap.size();
+            case LoadField::opcode:
+            case LoadArray::opcode:
+                return element(arg(0), arg(1));
+            case StoreField::opcode:
+            case StoreArray::opcode:
+                element(arg(0), arg(1)) = arg(2);
+                return 0;
+            case ArrayLength::opcode:
+                return object(arg(0)).size();
+            case ReduceAdd::opcode:
+            case ReduceMul::opcode:
+            case ReduceAnd::opcode: {
+                Lanes lanes = lanes_of(frame, std::get<Instruction *>(inst->inputs[0].data));
+                int64_t result = lanes[0];
+                for (size_t k = 1; k < lanes.size(); k++)
+                    result = inst->opcode == ReduceAdd::opcode   ? result + lanes[k]
+                             : inst->opcode == ReduceMul::opcode ? result * lanes[k]
+                                                                 : result & lanes[k];
+                return result;
+            }
+        }
+        throw "interpreter: not implemented opcode :(";
+    }
+
+    Lanes eval_vector(Frame &frame, Instruction *inst) {
+        int n = Types::lanes(inst->type);
+        auto arg = [&](size_t i) { return get_lanes(frame, inst->inputs[i], n); };
+        Lanes result(n);
+        switch (inst->opcode) {
+            case Const::opcode:
+            case Broadcast::opcode:
+            case Spill::opcode:
+            case Fill::opcode:
+            case Move::opcode:
+                return arg(0);
+            case Iota::opcode: {
+                int64_t start = get(frame, inst->inputs[0]), step = get(frame, inst->inputs[1]);
+                for (int k = 0; k < n; k++) result[k] = start + k * step;
+                return result;
+            }
+            case Add::opcode:
+            case Sub::opcode:
+            case Mul::opcode:
+            case And::opcode:
+            case Shr::opcode:
+            case Shl::opcode: {
+                Lanes a = arg(0), b = arg(1);
+                for (int k = 0; k < n; k++)
+                    switch (inst->opcode) {
+                        case Add::opcode:
+                            result[k] = a[k] + b[k];
+                            break;
+                        case Sub::opcode:
+                            result[k] = a[k] - b[k];
+                            break;
+                        case Mul::opcode:
+                            result[k] = a[k] * b[k];
+                            break;
+                        case And::opcode:
+                            result[k] = a[k] & b[k];
+                            break;
+                        case Shl::opcode:
+                            result[k] =
+                                shift_out(b[k]) ? 0 : int64_t(uint64_t(a[k]) << b[k]);
+                            break;
+                        default:
+                            result[k] = shift_out(b[k]) ? 0 : a[k] >> b[k];
+                    }
+                return result;
+            }
+        }
+        throw "interpreter: not implemented vector opcode :(";
+    }
+
+    std::vector<int64_t> &object(int64_t ref) {
+        if (ref <= 0 || ref > (int64_t)heap.size()) throw "null or bad reference :(";
+        return heap[ref - 1];
+    }
+
+    int64_t &element(int64_t ref, int64_t index) {
+        std::vector<int64_t> &obj = object(ref);
+        if (index < 0 || index >= (int64_t)obj.size()) throw "index out of bounds :(";
+        return obj[index];
+    }
+
+    int64_t call(Frame &frame, Instruction *inst) {
+        int target = get(frame, inst->inputs[0]);
+        if (profile && std::holds_alternative<Instruction *>(inst->inputs[0].data))
+            call_profiles[inst].record(target);
+
+        Graph *callee = resolve_callee ? resolve_callee(target) : nullptr;
+        if (!callee) throw "interpreter: unknown callee :(";
+        std::vector<int64_t> args;
+        for (size_t i = 1; i < inst->inputs.size(); i++)
+            args.push_back(get(frame, inst->inputs[i]));
+        int64_t result = run(callee, args);
+        if (use_locations)
+            for (int r : clobbered_registers) {
+                frame.registers[r] = 0xdeadbeef;
+                frame.vector_registers.erase(r);
+            }
+        return result;
+    }
+
+    // continues in tier 0 version of method, result of it is result of optimized code
+    int64_t deoptimize(Frame &frame, Instruction *deopt) {
+        deopts++;
+        const FrameState &state = *deopt->frame_state;
+        Frame tier0(state.method, frame.args);
+        for (size_t i = 0; i < state.values.size(); i++)
+            tier0.values[state.values[i]] = get(frame, deopt->inputs[i + 1]);
+        return execute(tier0, state.resume_bb, nullptr);
+    }
+
+    bool is_back_edge(Graph *graph, BasicBlock *from, BasicBlock *to) {
+        auto it = back_edges.find(graph);
+        if (it == back_edges.end()) {
+            LoopAnalyzer loops(graph);
+            it = back_edges.emplace(graph, std::set(loops.back_edges.begin(),
+                                                    loops.back_edges.end()))
+                     .first;
+        }
+        return it->second.count({from, to});
+    }
+
+    OsrEntry *get_osr_entry(Graph *graph, BasicBlock *header) {
+        auto it = osr_code.find(header);
+        if (it == osr_code.end()) {
+            it = osr_code.emplace(header, compile_osr(graph, header)).first;
+            if (it->second) osr_graphs.insert(&it->second->graph);
+        }
+        return it->second;
+    }
+};
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_INTERPRETER_HPP
@@ -0,0 +1,466 @@
+#ifndef COMPILER_IR_IR_TEXT_HPP
+#define COMPILER_IR_IR_TEXT_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "basic_block.hpp"
+#include "graph.hpp"
+#include "instruction.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// text form of methods, parse(print(g)) gives the same graph and printing it again gives
+// the same text. values are numbered in print order, so text doesn't depend on global
+// instruction ids. parsed graph gets new id, so id from text is printed instead of it to
+// keep calls right. frame states of deopts are not printed
+//
+//   method 3 (i64, i64) {
+//   bb0:
+//     v0 = i64 ARG 0
+//     goto bb1
+//   bb1 <- bb0, bb2 count 11:
+//     v1 = i64 PHI [v0, bb0], [v4, bb2]
+//     v2 = bool EQ v1, 0
+//     if bb3, bb2 count 1, 10
+//   bb2 <- bb1:
+//     v4 = i64 SUB v1, 1 @r1
+//     goto bb1
+//   ...
+//   }
+//
+// after values: !flags if they are not zero, @rN / @sN / @remat for location.
+// "if" goes to first block when condition is true. counts of blocks and of edges (after
+// targets of goto and if) come from profile
+class IrPrinter {
+   public:
+    static std::string print(const Graph &graph, int id = -1) {
+        std::ostringstream out;
+        print(out, graph, id);
+        return out.str();
+    }
+
+    static void print(std::ostream &out, const Graph &graph, int id = -1) {
+        std::unordered_map<const Instruction *, int> names;
+        for (const BasicBlock &bb : graph.basic_blocks)
+            for (auto inst = bb.first_phi ? bb.first_phi : bb.first_not_phi; inst;
+                 inst = inst->next)
+                names.emplace(inst, names.size());
+
+        out << "method " << (id < 0 ? graph.id : id) << " (";
+        for (size_t i = 0; i < graph.args.size(); i++)
+            out << (i ? ", " : "") << type_name(graph.args[i]);
+        out << ") {\n";
+        for (const BasicBlock &bb : graph.basic_blocks) {
+            out << "bb" << bb.id;
+            for (size_t i = 0; i < bb.preds.size(); i++)
+                out << (i ? ", bb" : " <- bb") << bb.preds[i]->id;
+            if (bb.exec_count >= 0) out << " count " << bb.exec_count;
+            out << ":\n";
+            for (auto inst = bb.first_phi ? bb.first_phi : bb.first_not_phi; inst;
+                 inst = inst->next)
+                print(out, inst, names);
+            if (bb.next2) {
+                out << "  if bb" << bb.next1->id << ", bb" << bb.next2->id;
+                if (bb.next1_count >= 0 && bb.next2_count >= 0)
+                    out << " count " << bb.next1_count << ", " << bb.next2_count;
+                out << "\n";
+            } else if (bb.next1) {
+                out << "  goto bb" << bb.next1->id;
+                if (bb.next1_count >= 0) out << " count " << bb.next1_count;
+                out << "\n";
+            }
+        }
+        out << "}\n";
+    }
+
+    static const char *type_name(Types::Type type) {
+        switch (type) {
+            case Types::INT64_T:
+                return "i64";
+            case Types::INT32_T:
+                return "i32";
+            case Types::BOOL_T:
+                return "bool";
+            case Types::VOID_T:
+                return "void";
+            case Types::VEC2_INT64_T:
+                return "v2i64";
+            case Types::VEC4_INT64_T:
+                return "v4i64";
+            case Types::VEC8_INT32_T:
+                return "v8i32";
+        }
+        throw "ir text: unknown type :(";
+    }
+
+   private:
+    static void print(std::ostream &out, const Instruction *inst,
+                      const std::unordered_map<const Instruction *, int> &names) {
+        out << "  v" << names.at(inst) << " = " << type_name(inst->type) << ' ';
+        for (int shift = 24; shift >= 0; shift -= 8)
+            if (char c = (inst->opcode >> shift) & 0xff) out << c;
+
+        for (size_t i = 0; i < inst->inputs.size(); i++) {
+            out << (i ? ", " : " ");
+            const auto &data = inst->inputs[i].data;
+            if (std::holds_alternative<int>(data)) {
+                out << std::get<int>(data);
+            } else if (std::holds_alternative<Instruction *>(data)) {
+                out << 'v' << names.at(std::get<Instruction *>(data));
+            } else {
+                const PhiInput &pi = std::get<PhiInput>(data);
+                out << "[v" << names.at(pi.first) << ", bb" << pi.second->id << ']';
+            }
+        }
+        if (inst->flags.any()) out << " !" << inst->flags.to_ulong();
+        if (inst->loc.type == LocationType::REGISTER)
+            out << " @r" << inst->loc.value;
+        else if (inst->loc.type == LocationType::STACK)
+            out << " @s" << inst->loc.value;
+        else if (inst->loc.type == LocationType::REMAT)
+            out << " @remat";
+        out << '\n';
+    }
+};
+
+// methods of one text, calls keep ids from text, so callee is found by by_id
+struct ParsedMethods {
+    std::vector<std::unique_ptr<Graph>> methods;
+    std::vector<int> ids;                    // in text
+    std::unordered_map<int, Graph *> by_id;  // id in text -> method
+
+    Graph *resolve(int id) const {
+        auto it = by_id.find(id);
+        return it == by_id.end() ? nullptr : it->second;
+    }
+};
+
+// single pass over text into flat records, graph is built when method is complete, so
+// values and blocks may be used before their definition. errors are thrown as strings
+class IrParser {
+   public:
+    static ParsedMethods parse(std::string_view text) {
+        IrParser parser(text);
+        ParsedMethods result;
+        parser.skip_space();
+        while (!parser.at_end()) {
+            int id = 0;
+            std::unique_ptr<Graph> graph = parser.parse_method(id);
+            if (!result.by_id.emplace(id, graph.get()).second)
+                throw "ir text: method is defined twice";
+            result.ids.push_back(id);
+            result.methods.push_back(std::move(graph));
+            parser.skip_space();
+        }
+        return result;
+    }
+
+    static std::unique_ptr<Graph> parse_graph(std::string_view text, int *id = nullptr) {
+        ParsedMethods parsed = parse(text);
+        if (parsed.methods.size() != 1) throw "ir text: expected one method";
+        if (id) *id = parsed.ids[0];
+        return std::move(parsed.methods[0]);
+    }
+
+   private:
+    struct TextInput {
+        enum { VALUE, INT, PHI } kind;
+        int value;  // value number or constant
+        int block = -1;
+    };
+
+    struct TextInst {
+        int name;
+        Types::Type type;
+        opcode_t opcode;
+        std::vector<TextInput> inputs;
+        unsigned long flags = 0;
+        Location loc;
+    };
+
+    struct TextBlock {
+        int id;
+        std::vector<int> preds;
+        int next1 = -1, next2 = -1;
+        int64_t count = -1;
+        int64_t next1_count = -1, next2_count = -1;
+        std::vector<TextInst> insts;
+    };
+
+    std::string_view text;
+    size_t pos = 0;
+
+    explicit IrParser(std::string_view text_) : text(text_) {}
+
+    bool at_end() const { return pos >= text.size(); }
+    char peek() const { return at_end() ? '\0' : text[pos]; }
+
+    void skip_space() {
+        while (!at_end() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' ||
+                             text[pos] == '\r'))
+            pos++;
+    }
+
+    // spaces inside of a line
+    void skip_blanks() {
+        while (!at_end() && (text[pos] == ' ' || text[pos] == '\t')) pos++;
+    }
+
+    bool accept(std::string_view s) {
+        skip_blanks();
+        if (text.substr(pos, s.size()) != s) return false;
+        pos += s.size();
+        return true;
+    }
+
+    void expect(std::string_view s) {
+        if (!accept(s)) throw "ir text: unexpected token";
+    }
+
+    std::string_view word() {
+        skip_blanks();
+        size_t start = pos;
+        while (!at_end() && (std::isalnum((unsigned char)text[pos]) || text[pos] == '_')) pos++;
+        if (start == pos) throw "ir text: expected word";
+        return text.substr(start, pos - start);
+    }
+
+    int64_t number() {
+        skip_blanks();
+        bool negative = accept("-");
+        if (at_end() || !std::isdigit((unsigned char)peek())) throw "ir text: expected number";
+        int64_t result = 0;
+        while (!at_end() && std::isdigit((unsigned char)peek()))
+            result = result * 10 + (text[pos++] - '0');
+        return negative ? -result : result;
+    }
+
+    int prefixed(std::string_view prefix) {
+        expect(prefix);
+        return number();
+    }
+
+    Types::Type type() {
+        std::string_view w = word();
+        if (w == "i64") return Types::INT64_T;
+        if (w == "i32") return Types::INT32_T;
+        if (w == "bool") return Types::BOOL_T;
+        if (w == "void") return Types::VOID_T;
+        if (w == "v2i64") return Types::VEC2_INT64_T;
+        if (w == "v4i64") return Types::VEC4_INT64_T;
+        if (w == "v8i32") return Types::VEC8_INT32_T;
+        throw "ir text: unknown type";
+    }
+
+    std::unique_ptr<Graph> parse_method(int &id) {
+        skip_space();
+        expect("method");
+        id = number();
+        expect("(");
+        std::vector<Types::Type> args;
+        while (!accept(")")) {
+            if (!args.empty()) expect(",");
+            args.push_back(type());
+        }
+        expect("{");
+
+        std::vector<TextBlock> blocks;
+        int num_values = 0, num_insts = 0;
+        for (skip_space(); !accept("}"); skip_space()) {
+            if (peek() == 'b') {
+                TextBlock &bb = blocks.emplace_back();
+                bb.id = prefixed("bb");
+                if (accept("<-"))
+                    do
+                        bb.preds.push_back(prefixed("bb"));
+                    while (accept(","));
+                if (accept("count")) bb.count = number();
+                expect(":");
+            } else if (blocks.empty()) {
+                throw "ir text: instruction before first block";
+            } else if (accept("goto")) {
+                blocks.back().next1 = prefixed("bb");
+                if (accept("count")) blocks.back().next1_count = number();
+            } else if (accept("if")) {
+                TextBlock &bb = blocks.back();
+                bb.next1 = prefixed("bb");
+                expect(",");
+                bb.next2 = prefixed("bb");
+                if (accept("count")) {
+                    bb.next1_count = number();
+                    expect(",");
+                    bb.next2_count = number();
+                }
+            } else {
+                blocks.back().insts.push_back(parse_inst(num_insts++));
+                num_values = std::max(num_values, blocks.back().insts.back().name + 1);
+            }
+        }
+        if (blocks.empty()) throw "ir text: method without blocks";
+        return build(args, blocks, num_values);
+    }
+
+    // names are dense in printed text, hand written one may skip some of them
+    static constexpr int max_name_gap = 1024;
+
+    // index is number of instructions before this one
+    TextInst parse_inst(int index) {
+        TextInst inst;
+        inst.name = prefixed("v");
+        if (inst.name < 0 || inst.name > index + max_name_gap)
+            throw "ir text: value name out of range";
+        expect("=");
+        inst.type = type();
+        std::string_view op = word();
+        if (op.size() > 4) throw "ir text: opcode is longer than 4 chars";
+        inst.opcode = 0;
+        for (char c : op) inst.opcode = (inst.opcode << 8) | (unsigned char)c;
+        if (!is_known(inst.opcode)) throw "ir text: unknown opcode";
+
+        skip_blanks();
+        bool more = !at_end() && peek() != '\n' && peek() != '\r' && peek() != '!' &&
+                    peek() != '@';
+        while (more) {
+            skip_blanks();
+            if (accept("[")) {
+                int value = prefixed("v");
+                expect(",");
+                inst.inputs.push_back({TextInput::PHI, value, prefixed("bb")});
+                expect("]");
+            } else if (peek() == 'v') {
+                inst.inputs.push_back({TextInput::VALUE, prefixed("v")});
+            } else {
+                inst.inputs.push_back({TextInput::INT, (int)number()});
+            }
+            more = accept(",");
+        }
+
+        if (accept("!")) inst.flags = number();
+        if (accept("@remat"))
+            inst.loc = {LocationType::REMAT, 0};
+        else if (accept("@r"))
+            inst.loc = {LocationType::REGISTER, (int)number()};
+        else if (accept("@s"))
+            inst.loc = {LocationType::STACK, (int)number()};
+        skip_blanks();
+        if (!at_end() && peek() != '\n' && peek() != '\r') throw "ir text: junk after instruction";
+        return inst;
+    }
+
+    static bool is_known(opcode_t opcode) {
+        switch (opcode) {
+            case Add::opcode:
+            case Sub::opcode:
+            case Mul::opcode:
+            case And::opcode:
+            case Shr::opcode:
+            case Shl::opcode:
+            case PHI_OPCODE:
+            case Eq::opcode:
+            case Select::opcode:
+            case Ret::opcode:
+            case Const::opcode:
+            case GetArg::opcode:
+            case Spill::opcode:
+            case Fill::opcode:
+            case Move::opcode:
+            case Broadcast::opcode:
+            case Iota::opcode:
+            case ReduceAdd::opcode:
+            case ReduceMul::opcode:
+            case ReduceAnd::opcode:
+            case Call::opcode:
+            case NewObject::opcode:
+            case NewArray::opcode:
+            case LoadField::opcode:
+            case StoreField::opcode:
+            case LoadArray::opcode:
+            case StoreArray::opcode:
+            case ArrayLength::opcode:
+            case ZC::opcode:
+            case NC::opcode:
+            case BC::opcode:
+            case Deopt::opcode:
+                return true;
+        }
+        return false;
+    }
+
+    static std::unique_ptr<Graph> build(const std::vector<Types::Type> &args,
+                                        const std::vector<TextBlock> &blocks, int num_values) {
+        auto graph = std::make_unique<Graph>(blocks.size(), args);
+        std::unordered_map<int, BasicBlock *> by_id;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            // passes index blocks by id
+            if (blocks[i].id != (int)i) throw "ir text: block ids must be 0..n-1";
+            BasicBlock &bb = graph->basic_blocks[i];
+            bb.id = blocks[i].id;
+            bb.exec_count = blocks[i].count;
+            bb.next1_count = blocks[i].next1_count;
+            bb.next2_count = blocks[i].next2_count;
+            if (!by_id.emplace(bb.id, &bb).second) throw "ir text: block is defined twice";
+        }
+        auto block = [&](int id) {
+            auto it = by_id.find(id);
+            if (it == by_id.end()) throw "ir text: unknown block";
+            return it->second;
+        };
+
+        // instructions are created first, then their inputs are linked
+        std::vector<Instruction *> values(num_values, nullptr);
+        for (size_t i = 0; i < blocks.size(); i++) {
+            BasicBlock &bb = graph->basic_blocks[i];
+            for (const TextInst &t : blocks[i].insts) {
+                if (values[t.name]) throw "ir text: value is defined twice";
+                Instruction *inst =
+                    new Instruction(bb.last, nullptr, t.opcode, t.type, &bb, {}, {}, t.flags);
+                inst->loc = t.loc;
+                if (bb.last) bb.last->next = inst;
+                if (t.opcode == PHI_OPCODE) {
+                    if (bb.first_not_phi) throw "ir text: phi after other instruction";
+                    if (!bb.first_phi) bb.first_phi = inst;
+                } else if (!bb.first_not_phi) {
+                    bb.first_not_phi = inst;
+                }
+                bb.last = inst;
+                values[t.name] = inst;
+            }
+        }
+        auto value = [&](int name) {
+            if (name < 0 || name >= (int)values.size() || !values[name])
+                throw "ir text: unknown value";
+            return values[name];
+        };
+
+        for (size_t i = 0; i < blocks.size(); i++) {
+            BasicBlock &bb = graph->basic_blocks[i];
+            for (int pred : blocks[i].preds) bb.preds.push_back(block(pred));
+            if (blocks[i].next1 >= 0) bb.next1 = block(blocks[i].next1);
+            if (blocks[i].next2 >= 0) bb.next2 = block(blocks[i].next2);
+            for (const TextInst &t : blocks[i].insts) {
+                Instruction *inst = values[t.name];
+                for (const TextInput &inp : t.inputs)
+                    if (inp.kind == TextInput::INT)
+                        inst->add_input(inp.value);
+                    else if (inp.kind == TextInput::VALUE)
+                        inst->add_input(value(inp.value));
+                    else
+                        inst->add_input(PhiInput{value(inp.value), block(inp.block)});
+            }
+        }
+        return graph;
+    }
+};
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_IR_TEXT_HPP
@@ -2,6 +2,9 @@
 #define COMPILER_IR_LINEAR_ORDER_HPP
 
 #include <algorithm>
+#include <set>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "basic_block.hpp"
@@ -11,31 +14,57 @@
 namespace Compiler {
 namespace IR {
 
+// reverse post order keeps loops together and puts loop exits after them. profile
+// layout also keeps loops together and every block after its forward preds, but among
+// blocks that may go next it takes the hottest successor of the last block, so hot path
+// falls through, and blocks that are executed less than cold_ratio times per method entry
+// (check failures, deopts) go as far to the end as possible. it falls back to reverse post
+// order if there are no counts
+enum class BlockLayout { REVERSE_POST_ORDER, PROFILE };
+
 class LinearOrderBuilder {
    public:
+    static constexpr double cold_ratio = 0.01;
+
     Graph *graph;
     LoopAnalyzer *loop_analyzer;
     std::vector<BasicBlock *> linear_order;
 
-    LinearOrderBuilder(Graph *g, LoopAnalyzer *la) : graph(g), loop_analyzer(la) {
-        build();
+    LinearOrderBuilder(Graph *g, LoopAnalyzer *la,
+                       BlockLayout layout = BlockLayout::REVERSE_POST_ORDER)
+        : graph(g), loop_analyzer(la) {
+        if (!graph || !graph->first) return;
+        if (layout == BlockLayout::PROFILE && graph->first->exec_count > 0)
+            build_from_profile();
+        else
+            build();
+        number_instructions();
+    }
+
+    // times next1 or next2 of bb was taken, count of succ itself if edge is not
+    // counted, -1 if unknown
+    static int64_t edge_count(BasicBlock *bb, BasicBlock *succ) {
+        int64_t count = succ == bb->next1 ? bb->next1_count : bb->next2_count;
+        return count >= 0 ? count : succ->exec_count;
+    }
+
+    // profile weighted number of jumps in code laid out in order: every edge that doesn't
+    // go to the next block is a jump
+    static int64_t taken_jumps(const std::vector<BasicBlock *> &order) {
+        int64_t jumps = 0;
+        for (size_t i = 0; i < order.size(); i++)
+            for (BasicBlock *succ : {order[i]->next1, order[i]->next2})
+                if (succ && (i + 1 == order.size() || order[i + 1] != succ))
+                    jumps += std::max<int64_t>(edge_count(order[i], succ), 0);
+        return jumps;
     }
 
    private:
     void build() {
-        if (!graph || !graph->first) return;
-
         std::vector<int> loop_depth(graph->basic_blocks.size(), 0);
 
-        auto compute_depth = [&](const Loop *l, auto &compute_depth_ref) -> int {
-            if (!l) return 0;
-            if (l->parent_loop)
-                return compute_depth_ref(l->parent_loop, compute_depth_ref) + 1;
-            return 0;  // root loop
-        };
-
         for (const auto &loop : loop_analyzer->loops) {
-            int depth = compute_depth(&loop, compute_depth);
+            int depth = LoopAnalyzer::get_depth(&loop);
             for (BasicBlock *b : loop.blocks) loop_depth[b->id] = depth;
         }
 
@@ -65,7 +94,85 @@ class LinearOrderBuilder {
 
         std::reverse(post_order.begin(), post_order.end());
         linear_order = std::move(post_order);
+    }
+
+    void build_from_profile() {
+        // reverse post order breaks ties
+        build();
+        std::unordered_map<BasicBlock *, int> rpo_index;
+        for (BasicBlock *b : linear_order) rpo_index.emplace(b, rpo_index.size());
+
+        std::set<std::pair<BasicBlock *, BasicBlock *>> back_edges(
+            loop_analyzer->back_edges.begin(), loop_analyzer->back_edges.end());
+        std::unordered_map<BasicBlock *, int> waiting;  // forward preds not placed yet
+        for (BasicBlock *b : linear_order)
+            for (BasicBlock *pred : b->preds)
+                if (rpo_index.count(pred) && !back_edges.count({pred, b})) waiting[b]++;
+
+        // loop that is being laid out must be finished before anything outside of it
+        std::unordered_map<const Loop *, int> left;
+        for (BasicBlock *b : linear_order)
+            for (const Loop *l = loop_analyzer->get_loop(b); l; l = l->parent_loop) left[l]++;
+        std::vector<const Loop *> open;
+        for (const Loop &l : loop_analyzer->loops)
+            if (!l.header) open.push_back(&l);
+        auto inside = [&](BasicBlock *b) {
+            for (const Loop *l = loop_analyzer->get_loop(b); l; l = l->parent_loop)
+                if (l == open.back()) return true;
+            return false;
+        };
+
+        int64_t entry_count = graph->first->exec_count;
+        auto is_cold = [&](BasicBlock *b) {
+            return b->exec_count >= 0 && b->exec_count < entry_count * cold_ratio;
+        };
+        // hot before cold, then more executed, then reverse post order
+        auto better = [&](BasicBlock *x, BasicBlock *y) {
+            if (is_cold(x) != is_cold(y)) return !is_cold(x);
+            if (x->exec_count != y->exec_count) return x->exec_count > y->exec_count;
+            return rpo_index[x] < rpo_index[y];
+        };
+
+        std::vector<BasicBlock *> ready = {graph->first}, order;
+        while (!ready.empty()) {
+            BasicBlock *best = nullptr;
+            for (BasicBlock *b : ready)
+                if (inside(b) && (!best || better(b, best))) best = b;
+
+            // hottest successor of the last block falls through unless it is cold
+            BasicBlock *last = order.empty() ? nullptr : order.back();
+            int64_t best_edge = -1;
+            if (last)
+                for (BasicBlock *succ : {last->next1, last->next2})
+                    if (succ && !is_cold(succ) && inside(succ) &&
+                        std::find(ready.begin(), ready.end(), succ) != ready.end() &&
+                        edge_count(last, succ) > best_edge) {
+                        best = succ;
+                        best_edge = edge_count(last, succ);
+                    }
+            if (!best) throw "linear order: loop can't be laid out";
+
+            ready.erase(std::find(ready.begin(), ready.end(), best));
+            order.push_back(best);
+            for (const Loop *l = loop_analyzer->get_loop(best); l; l = l->parent_loop)
+                left[l]--;
+            if (best == loop_analyzer->get_loop(best)->header) {
+                std::vector<const Loop *> entered;
+                for (const Loop *l = loop_analyzer->get_loop(best); l != open.back();
+                     l = l->parent_loop)
+                    entered.push_back(l);
+                open.insert(open.end(), entered.rbegin(), entered.rend());
+            }
+            while (open.size() > 1 && !left[open.back()]) open.pop_back();
+
+            for (BasicBlock *succ : {best->next1, best->next2})
+                if (succ && !back_edges.count({best, succ}) && !--waiting[succ])
+                    ready.push_back(succ);
+        }
+        linear_order = std::move(order);
+    }
 
+    void number_instructions() {
         int next_num = 0;
         for (BasicBlock *b : linear_order) {
             b->linear_from = next_num;
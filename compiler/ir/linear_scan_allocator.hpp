@@ -2,114 +2,463 @@
 #define COMPILER_IR_LINEAR_SCAN_ALLOCATOR_HPP
 
 #include <algorithm>
+#include <climits>
+#include <cmath>
+#include <queue>
+#include <unordered_map>
 #include <vector>
 
+#include "basic_block.hpp"
 #include "instruction.hpp"
 #include "liveness_analyzer.hpp"
+#include "pass_stats.hpp"
+#include "register_config.hpp"
 
 namespace Compiler {
 namespace IR {
 
+// where each register is taken by calling convention: call clobbers caller saved ones
+// between reading arguments and writing result, arguments of method stay in their
+// registers until they are taken
+inline std::vector<LiveInterval> fixed_intervals(LivenessAnalyzer &liveness,
+                                                 const RegisterConfig &config) {
+    std::vector<LiveInterval> fixed(config.num_registers);
+    if (!config.has_calling_convention() || liveness.linear_order.empty()) return fixed;
+    int entry = liveness.linear_order.front()->linear_from;
+    for (BasicBlock *bb : liveness.linear_order)
+        for (auto inst = bb->first_not_phi; inst; inst = inst->next) {
+            int p = inst->linear_num;
+            if (inst->opcode == Call::opcode) {
+                for (int r = 0; r < config.num_registers; r++)
+                    if (config.caller_saved[r]) fixed[r].add_range(p, p + 1);
+            } else if (inst->opcode == GetArg::opcode) {
+                size_t idx = std::get<int>(inst->inputs[0].data);
+                if (idx < config.arg_regs.size())
+                    fixed[config.arg_regs[idx]].add_range(entry, p);
+            }
+        }
+    return fixed;
+}
+
+// linear scan from Wimmer & Franz "Linear Scan Register Allocation on SSA Form":
+// intervals keep their lifetime holes, so registers are shared across them, and an
+// interval under pressure is split, only the part between uses goes to the stack.
+// parts get locations in LiveInterval::loc, instruction gets location of its first part.
+// calls clobber caller saved registers, values that live across them get callee saved
+// ones or stack. values get only registers of their class
 class LinearScanAllocator {
    public:
     int R;
-    int next_stack_location = 0;
-    std::vector<int> free_registers;
-    std::vector<LiveInterval *> active;
+    int next_stack_location = 0;  // frame size in slots
+    int num_spilled = 0;          // values with a slot, frame size if slots were not shared
+    int num_splits = 0;
+
+    // when all registers are taken, evict intervals with the lowest spill weight unless
+    // current is cheaper, or the ones used furthest away if it is false
+    bool weighted_spills;
 
-    LinearScanAllocator(LivenessAnalyzer &liveness, int num_registers)
-        : R(num_registers) {
-        for (int i = num_registers - 1; i >= 0; --i) free_registers.push_back(i);
+    // free register of phi input, phi or previous part is taken first, then value stays
+    // in place and no move is needed
+    bool use_hints;
+    int num_hinted = 0;  // intervals that got hinted register
 
+    LinearScanAllocator(LivenessAnalyzer &liveness, int num_registers,
+                        bool weighted_spills_ = true, bool use_hints_ = true)
+        : LinearScanAllocator(liveness, RegisterConfig::uniform(num_registers),
+                              weighted_spills_, use_hints_) {}
+
+    LinearScanAllocator(LivenessAnalyzer &liveness, const RegisterConfig &config_,
+                        bool weighted_spills_ = true, bool use_hints_ = true)
+        : R(config_.num_registers),
+          weighted_spills(weighted_spills_),
+          use_hints(use_hints_),
+          config(config_),
+          fixed(fixed_intervals(liveness, config_)) {
+        PassTimer timer("linear scan", liveness.get_graph());
+        for (size_t i = 0; i < liveness.linear_order.size(); i++)
+            blocks.push_back({liveness.linear_order[i]->linear_from,
+                              liveness.linear_order[i]->linear_to, liveness.loop_depth[i]});
+
+        if (use_hints) collect_hints(liveness);
         allocate(liveness);
+        timer.count("spilled", num_spilled);
+        timer.count("splits", num_splits);
+        timer.count("hinted", num_hinted);
     }
 
    private:
-    int get_startpoint(const LiveInterval *i) const { return i->ranges.front().start; }
+    struct BlockInfo {
+        int from, to, loop_depth;
+    };
+
+    // value of other at other_pos, or fixed register reg, is copied to/from current at pos
+    struct Hint {
+        LiveInterval *other;
+        int pos, other_pos;
+        int reg = -1;
+    };
+
+    struct StartsLater {
+        bool operator()(const LiveInterval *a, const LiveInterval *b) const {
+            if (a->start() != b->start()) return a->start() > b->start();
+            return a->reg->id > b->reg->id;  // for determinism
+        }
+    };
+
+    RegisterConfig config;
+    std::vector<LiveInterval> fixed;  // where register is taken by calling convention
+    std::vector<BlockInfo> blocks;    // in linear order
+    std::priority_queue<LiveInterval *, std::vector<LiveInterval *>, StartsLater> unhandled;
+    std::vector<LiveInterval *> active;
+    std::vector<LiveInterval *> inactive;
+    std::vector<std::vector<LiveRange>> slot_busy;  // ranges of values in each slot
+    std::unordered_map<LiveInterval *, std::vector<Hint>> hints;  // by first part
+
+    void collect_hints(LivenessAnalyzer &liveness) {
+        for (BasicBlock *bb : liveness.linear_order)
+            if (config.has_calling_convention()) collect_fixed_hints(liveness, bb);
+
+        for (BasicBlock *bb : liveness.linear_order)
+            for (auto phi = bb->first_phi; phi && phi->opcode == PHI_OPCODE; phi = phi->next) {
+                LiveInterval *phi_interval = liveness.get_live_interval(phi);
+                if (!phi_interval) continue;
+                for (auto &inp : phi->inputs) {
+                    PhiInput pi = std::get<PhiInput>(inp.data);
+                    LiveInterval *input = liveness.get_live_interval(pi.first);
+                    if (!input || pi.second->linear_from < 0) continue;
+                    int pred_end = pi.second->linear_to - 1;
+                    hints[phi_interval].push_back({input, bb->linear_from, pred_end});
+                    hints[input].push_back({phi_interval, pred_end, bb->linear_from});
+                }
+            }
+    }
+
+    // arguments are wanted in argument registers and results in return register
+    void collect_fixed_hints(LivenessAnalyzer &liveness, BasicBlock *bb) {
+        auto add = [&](Instruction *value, int pos, int reg) {
+            if (LiveInterval *interval = liveness.get_live_interval(value))
+                hints[interval].push_back({nullptr, pos, 0, reg});
+        };
+        for (auto inst = bb->first_not_phi; inst; inst = inst->next) {
+            int p = inst->linear_num;
+            if (inst->opcode == Call::opcode) {
+                for (size_t i = 1; i < inst->inputs.size() && i - 1 < config.arg_regs.size(); i++)
+                    if (std::holds_alternative<Instruction *>(inst->inputs[i].data))
+                        add(std::get<Instruction *>(inst->inputs[i].data), p - 1,
+                            config.arg_regs[i - 1]);
+                add(inst, p + 1, config.return_reg);
+            } else if (inst->opcode == Ret::opcode && !inst->inputs.empty() &&
+                       std::holds_alternative<Instruction *>(inst->inputs[0].data)) {
+                add(std::get<Instruction *>(inst->inputs[0].data), p - 1, config.return_reg);
+            } else if (inst->opcode == GetArg::opcode) {
+                size_t idx = std::get<int>(inst->inputs[0].data);
+                if (idx < config.arg_regs.size()) add(inst, p, config.arg_regs[idx]);
+            }
+        }
+    }
 
-    int get_endpoint(const LiveInterval *i) const { return i->ranges.back().end; }
+    // free register that would make copy to or from current unnecessary
+    int hinted_reg(LiveInterval *current, const std::vector<int> &free_until) {
+        auto is_free = [&](const Location &loc) {
+            return loc.type == LocationType::REGISTER && free_until[loc.value] >= current->end();
+        };
+        if (current->parent) {
+            // previous part, then no move at split
+            const LiveInterval *prev = current->parent->child_at(current->start() - 1);
+            if (is_free(prev->loc)) return prev->loc.value;
+        }
+        auto it = hints.find(current->parent ? current->parent : current);
+        if (it == hints.end()) return -1;
+        for (const Hint &h : it->second) {
+            if (!current->covers(h.pos)) continue;
+            if (h.reg >= 0) {
+                if (is_free({LocationType::REGISTER, h.reg})) return h.reg;
+                continue;
+            }
+            const LiveInterval *other = h.other->child_at(h.other_pos);
+            if (other->covers(h.other_pos) && is_free(other->loc)) return other->loc.value;
+        }
+        return -1;
+    }
 
     void allocate(LivenessAnalyzer &liveness) {
-        std::vector<LiveInterval *> intervals;
         for (auto &pair : liveness.intervals)
-            if (!pair.second.ranges.empty()) intervals.push_back(&pair.second);
-
-        std::sort(intervals.begin(), intervals.end(),
-                  [this](const LiveInterval *a, const LiveInterval *b) {
-                      return get_startpoint(a) < get_startpoint(b);
-                  });
-
-        // LinearScanRegisterAllocation
-        // active <- {}
-        active.clear();
-
-        // for each live interval i, in order of increasing start point do
-        for (LiveInterval *i : intervals) {
-            ExpireOldIntervals(i);
-
-            if (active.size() == static_cast<size_t>(R)) {
-                SpillAtInterval(i);
-            } else {
-                // register[i] <- a register removed from pool of free registers
-                int reg = free_registers.back();
-                free_registers.pop_back();
-                i->reg->loc.type = LocationType::REGISTER;
-                i->reg->loc.value = reg;
-
-                // add i to active, sorted by increasing end point
-                insert_active(i);
+            if (!pair.second.ranges.empty()) unhandled.push(&pair.second);
+
+        while (!unhandled.empty()) {
+            LiveInterval *current = unhandled.top();
+            unhandled.pop();
+            int position = current->start();
+
+            for (auto it = active.begin(); it != active.end();) {
+                if ((*it)->end() <= position) {
+                    it = active.erase(it);
+                } else if (!(*it)->covers(position)) {
+                    inactive.push_back(*it);
+                    it = active.erase(it);
+                } else {
+                    ++it;
+                }
             }
+            for (auto it = inactive.begin(); it != inactive.end();) {
+                if ((*it)->end() <= position) {
+                    it = inactive.erase(it);
+                } else if ((*it)->covers(position)) {
+                    active.push_back(*it);
+                    it = inactive.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            if (!try_allocate_free_reg(current)) allocate_blocked_reg(current);
+            if (current->loc.type == LocationType::REGISTER) active.push_back(current);
         }
+
+        for (auto &[inst, interval] : liveness.intervals) inst->loc = interval.loc;
     }
 
-    void ExpireOldIntervals(LiveInterval *i) {
-        // for each interval j in active, in order of increasing end point do
-        auto it = active.begin();
-        while (it != active.end()) {
-            LiveInterval *j = *it;
-            // if endpoint[j] > startpoint[i] then
-            if (get_endpoint(j) > get_startpoint(i))
-                // return
-                return;
-            // remove j from active
+    bool try_allocate_free_reg(LiveInterval *current) {
+        std::vector<int> free_until(R, INT_MAX);
+        for (LiveInterval *it : active) free_until[it->loc.value] = 0;
+        for (LiveInterval *it : inactive) {
+            int pos = it->next_intersection(*current);
+            if (pos >= 0)
+                free_until[it->loc.value] = std::min(free_until[it->loc.value], pos);
+        }
+        std::vector<int> block_pos = fixed_block_pos(current);
+        for (int r = 0; r < R; r++) free_until[r] = std::min(free_until[r], block_pos[r]);
+
+        int reg = std::max_element(free_until.begin(), free_until.end()) - free_until.begin();
+        if (free_until[reg] <= current->start()) return false;
+        if (free_until[reg] >= current->end())
+            // caller saved one if it is enough, callee saved are for values across calls
+            for (int r = 0; r < R; r++)
+                if (config.caller_saved[r] && free_until[r] >= current->end()) {
+                    reg = r;
+                    break;
+                }
+
+        int hint = use_hints ? hinted_reg(current, free_until) : -1;
+        if (hint >= 0) {
+            num_hinted++;
+            current->loc = {LocationType::REGISTER, hint};
+            return true;
+        }
+
+        if (free_until[reg] < current->end()) {
+            // register is free only for the first part
+            int pos = find_split_pos(current->start(), free_until[reg]);
+            if (pos <= current->start()) return false;
+            unhandled.push(split(current, pos));
+        }
+        current->loc = {LocationType::REGISTER, reg};
+        return true;
+    }
+
+    void allocate_blocked_reg(LiveInterval *current) {
+        int position = current->start();
+        std::vector<int> block_pos = fixed_block_pos(current);
+        int reg = weighted_spills ? cheapest_reg(current, block_pos)
+                                  : furthest_used_reg(current, block_pos);
+        if (reg >= 0 && block_pos[reg] < current->end()) {
+            // register is taken by call later, the rest goes elsewhere
+            int pos = find_split_pos(position, block_pos[reg]);
+            if (pos > position)
+                unhandled.push(split(current, pos));
+            else
+                reg = -1;
+        }
+        if (reg < 0) {
+            // current is the one to wait on stack
+            spill(current, position);
+            return;
+        }
+
+        current->loc = {LocationType::REGISTER, reg};
+        // call result starts after the call and is copied there from return register, so
+        // value that lives across the call is saved before the call, not over the result
+        int evict_at = position;
+        if (!current->parent && current->reg->opcode == Call::opcode)
+            evict_at = std::min(position, current->reg->linear_num);
+        for (auto it = active.begin(); it != active.end();) {
+            if ((*it)->loc.value != reg) {
+                ++it;
+                continue;
+            }
+            split_and_spill(*it, evict_at, evict_at);
             it = active.erase(it);
-            // add register[j] to pool of free registers
-            free_registers.push_back(j->reg->loc.value);
+        }
+        for (auto it = inactive.begin(); it != inactive.end();) {
+            int pos = (*it)->loc.value == reg ? (*it)->next_intersection(*current) : -1;
+            if (pos < 0) {
+                ++it;
+                continue;
+            }
+            // first part keeps register as it ends before current needs it
+            if (split_and_spill(*it, pos, position) == *it)
+                it = inactive.erase(it);
+            else
+                ++it;
         }
     }
 
-    void SpillAtInterval(LiveInterval *i) {
-        // spill <- last interval in active
-        LiveInterval *spill = active.back();
+    double weight(const LiveInterval *it) const {
+        return it->spill_weight(config.has_calling_convention());
+    }
+
+    // register whose intervals have the lowest total spill weight. intervals used before
+    // current can't be evicted, -1 if every register has one or is taken by call, or if
+    // current itself is cheaper to spill than them
+    int cheapest_reg(LiveInterval *current, const std::vector<int> &block_pos) {
+        int position = current->start();
+        std::vector<double> cost(R, 0);
+        int first_use = current->next_use(position);
+        auto add_cost = [&](LiveInterval *it) {
+            // it would be filled before current needs the register
+            if (it->next_use(position) < first_use)
+                cost[it->loc.value] = HUGE_VAL;
+            else
+                cost[it->loc.value] += weight(it);
+        };
+        for (LiveInterval *it : active) add_cost(it);
+        for (LiveInterval *it : inactive)
+            if (it->next_intersection(*current) >= 0) add_cost(it);
+        for (int r = 0; r < R; r++)
+            if (block_pos[r] <= position) cost[r] = HUGE_VAL;
+
+        // register that is not clobbered by call goes first, even if it is more expensive
+        int reg = -1;
+        auto key = [&](int r) { return std::make_pair(block_pos[r] < current->end(), cost[r]); };
+        for (int r = 0; r < R; r++)
+            if (cost[r] != HUGE_VAL && (reg < 0 || key(r) < key(reg))) reg = r;
+        if (reg >= 0 && cost[reg] >= weight(current)) return -1;
+        return reg;
+    }
 
-        // if endpoint[spill] > endpoint[i] then
-        if (get_endpoint(spill) > get_endpoint(i)) {
-            // register[i] <- register[spill]
-            i->reg->loc.type = LocationType::REGISTER;
-            i->reg->loc.value = spill->reg->loc.value;
+    // register whose intervals are used furthest away, -1 if it is before current's use
+    int furthest_used_reg(LiveInterval *current, const std::vector<int> &block_pos) {
+        int position = current->start();
+        std::vector<int> use_pos(R, INT_MAX);
+        for (LiveInterval *it : active)
+            use_pos[it->loc.value] = std::min(use_pos[it->loc.value], it->next_use(position));
+        for (LiveInterval *it : inactive)
+            if (it->next_intersection(*current) >= 0)
+                use_pos[it->loc.value] =
+                    std::min(use_pos[it->loc.value], it->next_use(position));
+        for (int r = 0; r < R; r++) use_pos[r] = std::min(use_pos[r], block_pos[r]);
 
-            // location[spill] <- new stack location
-            spill->reg->loc.type = LocationType::STACK;
-            spill->reg->loc.value = next_stack_location++;
+        int reg = std::max_element(use_pos.begin(), use_pos.end()) - use_pos.begin();
+        return use_pos[reg] < current->next_use(position) || use_pos[reg] <= position ? -1
+                                                                                      : reg;
+    }
+
+    // where fixed intervals take registers from current, registers of other class are
+    // taken everywhere
+    std::vector<int> fixed_block_pos(LiveInterval *current) const {
+        std::vector<int> block_pos(R, INT_MAX);
+        for (int r = 0; r < R; r++) {
+            if (!config.can_hold(r, current->reg->type)) block_pos[r] = 0;
+            if (fixed[r].ranges.empty() || block_pos[r] == 0) continue;
+            int pos = fixed[r].next_intersection(*current);
+            if (pos >= 0) block_pos[r] = pos;
+        }
+        return block_pos;
+    }
 
-            // remove spill from active
-            active.pop_back();
-            // add i to active, sorted by increasing end point
-            insert_active(i);
+    // spills interval from pos on, returns the spilled part
+    LiveInterval *split_and_spill(LiveInterval *it, int pos, int position) {
+        int prev_use = it->prev_use(pos);
+        int min_pos = std::max(it->start(), prev_use - 1);
+        int split_pos = find_split_pos(min_pos, pos);
+        LiveInterval *spilled = split_pos > it->start() ? split(it, split_pos) : it;
+        spill(spilled, position);
+        return spilled;
+    }
+
+    // puts interval on stack until its next use, the rest is allocated later. constants
+    // and arguments that are not in registers of calling convention need no slot, they
+    // are computed again
+    void spill(LiveInterval *it, int position) {
+        LiveInterval *root = it->parent ? it->parent : it;
+        if (is_rematerializable(root->reg, config.has_calling_convention())) {
+            it->loc = {LocationType::REMAT, 0};
         } else {
-            // location[i] <- new stack location
-            i->reg->loc.type = LocationType::STACK;
-            i->reg->loc.value = next_stack_location++;
+            if (root->spill_slot < 0) root->spill_slot = get_spill_slot(root);
+            it->loc = {LocationType::STACK, root->spill_slot};
+        }
+
+        int next_use = it->next_use(it->start());
+        if (next_use == INT_MAX) return;
+        int pos = find_split_pos(std::max(it->start(), position - 1), next_use - 1);
+        if (pos > it->start() && pos >= position) unhandled.push(split(it, pos));
+    }
+
+    // slot is shared by values that are never live at the same time. whole value is
+    // counted, not only the parts on stack, as edge moves may write the slot anywhere
+    int get_spill_slot(LiveInterval *root) {
+        std::vector<LiveRange> busy = root->ranges;
+        for (auto &child : root->children)
+            busy.insert(busy.end(), child->ranges.begin(), child->ranges.end());
+        // phi is written by moves at the end of its preds
+        if (root->reg->opcode == PHI_OPCODE)
+            for (BasicBlock *pred : root->reg->bb->preds)
+                if (pred->linear_from >= 0) busy.push_back({pred->linear_to - 1, pred->linear_to});
+
+        auto overlaps = [&](const std::vector<LiveRange> &other) {
+            for (const LiveRange &a : busy)
+                for (const LiveRange &b : other)
+                    if (a.start < b.end && b.start < a.end) return true;
+            return false;
+        };
+
+        num_spilled++;
+        size_t slot = 0;
+        while (slot < slot_busy.size() && overlaps(slot_busy[slot])) slot++;
+        if (slot == slot_busy.size()) {
+            slot_busy.emplace_back();
+            next_stack_location++;
         }
+        slot_busy[slot].insert(slot_busy[slot].end(), busy.begin(), busy.end());
+        return slot;
     }
 
-    // maintains sort order
-    void insert_active(LiveInterval *i) {
-        auto it = std::upper_bound(active.begin(), active.end(), i,
-                                   [this](const LiveInterval *a, const LiveInterval *b) {
-                                       return get_endpoint(a) < get_endpoint(b);
-                                   });
-        active.insert(it, i);
+    LiveInterval *split(LiveInterval *it, int pos) {
+        num_splits++;
+        return it->split_at(pos);
+    }
+
+    size_t block_at(int pos) const {
+        auto it = std::upper_bound(blocks.begin(), blocks.end(), pos,
+                                   [](int p, const BlockInfo &b) { return p < b.from; });
+        return it == blocks.begin() ? 0 : it - blocks.begin() - 1;
+    }
+
+    // moves can be placed at block start (resolution puts them on edges) or between
+    // two instructions, but not after the last one as it may be the branch condition
+    int valid_split_pos(int pos) const {
+        if (blocks.empty()) return pos;
+        const BlockInfo &b = blocks[block_at(pos)];
+        if (pos <= b.from) return b.from;
+        if (pos % 2 == 0) pos--;
+        if (pos >= b.to - 1) pos = b.to - 3;
+        return pos < b.from ? b.from : pos;
+    }
+
+    // split position in (min_pos, max_pos]: latest block start with the lowest loop depth,
+    // so moves leave loops, or max_pos itself if it is not deeper than any of them
+    int find_split_pos(int min_pos, int max_pos) const {
+        int best = valid_split_pos(max_pos);
+        if (blocks.empty()) return best;
+        int best_depth = blocks[block_at(max_pos)].loop_depth;
+        for (size_t i = block_at(max_pos) + 1; i-- > 0;) {
+            if (blocks[i].from <= min_pos) break;
+            if (blocks[i].from <= max_pos && blocks[i].loop_depth < best_depth) {
+                best = blocks[i].from;
+                best_depth = blocks[i].loop_depth;
+            }
+        }
+        return best;
     }
 };
 
@@ -2,28 +2,156 @@
 #define COMPILER_IR_LINEAR_SCAN_REWRITER_HPP
 
 #include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <map>
+#include <unordered_map>
 #include <vector>
 
 #include "basic_block.hpp"
 #include "graph.hpp"
 #include "instruction.hpp"
+#include "liveness_analyzer.hpp"
+#include "pass_stats.hpp"
+#include "register_config.hpp"
 
 namespace Compiler {
 namespace IR {
 
 const opcode_t MOVE_OPCODE = 'MOVE';
 
+// turns allocation into code: moves where interval is split, moves on cfg edges where
+// value or phi changes location, fills for stack operands and spills for stack defs.
+// rematerialized values get a copy of their definition instead of a fill. with calling
+// convention arguments are moved to their registers and result is taken from return one
+// afterwards an input tells where the value is read from, it is not ssa anymore.
+// with place_spills value goes to its slot once after definition when that is cheaper
+// than spilling at every split, fills are reused inside of block and stack value that
+// is invariant in a loop is filled once at preheader if some register is free in loop
 class LinearScanRewriter {
    public:
+    // registers above R the rewriter writes: operands of one instruction are loaded into
+    // them, three for select, and parallel copies use the first two
+    static constexpr int NUM_SCRATCH = 3;
+
     int scratch_base;  // temporaries for spill/fill start after other registers
+    int num_remats = 0;
+    int num_moves = 0;  // moves, fills and spills of split and edge copies
+    int num_hoisted = 0;   // fills moved to preheaders
+    int num_reused = 0;    // operands that took value filled for previous instruction
+
+    LinearScanRewriter(Graph *graph_, int R, LivenessAnalyzer &liveness_,
+                       bool place_spills = true)
+        : LinearScanRewriter(graph_, RegisterConfig::uniform(R), liveness_, place_spills) {}
+
+    LinearScanRewriter(Graph *graph_, const RegisterConfig &config_, LivenessAnalyzer &liveness_,
+                       bool place_spills_ = true)
+        : scratch_base(config_.num_registers),
+          graph(graph_),
+          liveness(liveness_),
+          config(config_),
+          place_spills(place_spills_) {
+        PassTimer timer("rewrite", graph);
+        std::vector<Instruction *> insts;
+        for (BasicBlock &bb : graph->basic_blocks)
+            for (Instruction *inst = bb.first_not_phi; inst; inst = inst->next) {
+                insts.push_back(inst);
+                inst_at[inst->linear_num] = inst;
+            }
 
-    LinearScanRewriter(Graph *graph, int R) : scratch_base(R) {
-        rewrite_normal_instructions(graph);
-        resolve_phi_nodes(graph);
-        fix_conditional_branch_conditions(graph);
+        if (place_spills) choose_def_spills();
+        insert_def_spills(insts);
+        if (place_spills) hoist_loop_fills();
+        insert_split_moves();
+        resolve_edges();
+        for (auto &p : pending)
+            set_input(p.inst, p.inst->inputs[0], get_holder(p.value, p.from));
+        rewrite_operands(insts);
+        timer.count("moves", num_moves);
+        timer.count("remats", num_remats);
+        timer.count("hoisted fills", num_hoisted);
+        timer.count("reused fills", num_reused);
     }
 
    private:
+    struct Copy {
+        Instruction *value;  // what is read from "from"
+        Location from, to;
+        Instruction *src = nullptr;   // holder of value if it is already known
+        Instruction *user = nullptr;  // copy is read by this input of phi, call or ret
+        size_t input = 0;
+    };
+
+    struct PendingInput {
+        Instruction *inst;
+        Instruction *value;
+        Location from;
+    };
+
+    struct ScratchState {
+        std::unordered_map<int, std::pair<Instruction *, Instruction *>> regs;  // value, holder
+        std::unordered_map<int, int> written;  // when register was written last
+        int clock = 0;
+    };
+
+    struct HoistedFill {
+        Instruction *value;
+        int from, to;  // loop
+        Instruction *fill;
+    };
+
+    Graph *graph;
+    LivenessAnalyzer &liveness;
+    RegisterConfig config;
+    bool place_spills;
+    std::unordered_map<int, Instruction *> inst_at;
+    std::unordered_map<Instruction *, Location> spilled_at_def;  // slot is valid after def
+    std::vector<HoistedFill> hoisted;
+    std::unordered_map<Instruction *, Instruction *> loads;  // fill or remat -> its value
+    std::unordered_map<Instruction *, std::vector<Instruction *>> holders;
+    std::vector<PendingInput> pending;
+
+    static bool same(Location a, Location b) { return a.type == b.type && a.value == b.value; }
+
+    bool is_scratch(Location loc) const {
+        return loc.type == LocationType::REGISTER && loc.value >= scratch_base;
+    }
+
+    // some instruction that keeps value in loc
+    Instruction *get_holder(Instruction *value, Location loc) {
+        for (Instruction *h : holders[value])
+            if (same(h->loc, loc)) return h;
+        return value;
+    }
+
+    const LiveInterval *part_at(Instruction *value, int pos) {
+        LiveInterval *interval = liveness.get_live_interval(value);
+        return interval ? interval->child_at(pos) : nullptr;
+    }
+
+    int depth_at(int pos) const {
+        for (size_t i = 0; i < liveness.linear_order.size(); i++)
+            if (pos < liveness.linear_order[i]->linear_to) return liveness.loop_depth[i];
+        return 0;
+    }
+
+    Instruction *hoisted_fill(Instruction *value, int pos) const {
+        for (const HoistedFill &h : hoisted)
+            if (h.value == value && h.from <= pos && pos < h.to) return h.fill;
+        return nullptr;
+    }
+
+    // copy from stack inside of loop takes value from register filled at preheader
+    Copy from_hoisted(Copy c, int from_pos, int to_pos) const {
+        if (c.from.type != LocationType::STACK) return c;
+        Instruction *fill = hoisted_fill(c.value, from_pos);
+        if (fill && fill == hoisted_fill(c.value, to_pos)) {
+            c.from = fill->loc;
+            c.src = fill;
+        }
+        return c;
+    }
+
     static void do_insert_before(Instruction *target, Instruction *new_inst,
                                  BasicBlock &bb) {
         new_inst->next = target;
@@ -33,156 +161,477 @@ class LinearScanRewriter {
         if (bb.first_not_phi == target) bb.first_not_phi = new_inst;
     }
 
-    void rewrite_normal_instructions(Graph *graph) {
-        for (BasicBlock &bb : graph->basic_blocks) {
-            Instruction *inst = bb.first_not_phi;
-            while (inst) inst = process_inst(inst, bb);
+    void insert_def_spills(const std::vector<Instruction *> &insts) {
+        for (Instruction *inst : insts) {
+            holders[inst].push_back(inst);
+            if (inst->opcode == Call::opcode && config.has_calling_convention())
+                take_call_result(inst);
+            auto at_def = spilled_at_def.find(inst);
+            if (at_def != spilled_at_def.end()) {
+                Instruction *spill =
+                    inst->next ? create_instruction(inst->bb, Spill::opcode, inst->type, {inst},
+                                                    at_def->second, inst->next)
+                               : create_instruction(inst->bb, Spill::opcode, inst->type, {inst},
+                                                    at_def->second);
+                holders[inst].push_back(spill);
+                continue;
+            }
+            if (inst->opcode == Call::opcode && config.has_calling_convention()) continue;
+            if (inst->loc.type == LocationType::REMAT) {
+                inst->loc = {LocationType::REGISTER, scratch_base};
+                continue;
+            }
+            if (inst->loc.type != LocationType::STACK || inst->type == Types::VOID_T)
+                continue;
+
+            BasicBlock &bb = *inst->bb;
+            Location stack = inst->loc;
+            inst->loc = {LocationType::REGISTER, scratch_base};
+            // branch needs the condition value in a register, dont spill it
+            if (bb.next1 && bb.next2 && inst == bb.last) continue;
+
+            Instruction *spill = inst->next
+                                     ? create_instruction(&bb, Spill::opcode, inst->type,
+                                                          {inst}, stack, inst->next)
+                                     : create_instruction(&bb, Spill::opcode, inst->type,
+                                                          {inst}, stack);
+            holders[inst].push_back(spill);
         }
     }
 
-    Instruction *process_inst(Instruction *inst, BasicBlock &bb) {
-        Instruction *next_inst = inst->next;
+    // value that is in register at definition and goes to stack later is stored there once
+    // right after definition if it runs less often than stores at splits, then its slot
+    // is valid everywhere and moves to stack are not needed
+    void choose_def_spills() {
+        for (auto &[value, interval] : liveness.intervals) {
+            if (interval.loc.type != LocationType::REGISTER || interval.spill_slot < 0 ||
+                value->opcode == PHI_OPCODE || value->type == Types::VOID_T)
+                continue;
+            if (value->bb->next2 && value == value->bb->last) continue;  // branch condition
+
+            double at_splits = 0;
+            const LiveInterval *prev = &interval;
+            for (auto &child : interval.children) {
+                if (child->loc.type == LocationType::STACK &&
+                    prev->loc.type != LocationType::STACK)
+                    at_splits += std::pow(10.0, depth_at(child->start()));
+                prev = child.get();
+            }
+            if (std::pow(10.0, depth_at(value->linear_num)) <= at_splits)
+                spilled_at_def[value] = {LocationType::STACK, interval.spill_slot};
+        }
+    }
 
-        if (inst->opcode == Spill::opcode || inst->opcode == Fill::opcode ||
-            inst->opcode == MOVE_OPCODE)
-            return next_inst;
+    // call leaves result in return register, it is copied to where allocator put it
+    void take_call_result(Instruction *call) {
+        Location want = call->loc;
+        Location ret = {LocationType::REGISTER, config.return_reg};
+        call->loc = ret;
+        if (want.type == LocationType::UNASSIGNED || same(want, ret)) return;
+
+        opcode_t opcode = want.type == LocationType::STACK ? Spill::opcode : MOVE_OPCODE;
+        Instruction *copy =
+            call->next ? create_instruction(call->bb, opcode, call->type, {call}, want, call->next)
+                       : create_instruction(call->bb, opcode, call->type, {call}, want);
+        holders[call].push_back(copy);
+    }
 
-        // insert fill before every use of a stack value
-        int scratch_idx = 0;
-        for (Input &inp : inst->inputs) {
-            if (std::holds_alternative<Instruction *>(inp.data)) {
-                Instruction *def = std::get<Instruction *>(inp.data);
-                if (def->loc.type == LocationType::STACK) {
-                    Instruction *fill_inst = new Instruction(
-                        nullptr, nullptr, Fill::opcode, def->type, &bb, {def}, {}, 0);
-
-                    do_insert_before(inst, fill_inst, bb);
-
-                    // update user lists
-                    def->users.emplace_back(fill_inst);
-                    auto &def_users = def->users;
-                    def_users.erase(
-                        std::remove_if(def_users.begin(), def_users.end(),
-                                       [&](const User &u) { return u.inst == inst; }),
-                        def_users.end());
-                    fill_inst->users.emplace_back(inst);
-
-                    inp.data = fill_inst;
-                    fill_inst->loc = {LocationType::REGISTER,
-                                      scratch_base + scratch_idx++};
+    // interval parts that start between two instructions get value from previous part
+    void insert_split_moves() {
+        std::map<int, std::vector<Copy>> copies;
+        for (auto &[value, interval] : liveness.intervals)
+            for (auto &child : interval.children) {
+                int pos = child->start();
+                if (pos % 2 == 0) continue;  // block start, edges take care of it
+                const LiveInterval *prev = interval.child_at(pos - 1);
+                if (same(prev->loc, child->loc) || child->loc.type == LocationType::REMAT ||
+                    (child->loc.type == LocationType::STACK && spilled_at_def.count(value)))
+                    continue;
+                Copy c = from_hoisted({value, prev->loc, child->loc}, pos, pos);
+                if (!same(c.from, c.to)) copies[pos].push_back(c);
+            }
+
+        for (auto &[pos, list] : copies) {
+            Instruction *before = inst_at.at(pos + 1);
+            emit_parallel_copy(list, *before->bb, before);
+        }
+    }
+
+    void resolve_edges() {
+        size_t num_blocks = graph->basic_blocks.size();
+        for (size_t i = 0; i < num_blocks; i++) {
+            BasicBlock *pred = &graph->basic_blocks[i];
+            if (pred->linear_from < 0) continue;  // unreachable
+            for (BasicBlock *succ : {pred->next1, pred->next2})
+                if (succ) resolve_edge(pred, succ);
+        }
+    }
+
+    void resolve_edge(BasicBlock *pred, BasicBlock *succ) {
+        std::vector<Copy> copies;
+        int pred_end = pred->linear_to - 1;
+
+        for (auto &[value, interval] : liveness.intervals) {
+            if (value->opcode == PHI_OPCODE && value->bb == succ) continue;
+            const LiveInterval *to = interval.child_at(succ->linear_from);
+            if (!to->covers(succ->linear_from)) continue;
+            const LiveInterval *from = interval.child_at(pred_end);
+            copies.push_back(from_hoisted({value, from->loc, to->loc}, pred_end, succ->linear_from));
+        }
+
+        for (auto phi = succ->first_phi; phi && phi->opcode == PHI_OPCODE; phi = phi->next)
+            for (size_t i = 0; i < phi->inputs.size(); i++) {
+                PhiInput pi = std::get<PhiInput>(phi->inputs[i].data);
+                if (pi.second != pred) continue;
+                const LiveInterval *from = part_at(pi.first, pred_end);
+                if (!from || from->loc.type == LocationType::UNASSIGNED ||
+                    phi->loc.type == LocationType::UNASSIGNED)
+                    continue;
+                copies.push_back(from_hoisted({pi.first, from->loc, phi->loc, nullptr, phi, i},
+                                              pred_end, succ->linear_from));
+            }
+
+        copies.erase(std::remove_if(copies.begin(), copies.end(),
+                                    [&](const Copy &c) {
+                                        return same(c.from, c.to) ||
+                                               c.to.type == LocationType::REMAT ||
+                                               (!c.user && c.to.type == LocationType::STACK &&
+                                                spilled_at_def.count(c.value));
+                                    }),
+                     copies.end());
+        if (copies.empty()) return;
+
+        if (!pred->next2) {
+            emit_parallel_copy(copies, *pred, nullptr);
+        } else if (succ->preds.size() == 1) {
+            emit_parallel_copy(copies, *succ, succ->first_not_phi);
+        } else {
+            // critical edge, moves get their own block
+            emit_parallel_copy(copies, *split_edge(graph, pred, succ), nullptr);
+        }
+    }
+
+    // blocks of loop are contiguous in linear order and header is the first of them.
+    // register is free in loop if no part of other interval and no other hoisted fill has
+    // it there, reloads of the value itself into it only copy the same value. caller saved
+    // ones are skipped as calls and their arguments write them
+    void hoist_loop_fills() {
+        std::vector<std::vector<std::pair<LiveRange, Instruction *>>> taken(config.num_registers);
+        for (auto &[value, interval] : liveness.intervals) {
+            std::vector<const LiveInterval *> parts = {&interval};
+            for (auto &child : interval.children) parts.push_back(child.get());
+            for (const LiveInterval *part : parts)
+                if (part->loc.type == LocationType::REGISTER &&
+                    part->loc.value < config.num_registers)
+                    for (const LiveRange &r : part->ranges)
+                        taken[part->loc.value].push_back({r, value});
+        }
+        auto is_free = [&](int reg, int from, int to, Instruction *value) {
+            if (!config.caller_saved.empty() && config.caller_saved[reg]) return false;
+            for (auto &[r, owner] : taken[reg])
+                if (owner != value && r.start < to && from < r.end) return false;
+            return true;
+        };
+
+        // outer loops first, they save more
+        for (BasicBlock *header : liveness.linear_order) {
+            int from = header->linear_from, to = -1;
+            BasicBlock *preheader = nullptr;
+            int entries = 0;
+            for (BasicBlock *pred : header->preds) {
+                if (pred->linear_from < 0) continue;
+                if (pred->linear_from >= from) {
+                    to = std::max(to, pred->linear_to);
+                } else {
+                    preheader = pred;
+                    entries++;
                 }
             }
+            if (to < 0 || entries != 1 || preheader->next2) continue;
+            int pred_end = preheader->linear_to - 1;
+
+            for (auto &[value, interval] : liveness.intervals) {
+                if (value->linear_num >= from || !interval.child_at(pred_end)->covers(pred_end) ||
+                    hoisted_fill(value, from))
+                    continue;
+                Location src = interval.child_at(pred_end)->loc;
+                if (src.type == LocationType::REMAT || !reads_stack_in(interval, from, to))
+                    continue;
+
+                int reg = 0;
+                while (reg < config.num_registers &&
+                       (!config.can_hold(reg, value->type) || !is_free(reg, pred_end, to, value)))
+                    reg++;
+                if (reg == config.num_registers) break;
+
+                opcode_t opcode = src.type == LocationType::STACK ? Fill::opcode : MOVE_OPCODE;
+                Instruction *fill = create_instruction(preheader, opcode, value->type, {value},
+                                                       {LocationType::REGISTER, reg});
+                pending.push_back({fill, value, src});
+                hoisted.push_back({value, from, to, fill});
+                taken[reg].push_back({{pred_end, to}, nullptr});
+                num_hoisted++;
+            }
+        }
+    }
+
+    // some use or reload of value in [from, to) would be a fill
+    static bool reads_stack_in(const LiveInterval &interval, int from, int to) {
+        std::vector<const LiveInterval *> parts = {&interval};
+        for (auto &child : interval.children) parts.push_back(child.get());
+        for (const LiveInterval *part : parts)
+            for (const UsePosition &use : part->use_positions)
+                if (use.pos >= from && use.pos < to &&
+                    interval.child_at(use.pos - 1)->loc.type == LocationType::STACK)
+                    return true;
+        for (auto &child : interval.children) {
+            int pos = child->start();
+            if (pos > from && pos < to && child->loc.type != LocationType::STACK &&
+                interval.child_at(pos - 1)->loc.type == LocationType::STACK)
+                return true;
         }
+        return false;
+    }
 
-        // insert spills
-        if (inst->loc.type == LocationType::STACK && inst->type != Types::VOID_T) {
-            const bool is_condition =
-                (bb.next1 != nullptr && bb.next2 != nullptr && inst->next == nullptr);
+    // copies happen at once, so order them to not overwrite what is still needed and
+    // break cycles with scratch register. every location is written once, so value that
+    // is already in some register is copied from there instead of memory
+    void emit_parallel_copy(std::vector<Copy> copies, BasicBlock &bb, Instruction *before) {
+        std::unordered_map<Instruction *, Instruction *> in_reg;
+        while (!copies.empty()) {
+            auto ready = std::find_if(copies.begin(), copies.end(), [&](const Copy &c) {
+                return std::none_of(copies.begin(), copies.end(), [&](const Copy &other) {
+                    return &other != &c && same(other.from, c.to);
+                });
+            });
+            if (ready != copies.end()) {
+                Copy c = *ready;
+                copies.erase(ready);
+                auto loaded = in_reg.find(c.value);
+                if (c.from.type != LocationType::REGISTER && loaded != in_reg.end()) {
+                    c.from = loaded->second->loc;
+                    c.src = loaded->second;
+                }
+                Instruction *inst = emit_copy(c, bb, before);
+                if (c.to.type == LocationType::REGISTER && !is_scratch(c.to))
+                    in_reg.emplace(c.value, inst);
+                continue;
+            }
 
-            if (is_condition) {
-                // branch needs the condition value in a register, dont spill it
-                inst->loc = {LocationType::REGISTER, scratch_base};
+            Location blocked = copies.front().to;
+            Location tmp = {LocationType::REGISTER, scratch_base};
+            auto reader = std::find_if(copies.begin(), copies.end(),
+                                       [&](const Copy &c) { return same(c.from, blocked); });
+            Instruction *saved = emit_copy({reader->value, blocked, tmp, reader->src}, bb, before);
+            for (Copy &c : copies)
+                if (same(c.from, blocked)) {
+                    c.from = tmp;
+                    c.src = saved;
+                }
+        }
+    }
+
+    Instruction *emit_copy(const Copy &c, BasicBlock &bb, Instruction *before) {
+        Instruction *inst = nullptr;
+        if (c.from.type == LocationType::REMAT) {
+            if (c.to.type == LocationType::STACK) {
+                Location tmp = {LocationType::REGISTER, scratch_base + 1};
+                Instruction *value = rematerialize(c.value, bb, tmp, before);
+                inst = create_instruction(&bb, Spill::opcode, c.value->type, {value}, c.to,
+                                          before);
             } else {
-                int stack_slot = inst->loc.value;
-                inst->loc = {LocationType::REGISTER, scratch_base};
+                inst = rematerialize(c.value, bb, c.to, before);
+            }
+        } else if (c.from.type == LocationType::STACK && c.to.type == LocationType::STACK) {
+            Location tmp = {LocationType::REGISTER, scratch_base + 1};
+            Instruction *fill =
+                create_instruction(&bb, Fill::opcode, c.value->type, {}, tmp, before);
+            add_source(fill, c);
+            inst = create_instruction(&bb, Spill::opcode, c.value->type, {fill}, c.to, before);
+        } else {
+            opcode_t opcode = c.from.type == LocationType::STACK ? Fill::opcode
+                              : c.to.type == LocationType::STACK ? Spill::opcode
+                                                                 : MOVE_OPCODE;
+            inst = create_instruction(&bb, opcode, c.value->type, {}, c.to, before);
+            add_source(inst, c);
+        }
 
-                Instruction *spill_inst = new Instruction(inst, inst->next, Spill::opcode,
-                                                          inst->type, &bb, {inst}, {}, 0);
-
-                if (inst->next)
-                    inst->next->prev = spill_inst;
-                else
-                    bb.last = spill_inst;
-                inst->next = spill_inst;
-
-                spill_inst->users = std::move(inst->users);
-                inst->users.clear();
-                inst->users.emplace_back(spill_inst);
-
-                for (User &u : spill_inst->users)
-                    for (Input &u_inp : u.inst->inputs)
-                        if (std::holds_alternative<Instruction *>(u_inp.data) &&
-                            std::get<Instruction *>(u_inp.data) == inst) {
-                            u_inp.data = spill_inst;
-                        } else if (std::holds_alternative<PhiInput>(u_inp.data)) {
-                            PhiInput &phi_inp = std::get<PhiInput>(u_inp.data);
-                            if (phi_inp.first == inst) phi_inp.first = spill_inst;
-                        }
-                spill_inst->loc = {LocationType::STACK, stack_slot};
-            }
-        }
-
-        return next_inst;
-    }
-
-    void resolve_phi_nodes(Graph *graph) {
-        for (BasicBlock &bb : graph->basic_blocks) {
-            Instruction *phi = bb.first_phi;
-            while (phi && phi->opcode == PHI_OPCODE) {
-                Location dst_loc = phi->loc;
-                for (Input &inp : phi->inputs)
-                    if (std::holds_alternative<PhiInput>(inp.data))
-                        process_phi_input(phi, std::get<PhiInput>(inp.data), dst_loc);
-                phi = phi->next;
-            }
-        }
-    }
-
-    void process_phi_input(Instruction *phi, PhiInput &phi_inp, Location dst_loc) {
-        Instruction *src = phi_inp.first;
-        BasicBlock *pred = phi_inp.second;
-        Location src_loc = src->loc;
-
-        if (src_loc.type == LocationType::UNASSIGNED ||
-            dst_loc.type == LocationType::UNASSIGNED)
-            return;
-
-        const bool is_conditional = (pred->next1 && pred->next2);
-        Instruction *condition_instr = is_conditional ? pred->last : nullptr;
-        const bool is_condition_resolution = is_conditional && (src == condition_instr);
-        Instruction *insert_before =
-            (is_conditional && !is_condition_resolution) ? condition_instr : nullptr;
-
-        bool need_resolution = false;
-        Instruction *res_inst = nullptr;
-
-        if (src_loc.type == LocationType::STACK &&
-            dst_loc.type == LocationType::REGISTER) {
-            res_inst = create_instruction(pred, Fill::opcode, src->type, {src}, dst_loc,
-                                          insert_before);
-            need_resolution = true;
-        } else if (src_loc.type == LocationType::REGISTER &&
-                   dst_loc.type == LocationType::STACK) {
-            res_inst = create_instruction(pred, Spill::opcode, src->type, {src}, dst_loc,
-                                          insert_before);
-            need_resolution = true;
-        } else if (src_loc.type == LocationType::REGISTER &&
-                   dst_loc.type == LocationType::REGISTER &&
-                   src_loc.value != dst_loc.value) {
-            res_inst = create_instruction(pred, MOVE_OPCODE, src->type, {src}, dst_loc,
-                                          insert_before);
-            need_resolution = true;
-        } else if (src_loc.type == LocationType::STACK &&
-                   dst_loc.type == LocationType::STACK &&
-                   src_loc.value != dst_loc.value) {
-            Location tmp = {LocationType::REGISTER, scratch_base};
-            Instruction *fill_tmp = create_instruction(pred, Fill::opcode, src->type,
-                                                       {src}, tmp, insert_before);
-            res_inst = create_instruction(pred, Spill::opcode, src->type, {fill_tmp},
-                                          dst_loc, insert_before);
-            need_resolution = true;
+        num_moves++;
+        if (c.user && c.user->opcode == PHI_OPCODE) {
+            Input &inp = c.user->inputs[c.input];
+            PhiInput &pi = std::get<PhiInput>(inp.data);
+            auto &users = pi.first->users;
+            auto it = std::find_if(users.begin(), users.end(),
+                                   [&](const User &u) { return u.inst == c.user; });
+            if (it != users.end()) users.erase(it);
+            pi.first = inst;
+            inst->users.emplace_back(c.user);
+        } else if (c.user) {
+            set_input(c.user, c.user->inputs[c.input], inst);
+        } else if (!is_scratch(c.to)) {
+            holders[c.value].push_back(inst);
         }
+        return inst;
+    }
 
-        if (need_resolution) {
-            auto &src_users = src->users;
-            src_users.erase(std::remove_if(src_users.begin(), src_users.end(),
-                                           [&](const User &u) { return u.inst == phi; }),
-                            src_users.end());
-            res_inst->users.emplace_back(phi);
-            phi_inp.first = res_inst;
+    void add_source(Instruction *inst, const Copy &c) {
+        if (c.src) {
+            inst->add_input(c.src);
+        } else {
+            inst->add_input(c.value);
+            pending.push_back({inst, c.value, c.from});
         }
     }
 
+    // operands of call and ret go to registers of calling convention at once. arguments
+    // that don't fit them are stored to outgoing slots below the frame, -1 is the first
+    // one, and target of indirect call is kept in the last scratch register, so argument
+    // moves don't overwrite them
+    bool rewrite_convention_operands(Instruction *inst) {
+        bool is_call = inst->opcode == Call::opcode;
+        if (!config.has_calling_convention() || (!is_call && inst->opcode != Ret::opcode))
+            return false;
+
+        std::vector<Copy> copies;
+        for (size_t i = 0; i < inst->inputs.size(); i++) {
+            if (!std::holds_alternative<Instruction *>(inst->inputs[i].data)) continue;
+            Instruction *value = std::get<Instruction *>(inst->inputs[i].data);
+            const LiveInterval *part = part_at(value, inst->linear_num - 1);
+            if (!part) continue;
+
+            Location to = {LocationType::REGISTER, config.return_reg};
+            if (is_call && i == 0)
+                to = {LocationType::REGISTER, scratch_base + NUM_SCRATCH - 1};
+            else if (is_call && i - 1 < config.arg_regs.size())
+                to = {LocationType::REGISTER, config.arg_regs[i - 1]};
+            else if (is_call)
+                to = {LocationType::STACK, -int(i - config.arg_regs.size())};
+            Location from = part->loc;
+            Instruction *src = from.type == LocationType::REMAT ? nullptr : get_holder(value, from);
+            if (Instruction *fill = hoisted_fill(value, inst->linear_num)) {
+                from = fill->loc;
+                src = fill;
+            }
+            copies.push_back({value, from, to, src, inst, i});
+        }
+        copies.erase(std::remove_if(copies.begin(), copies.end(),
+                                    [&](const Copy &c) {
+                                        if (!same(c.from, c.to)) return false;
+                                        set_input(c.user, c.user->inputs[c.input], c.src);
+                                        return true;
+                                    }),
+                     copies.end());
+        emit_parallel_copy(copies, *inst->bb, inst);
+        return true;
+    }
+
+    // scratch registers keep what was filled or rematerialized into them until something
+    // else writes them, so next instructions of the block read it from there
+    void rewrite_operands(const std::vector<Instruction *> &insts) {
+        ScratchState scratch;
+        Instruction *done = nullptr;  // scratch state is known up to it
+
+        for (Instruction *inst : insts) {
+            if (!done || done->bb != inst->bb) {
+                scratch = {};
+                done = nullptr;
+            }
+            for (Instruction *i = done ? done->next : inst->bb->first_not_phi; i != inst;
+                 i = i->next)
+                track(scratch, i, nullptr);
+            Instruction *before = inst->prev;
+
+            if (!rewrite_convention_operands(inst)) rewrite_inputs(inst, scratch);
+
+            for (Instruction *i = before ? before->next : inst->bb->first_not_phi; i != inst;
+                 i = i->next)
+                track(scratch, i, nullptr);
+            track(scratch, inst, inst);
+            done = inst;
+        }
+    }
+
+    void track(ScratchState &scratch, Instruction *i, Instruction *value) {
+        if (i->opcode == Call::opcode) scratch.regs.clear();
+        if (!is_scratch(i->loc)) return;
+        auto it = loads.find(i);
+        if (it != loads.end()) value = it->second;
+        if (value)
+            scratch.regs[i->loc.value] = {value, i};
+        else
+            scratch.regs.erase(i->loc.value);
+        scratch.written[i->loc.value] = ++scratch.clock;
+    }
+
+    void rewrite_inputs(Instruction *inst, ScratchState &scratch) {
+        std::vector<int> busy;  // scratch registers read by this instruction
+        std::vector<std::pair<Input *, const LiveInterval *>> to_load;
+        for (Input &inp : inst->inputs) {
+            if (!std::holds_alternative<Instruction *>(inp.data)) continue;
+            Instruction *value = std::get<Instruction *>(inp.data);
+            const LiveInterval *part = part_at(value, inst->linear_num - 1);
+            if (!part) continue;
+
+            // frame state of deopt is read from where it is, slots included
+            if (part->loc.type == LocationType::REGISTER ||
+                (part->loc.type == LocationType::STACK && inst->opcode == Deopt::opcode &&
+                 &inp != &inst->inputs[0])) {
+                set_input(inst, inp, get_holder(value, part->loc));
+                continue;
+            }
+            if (!place_spills) {
+                to_load.push_back({&inp, part});
+                continue;
+            }
+            if (Instruction *fill = hoisted_fill(value, inst->linear_num)) {
+                set_input(inst, inp, fill);
+                continue;
+            }
+            auto cached = std::find_if(scratch.regs.begin(), scratch.regs.end(),
+                                       [&](auto &r) { return r.second.first == value; });
+            if (cached == scratch.regs.end()) {
+                to_load.push_back({&inp, part});
+                continue;
+            }
+            set_input(inst, inp, cached->second.second);
+            busy.push_back(cached->first);
+            num_reused++;
+        }
+
+        for (auto &[inp, part] : to_load) {
+            Instruction *value = std::get<Instruction *>(inp->data);
+            // empty scratch register first, then the one written longest ago
+            int reg = -1;
+            auto age = [&](int r) {
+                return scratch.regs.count(r) ? scratch.written[r] : -1;
+            };
+            for (int r = scratch_base; r < scratch_base + NUM_SCRATCH; r++)
+                if (std::find(busy.begin(), busy.end(), r) == busy.end() &&
+                    (reg < 0 || (place_spills && age(r) < age(reg))))
+                    reg = r;
+            assert(reg >= 0 && "rewriter: more operands to load than scratch registers");
+            busy.push_back(reg);
+            Location tmp = {LocationType::REGISTER, reg};
+
+            Instruction *load;
+            if (part->loc.type == LocationType::REMAT) {
+                load = rematerialize(value, *inst->bb, tmp, inst);
+            } else {
+                // stack value is filled before use
+                load = create_instruction(inst->bb, Fill::opcode, value->type,
+                                          {get_holder(value, part->loc)}, tmp, inst);
+            }
+            set_input(inst, *inp, load);
+            loads[load] = value;
+        }
+    }
+
+    Instruction *rematerialize(Instruction *value, BasicBlock &bb, Location loc,
+                               Instruction *before) {
+        num_remats++;
+        return create_instruction(&bb, value->opcode, value->type, value->inputs, loc, before);
+    }
+
     Instruction *create_instruction(BasicBlock *bb, opcode_t opcode, Types::Type type,
                                     std::vector<Input> inputs, Location loc,
                                     Instruction *insert_before = nullptr) {
@@ -206,21 +655,6 @@ class LinearScanRewriter {
         }
         return new_inst;
     }
-
-    // to move stack conditions to registers
-    void fix_conditional_branch_conditions(Graph *graph) {
-        for (BasicBlock &bb : graph->basic_blocks) {
-            if (bb.next1 && bb.next2 && bb.last &&
-                bb.last->loc.type == LocationType::STACK) {
-                Location tmp = {LocationType::REGISTER, scratch_base};
-                Instruction *fill = new Instruction(bb.last, nullptr, Fill::opcode,
-                                                    bb.last->type, &bb, {bb.last}, {}, 0);
-                bb.last->next = fill;
-                bb.last = fill;
-                fill->loc = tmp;
-            }
-        }
-    }
 };
 
 }  // namespace IR
@@ -2,7 +2,10 @@
 #define COMPILER_IR_LIVENESS_ANALYZER_HPP
 
 #include <algorithm>
+#include <climits>
+#include <cmath>
 #include <iostream>
+#include <memory>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -11,6 +14,7 @@
 #include "instruction.hpp"
 #include "linear_order.hpp"
 #include "loop_analyser.hpp"
+#include "pass_stats.hpp"
 
 namespace Compiler {
 namespace IR {
@@ -22,9 +26,32 @@ struct LiveRange {
     bool operator<(const LiveRange &other) const { return start < other.start; }
 };
 
+struct UsePosition {
+    int pos;  // operand is read by instruction at pos
+    int loop_depth;
+
+    bool operator<(const UsePosition &other) const { return pos < other.pos; }
+};
+
+// definition that can be repeated at a use instead of keeping value on stack. when
+// arguments come in registers of calling convention, these are overwritten after their
+// GetArg, so only constants are repeated
+inline bool is_rematerializable(const Instruction *inst, bool args_in_registers) {
+    return inst->opcode == Const::opcode ||
+           (inst->opcode == GetArg::opcode && !args_in_registers);
+}
+
 struct LiveInterval {
     Instruction *reg = nullptr;
     std::vector<LiveRange> ranges;
+    std::vector<UsePosition> use_positions;  // sorted
+
+    // filled by allocator. interval may be split, then every part has its own location,
+    // parts are kept in the first one sorted by start
+    Location loc;
+    LiveInterval *parent = nullptr;
+    std::vector<std::unique_ptr<LiveInterval>> children;
+    int spill_slot = -1;  // one for all parts
 
     void add_range(int start, int end) {
         if (start >= end) return;
@@ -53,16 +80,120 @@ struct LiveInterval {
             ranges.front().start = from;
     }
 
+    void add_use(int pos, int loop_depth = 0) {
+        UsePosition use{pos, loop_depth};
+        use_positions.insert(std::upper_bound(use_positions.begin(), use_positions.end(), use),
+                             use);
+    }
+
+    // use in loop counts 10 times more per level. divided by length, so long intervals
+    // with few uses are cheap to spill
+    double spill_weight(bool args_in_registers) const {
+        double weight = 0;
+        for (const auto &use : use_positions) weight += std::pow(10.0, use.loop_depth);
+        int length = 0;
+        for (const auto &r : ranges) length += r.end - r.start;
+        // repeating definition is almost free compared to memory access
+        if (reg && is_rematerializable(reg, args_in_registers)) weight /= 100;
+        return length ? weight / length : weight;
+    }
+
+    int start() const { return ranges.front().start; }
+    int end() const { return ranges.back().end; }
+
+    bool covers(int pos) const {
+        for (const auto &r : ranges) {
+            if (pos < r.start) return false;
+            if (pos < r.end) return true;
+        }
+        return false;
+    }
+
+    // first position where both are live, -1 if there is none
+    int next_intersection(const LiveInterval &other) const {
+        size_t i = 0, j = 0;
+        while (i < ranges.size() && j < other.ranges.size()) {
+            int from = std::max(ranges[i].start, other.ranges[j].start);
+            if (from < std::min(ranges[i].end, other.ranges[j].end)) return from;
+            if (ranges[i].end < other.ranges[j].end)
+                i++;
+            else
+                j++;
+        }
+        return -1;
+    }
+
+    // use at pos reads the value just before it, so the part that starts at pos - 1
+    // already has it
+    int next_use(int pos) const {
+        auto it = std::lower_bound(use_positions.begin(), use_positions.end(),
+                                   UsePosition{pos, 0});
+        return it == use_positions.end() ? INT_MAX : it->pos;
+    }
+
+    int prev_use(int pos) const {
+        auto it = std::upper_bound(use_positions.begin(), use_positions.end(),
+                                   UsePosition{pos, 0});
+        return it == use_positions.begin() ? -1 : (it - 1)->pos;
+    }
+
+    // moves everything from pos on into new part
+    LiveInterval *split_at(int pos) {
+        LiveInterval *root = parent ? parent : this;
+        auto child = std::make_unique<LiveInterval>();
+        child->reg = reg;
+        child->parent = root;
+
+        std::vector<LiveRange> kept;
+        for (const auto &r : ranges) {
+            if (r.end <= pos)
+                kept.push_back(r);
+            else if (r.start >= pos)
+                child->ranges.push_back(r);
+            else {
+                kept.push_back({r.start, pos});
+                child->ranges.push_back({pos, r.end});
+            }
+        }
+        ranges = std::move(kept);
+
+        auto first_moved = std::upper_bound(use_positions.begin(), use_positions.end(),
+                                            UsePosition{pos, 0});
+        child->use_positions.assign(first_moved, use_positions.end());
+        use_positions.erase(first_moved, use_positions.end());
+
+        LiveInterval *result = child.get();
+        auto where = std::upper_bound(
+            root->children.begin(), root->children.end(), result,
+            [](LiveInterval *a, const auto &b) { return a->start() < b->start(); });
+        root->children.insert(where, std::move(child));
+        return result;
+    }
+
+    // part of the value that is live at pos or last part before pos for holes
+    const LiveInterval *child_at(int pos) const {
+        const LiveInterval *result = this;
+        for (const auto &c : children) {
+            if (c->start() > pos) break;
+            result = c.get();
+        }
+        return result;
+    }
+
     void dump() const {
         std::cout << "Interval for %" << (reg ? reg->id : -1) << ": ";
         for (const auto &r : ranges) std::cout << "[" << r.start << ", " << r.end << ") ";
+        loc.dump();
         std::cout << "\n";
+        for (const auto &c : children) c->dump();
     }
 };
 
 class LivenessAnalyzer {
    public:
     std::unordered_map<Instruction *, LiveInterval> intervals;
+    std::vector<BasicBlock *> linear_order;
+    std::vector<int> loop_depth;  // for blocks of linear_order
 
     LivenessAnalyzer(Graph &g) {
         LoopAnalyzer la(&g);
@@ -70,11 +201,17 @@ class LivenessAnalyzer {
         build(linear.linear_order, la);
     }
 
+    // with calling convention call result starts after the call, where it is taken from
+    // return register once caller saved ones are clobbered. without it result is written
+    // by the call itself, so values that are evicted for it are saved before the call
     LivenessAnalyzer(const LinearOrderBuilder &linear_order_builder,
-                     const LoopAnalyzer &loop_analyzer) {
+                     const LoopAnalyzer &loop_analyzer, bool calling_convention_ = false)
+        : calling_convention(calling_convention_) {
         build(linear_order_builder.linear_order, loop_analyzer);
     }
 
+    Graph *get_graph() const { return linear_order.empty() ? nullptr : linear_order[0]->graph; }
+
     LiveInterval *get_live_interval(Instruction *inst) {
         auto it = intervals.find(inst);
         if (it != intervals.end()) return &it->second;
@@ -87,8 +224,14 @@ class LivenessAnalyzer {
     }
 
    private:
+    bool calling_convention = false;
+
     void build(const std::vector<BasicBlock *> &linear_order,
                const LoopAnalyzer &loop_analyzer) {
+        this->linear_order = linear_order;
+        PassTimer timer("liveness", get_graph());
+        for (BasicBlock *b : linear_order) loop_depth.push_back(loop_analyzer.get_loop_depth(b));
+
         std::unordered_map<BasicBlock *, std::unordered_set<Instruction *>> liveIn;
 
         std::unordered_map<BasicBlock *, int> linear_pos;
@@ -137,6 +280,7 @@ class LivenessAnalyzer {
                 curr = curr->next;
             }
 
+            int depth = loop_analyzer.get_loop_depth(b);
             for (auto op_it = insts.rbegin(); op_it != insts.rend(); ++op_it) {
                 Instruction *op = *op_it;
                 if (op->opcode == PHI_OPCODE) continue;
@@ -146,7 +290,9 @@ class LivenessAnalyzer {
                 //      live.remove(opd)
 
                 intervals[op].reg = op;
-                intervals[op].set_from(op->linear_num);
+                intervals[op].set_from(op->opcode == Call::opcode && calling_convention
+                                           ? op->linear_num + 1
+                                           : op->linear_num);
                 live.erase(op);
 
                 // for each input operand opd of op do
@@ -157,6 +303,7 @@ class LivenessAnalyzer {
                         Instruction *opd = std::get<Instruction *>(inp.data);
                         intervals[opd].reg = opd;
                         intervals[opd].add_range(b->linear_from, op->linear_num);
+                        intervals[opd].add_use(op->linear_num, depth);
                         live.insert(opd);
                     }
             }
@@ -199,6 +346,7 @@ class LivenessAnalyzer {
 
             liveIn[b] = live;
         }
+        timer.count("intervals", intervals.size());
     }
 };
 
@@ -0,0 +1,143 @@
+#ifndef COMPILER_IR_LOAD_ELIMINATION_HPP
+#define COMPILER_IR_LOAD_ELIMINATION_HPP
+
+#include <algorithm>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+#include "alias_analysis.hpp"
+#include "doms.hpp"
+#include "graph.hpp"
+#include "pass_stats.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// redundant load elimination and store to load forwarding. goes down dominator tree with
+// values known to be in memory: loaded ones, stored ones and lengths of new arrays. load
+// of place that must alias a known one is replaced with the value. stores drop what they
+// may alias, calls drop everything but lengths. at merge blocks values are dropped if
+// some path from idom to the block (loop back edges too) may write them
+class LoadEliminator {
+   public:
+    int num_removed = 0;
+    int num_forwarded = 0;  // of removed, ones that took stored value
+
+    explicit LoadEliminator(Graph *graph_) : graph(graph_) {}
+
+    void run() {
+        if (!graph || !graph->first) return;
+        PassTimer timer("load elimination", graph);
+
+        DominatorTree tree(*graph);
+        visit(tree.root, {});
+        for (Instruction *load : removed) {
+            load->bb->remove_instruction(load);
+            delete load;
+        }
+
+        timer.count("loads removed", num_removed);
+        timer.count("stores forwarded", num_forwarded);
+        if (num_removed) graph->version++;
+    }
+
+   private:
+    struct Known {
+        MemoryAccess access;
+        Instruction *value;
+        bool stored;
+    };
+
+    Graph *graph;
+    std::vector<Instruction *> removed;
+
+    void visit(DomTreeNode *node, std::vector<Known> known) {
+        BasicBlock *bb = node->block;
+        if (bb->preds.size() > 1) drop_clobbered(bb, known);
+
+        for (auto inst = bb->first_not_phi; inst; inst = inst->next) {
+            if (inst->opcode == Call::opcode) {
+                drop(known,
+                     [](const Known &k) { return k.access.kind != MemoryAccess::LENGTH; });
+                continue;
+            }
+            if (inst->opcode == NewArray::opcode &&
+                std::holds_alternative<Instruction *>(inst->inputs[0].data)) {
+                MemoryAccess length;
+                length.kind = MemoryAccess::LENGTH;
+                length.base = inst;
+                length.type = Types::INT64_T;
+                known.push_back(
+                    {length, std::get<Instruction *>(inst->inputs[0].data), true});
+                continue;
+            }
+
+            MemoryAccess access = memory_access(inst);
+            if (access.kind == MemoryAccess::NONE) continue;
+            if (access.is_write) {
+                drop(known, [&](const Known &k) {
+                    return alias(k.access, access) != AliasResult::NO_ALIAS;
+                });
+                Input value = inst->inputs[2];
+                if (std::holds_alternative<Instruction *>(value.data))
+                    known.push_back({access, std::get<Instruction *>(value.data), true});
+                continue;
+            }
+
+            Known *same = nullptr;
+            for (Known &k : known)
+                if (k.access.type == access.type &&
+                    alias(k.access, access) == AliasResult::MUST_ALIAS)
+                    same = &k;
+            if (!same) {
+                known.push_back({access, inst, false});
+                continue;
+            }
+            replace_uses(inst, same->value);
+            removed.push_back(inst);
+            num_removed++;
+            num_forwarded += same->stored;
+        }
+
+        for (DomTreeNode *child : node->childs) visit(child, known);
+    }
+
+    template <typename Pred>
+    static void drop(std::vector<Known> &known, Pred pred) {
+        known.erase(std::remove_if(known.begin(), known.end(), pred), known.end());
+    }
+
+    // stores and calls on paths from idom to bb
+    void drop_clobbered(BasicBlock *bb, std::vector<Known> &known) {
+        std::vector<Instruction *> writes;
+        bool call = false;
+        std::unordered_set<BasicBlock *> visited = {bb->idom};
+        std::vector<BasicBlock *> stack(bb->preds.begin(), bb->preds.end());
+        while (!stack.empty()) {
+            BasicBlock *block = stack.back();
+            stack.pop_back();
+            if (!visited.insert(block).second) continue;
+            for (auto inst = block->first_not_phi; inst; inst = inst->next) {
+                if (inst->opcode == Call::opcode) call = true;
+                if (memory_access(inst).is_write) writes.push_back(inst);
+            }
+            stack.insert(stack.end(), block->preds.begin(), block->preds.end());
+        }
+
+        drop(known, [&](const Known &k) {
+            if (k.access.kind == MemoryAccess::LENGTH) return false;
+            if (call) return true;
+            for (Instruction *w : writes)
+                if (alias(k.access, memory_access(w)) != AliasResult::NO_ALIAS) return true;
+            return false;
+        });
+    }
+};
+
+inline void eliminate_redundant_loads(Graph *graph) { LoadEliminator(graph).run(); }
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_LOAD_ELIMINATION_HPP
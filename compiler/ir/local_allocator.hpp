@@ -0,0 +1,330 @@
+#ifndef COMPILER_IR_LOCAL_ALLOCATOR_HPP
+#define COMPILER_IR_LOCAL_ALLOCATOR_HPP
+
+#include <algorithm>
+#include <climits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "basic_block.hpp"
+#include "doms.hpp"
+#include "graph.hpp"
+#include "instruction.hpp"
+#include "linear_scan_rewriter.hpp"
+#include "pass_stats.hpp"
+#include "register_config.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// allocator for baseline tier: no loops, no liveness, one pass over every block.
+// values used outside of their block and phis live in stack slots, inside of block
+// registers are given on first need and taken from value used furthest away, operands
+// that don't fit them are filled into scratch registers.
+// blocks go in reverse post order, so definition is allocated before its uses.
+// calls clobber caller saved registers, values read after a call live in slots too, and
+// argument registers are not given out until arguments are taken from them. arguments of
+// call are filled from slots into their registers, result is taken in return register
+// and returned value is moved there.
+// phis are copied slot to slot on edges through one scratch register, cycles of them go
+// through one more slot. result is code in the same form as after LinearScanRewriter
+class LocalAllocator {
+   public:
+    int R;
+    int scratch_base;  // registers for phi copies and extra operands are after other ones
+    int next_stack_location = 0;
+
+    LocalAllocator(Graph *graph_, int num_registers)
+        : LocalAllocator(graph_, RegisterConfig::uniform(num_registers)) {}
+
+    LocalAllocator(Graph *graph_, const RegisterConfig &config_)
+        : R(config_.num_registers),
+          scratch_base(config_.num_registers),
+          graph(graph_),
+          config(config_),
+          arg_reads(config_.num_registers, 0) {
+        PassTimer timer("baseline regalloc", graph);
+        std::vector<BasicBlock *> order = get_reverse_post_order(graph);
+        allocated.insert(order.begin(), order.end());
+        for (BasicBlock *bb : order) find_globals(*bb);
+        for (BasicBlock *bb : order) allocate_block(*bb);
+        for (BasicBlock *bb : order) resolve_phis(bb);
+        timer.count("slots", next_stack_location);
+    }
+
+   private:
+    Graph *graph;
+    RegisterConfig config;
+    std::unordered_map<Instruction *, int> slot;
+    std::unordered_map<Instruction *, Instruction *> in_slot;  // holder of value in its slot
+    std::unordered_set<BasicBlock *> allocated;  // reachable blocks and edges split by us
+    std::vector<int> arg_reads;  // GetArgs that are still to read each register
+    int cycle_slot = -1;
+
+    int new_slot(Instruction *value) { return slot[value] = next_stack_location++; }
+
+    int arg_reg(Instruction *inst) const {
+        if (inst->opcode != GetArg::opcode) return -1;
+        size_t idx = std::get<int>(inst->inputs[0].data);
+        return idx < config.arg_regs.size() ? config.arg_regs[idx] : -1;
+    }
+
+    void find_globals(BasicBlock &bb) {
+        for (auto phi = bb.first_phi; phi && phi->opcode == PHI_OPCODE; phi = phi->next) {
+            phi->loc = {LocationType::STACK, new_slot(phi)};
+            in_slot[phi] = phi;
+        }
+        std::unordered_map<Instruction *, int> index;
+        int last_call = -1, i = 0;
+        for (auto inst = bb.first_not_phi; inst; inst = inst->next, i++) {
+            bool is_call = inst->opcode == Call::opcode && config.has_calling_convention();
+            for (const Input &inp : inst->inputs) {
+                if (!std::holds_alternative<Instruction *>(inp.data)) continue;
+                auto it = index.find(std::get<Instruction *>(inp.data));
+                // call in between clobbered its register or call takes it from slot
+                if (it != index.end() && (it->second < last_call || is_call) &&
+                    !slot.count(it->first))
+                    new_slot(it->first);
+            }
+            if (is_call) last_call = i;
+            index[inst] = i;
+            if (arg_reg(inst) >= 0) arg_reads[arg_reg(inst)]++;
+
+            for (const User &u : inst->users)
+                if (u.inst->bb != &bb || u.inst->opcode == PHI_OPCODE) {
+                    if (!slot.count(inst)) new_slot(inst);
+                    break;
+                }
+        }
+    }
+
+    void allocate_block(BasicBlock &bb) {
+        std::vector<Instruction *> insts;
+        std::unordered_map<Instruction *, std::vector<int>> uses;  // indexes in block
+        for (auto inst = bb.first_not_phi; inst; inst = inst->next) {
+            for (const Input &inp : inst->inputs)
+                if (std::holds_alternative<Instruction *>(inp.data))
+                    uses[std::get<Instruction *>(inp.data)].push_back(insts.size());
+            insts.push_back(inst);
+        }
+        // use at i itself counts
+        auto next_use = [&](Instruction *value, int i) {
+            auto &list = uses[value];
+            auto it = std::lower_bound(list.begin(), list.end(), i);
+            return it == list.end() ? INT_MAX : *it;
+        };
+
+        std::vector<Instruction *> owner(R, nullptr);
+        std::unordered_map<Instruction *, Instruction *> holder;  // value -> its register
+
+        // register of class of type. registers in busy hold operands of current instruction
+        // and are not taken, -1 if every register is busy
+        auto get_reg = [&](int i, Types::Type type, const std::vector<int> &busy) {
+            for (int r = 0; r < R; r++)
+                if (!owner[r] && !arg_reads[r] && config.can_hold(r, type)) return r;
+            int victim = -1;
+            for (int r = 0; r < R; r++) {
+                if (!owner[r] || !config.can_hold(r, type) ||
+                    std::find(busy.begin(), busy.end(), r) != busy.end())
+                    continue;
+                if (victim < 0 || next_use(owner[r], i) > next_use(owner[victim], i))
+                    victim = r;
+            }
+            if (victim < 0) return -1;
+            Instruction *value = owner[victim];
+            if (next_use(value, i) != INT_MAX && !in_slot.count(value)) {
+                // value of this block is needed later, save it after its definition
+                Instruction *def = holder[value];
+                Instruction *spill = insert_after(def, Spill::opcode, def->type, {def});
+                spill->loc = {LocationType::STACK, new_slot(value)};
+                in_slot[value] = spill;
+            }
+            holder.erase(value);
+            owner[victim] = nullptr;
+            return victim;
+        };
+
+        auto load_operands = [&](int i) {
+            Instruction *inst = insts[i];
+            // operands that are in registers already are not evicted for other ones
+            std::vector<int> busy;
+            for (const Input &inp : inst->inputs)
+                if (std::holds_alternative<Instruction *>(inp.data)) {
+                    auto it = holder.find(std::get<Instruction *>(inp.data));
+                    if (it != holder.end()) busy.push_back(it->second->loc.value);
+                }
+            int scratch = scratch_base;
+            for (Input &inp : inst->inputs) {
+                if (!std::holds_alternative<Instruction *>(inp.data)) continue;
+                Instruction *value = std::get<Instruction *>(inp.data);
+                auto it = holder.find(value);
+                if (it == holder.end()) {
+                    // comes from other block, was evicted or clobbered by call
+                    int r = get_reg(i, value->type, busy);
+                    Instruction *fill =
+                        insert_before(inst, Fill::opcode, value->type, {in_slot.at(value)});
+                    if (r < 0) {
+                        // more operands than registers, the rest is read from scratch ones
+                        fill->loc = {LocationType::REGISTER, scratch++};
+                        set_input(inst, inp, fill);
+                        continue;
+                    }
+                    fill->loc = {LocationType::REGISTER, r};
+                    owner[r] = value;
+                    it = holder.emplace(value, fill).first;
+                    busy.push_back(r);
+                }
+                set_input(inst, inp, it->second);
+            }
+        };
+
+        for (int i = 0; i < (int)insts.size(); i++) {
+            Instruction *inst = insts[i];
+            bool clobbers = inst->opcode == Call::opcode && config.has_calling_convention();
+            if (clobbers)
+                pass_arguments(inst);
+            else
+                load_operands(i);
+            if (inst->opcode == Ret::opcode && config.has_calling_convention())
+                move_to_return_reg(inst);
+
+            for (int r = 0; r < R; r++)
+                if (owner[r] && (next_use(owner[r], i + 1) == INT_MAX ||
+                                 (clobbers && config.caller_saved[r]))) {
+                    holder.erase(owner[r]);
+                    owner[r] = nullptr;
+                }
+            if (arg_reg(inst) >= 0) arg_reads[arg_reg(inst)]--;
+
+            if (inst->type == Types::VOID_T) continue;
+            // return register is caller saved and was just freed
+            int r = clobbers ? config.return_reg : get_reg(i + 1, inst->type, {});
+            inst->loc = {LocationType::REGISTER, r};
+            if (slot.count(inst)) {
+                if (bb.next2 && inst == bb.last)
+                    spill_on_edges(&bb, inst);
+                else {
+                    in_slot[inst] = insert_after(inst, Spill::opcode, inst->type, {inst});
+                    in_slot[inst]->loc = {LocationType::STACK, slot[inst]};
+                }
+            }
+            if (next_use(inst, i + 1) != INT_MAX) {
+                owner[r] = inst;
+                holder[inst] = inst;
+            }
+        }
+    }
+
+    // arguments come from slots, so filling one doesn't overwrite another. those that
+    // don't fit argument registers go to outgoing slots below the frame, -1 is the first,
+    // and target of indirect call to the last scratch register, as LinearScanRewriter does
+    void pass_arguments(Instruction *call) {
+        size_t num_regs = config.arg_regs.size();
+        for (size_t i = 0; i < call->inputs.size(); i++) {
+            Input &inp = call->inputs[i];
+            if (!std::holds_alternative<Instruction *>(inp.data)) continue;
+            Instruction *value = std::get<Instruction *>(inp.data);
+            int reg = i == 0           ? scratch_base + LinearScanRewriter::NUM_SCRATCH - 1
+                      : i - 1 < num_regs ? config.arg_regs[i - 1]
+                                         : scratch_base;
+            Instruction *arg = insert_before(call, Fill::opcode, value->type, {in_slot.at(value)});
+            arg->loc = {LocationType::REGISTER, reg};
+            if (i > 0 && i - 1 >= num_regs) {
+                arg = insert_before(call, Spill::opcode, value->type, {arg});
+                arg->loc = {LocationType::STACK, -int(i - num_regs)};
+            }
+            set_input(call, inp, arg);
+        }
+    }
+
+    void move_to_return_reg(Instruction *ret) {
+        if (ret->inputs.empty() || !std::holds_alternative<Instruction *>(ret->inputs[0].data))
+            return;
+        Instruction *value = std::get<Instruction *>(ret->inputs[0].data);
+        Location to = {LocationType::REGISTER, config.return_reg};
+        if (value->loc == to) return;
+        Instruction *move = insert_before(ret, MOVE_OPCODE, value->type, {value});
+        move->loc = to;
+        set_input(ret, ret->inputs[0], move);
+    }
+
+    // copy into slot of a phi goes when no other copy still reads that slot. when only
+    // cycles are left, one phi is saved to cycle_slot and its readers take it from there
+    void resolve_phis(BasicBlock *bb) {
+        if (!bb->first_phi || bb->first_phi->opcode != PHI_OPCODE) return;
+        std::vector<BasicBlock *> preds = bb->preds;
+        for (BasicBlock *pred : preds) {
+            if (!allocated.count(pred)) continue;
+            BasicBlock *where = pred->next2 ? split_edge(graph, pred, bb) : pred;
+            struct Copy {
+                Instruction *phi;
+                size_t i;
+                Instruction *from;  // holder of source slot
+            };
+            std::vector<Copy> copies;
+            for (auto phi = bb->first_phi; phi && phi->opcode == PHI_OPCODE; phi = phi->next)
+                for (size_t i = 0; i < phi->inputs.size(); i++) {
+                    Instruction *value = std::get<PhiInput>(phi->inputs[i].data).first;
+                    if (std::get<PhiInput>(phi->inputs[i].data).second == where &&
+                        in_slot.at(value)->loc != phi->loc)
+                        copies.push_back({phi, i, in_slot.at(value)});
+                }
+
+            while (!copies.empty()) {
+                auto is_read = [&](const Location &loc, size_t except) {
+                    for (size_t k = 0; k < copies.size(); k++)
+                        if (k != except && copies[k].from->loc == loc) return true;
+                    return false;
+                };
+                size_t k = 0;
+                while (k < copies.size() && is_read(copies[k].phi->loc, k)) k++;
+                if (k == copies.size()) {
+                    Instruction *phi = copies[0].phi;
+                    if (cycle_slot < 0) cycle_slot = next_stack_location++;
+                    Instruction *saved =
+                        copy(where, phi, phi->type, {LocationType::STACK, cycle_slot});
+                    for (Copy &c : copies)
+                        if (c.from->loc == phi->loc) c.from = saved;
+                    continue;
+                }
+                auto [phi, i, from] = copies[k];
+                copies.erase(copies.begin() + k);
+                Instruction *spill = copy(where, from, phi->type, phi->loc);
+                PhiInput &pi = std::get<PhiInput>(phi->inputs[i].data);
+                auto &users = pi.first->users;
+                auto it = std::find_if(users.begin(), users.end(),
+                                       [&](const User &u) { return u.inst == phi; });
+                if (it != users.end()) users.erase(it);
+                pi.first = spill;
+                spill->users.emplace_back(phi);
+            }
+        }
+    }
+
+    // slot to slot through scratch register
+    Instruction *copy(BasicBlock *bb, Instruction *from, Types::Type type, Location to) {
+        Instruction *fill = bb->add_instruction(Fill::opcode, type, {from});
+        fill->loc = {LocationType::REGISTER, scratch_base};
+        Instruction *spill = bb->add_instruction(Spill::opcode, type, {fill});
+        spill->loc = to;
+        return spill;
+    }
+
+    // branch has to stay last, so its condition is saved on both edges into one slot.
+    // the register still has it there
+    void spill_on_edges(BasicBlock *bb, Instruction *cond) {
+        for (BasicBlock *succ : {bb->next1, bb->next2}) {
+            BasicBlock *edge = split_edge(graph, bb, succ);
+            allocated.insert(edge);
+            Instruction *spill = edge->add_instruction(Spill::opcode, cond->type, {cond});
+            spill->loc = {LocationType::STACK, slot[cond]};
+            if (!in_slot.count(cond)) in_slot[cond] = spill;
+        }
+    }
+};
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_LOCAL_ALLOCATOR_HPP
@@ -37,6 +37,22 @@ struct LoopAnalyzer {
         adjust_loop_tree();  // remove bbs from inner loops + add root loop
     }
 
+    // number of loops around l, root loop has depth 0
+    static int get_depth(const Loop *l) {
+        int depth = 0;
+        for (; l && l->parent_loop; l = l->parent_loop) depth++;
+        return depth;
+    }
+
+    // innermost loop that contains bb (blocks of inner loops are not in outer ones)
+    const Loop *get_loop(BasicBlock *bb) const {
+        for (const auto &loop : loops)
+            if (loop.blocks.count(bb)) return &loop;
+        return nullptr;
+    }
+
+    int get_loop_depth(BasicBlock *bb) const { return get_depth(get_loop(bb)); }
+
     void dump() const {
         std::cout << "Loops:\n";
         for (size_t i = 0; i < loops.size(); ++i) {
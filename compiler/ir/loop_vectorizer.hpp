@@ -0,0 +1,278 @@
+#ifndef COMPILER_IR_LOOP_VECTORIZER_HPP
+#define COMPILER_IR_LOOP_VECTORIZER_HPP
+
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "basic_block.hpp"
+#include "graph.hpp"
+#include "instruction.hpp"
+#include "loop_analyser.hpp"
+#include "pass_stats.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// widens counted innermost loops to vector ops. loop is a header with phis and
+// EQ(iv, bound) that leaves it and one body block going back, iv steps by 1 or -1.
+// header phis are either iv or reductions (phi + x, phi * x, phi & x, phi - x), body
+// is arithmetic on iv, invariants and other body values.
+//
+// vector loop goes before it and does trip & -lanes iterations, lanes of reductions are
+// combined after it and original loop finishes the rest as scalar epilogue:
+//
+//   preheader -> vheader <-> vbody
+//                   |
+//                 vexit -> header <-> body
+//                            |
+//                           exit
+class LoopVectorizer {
+   public:
+    int vector_bits;
+    int num_vectorized = 0;
+
+    explicit LoopVectorizer(Graph *graph_, int vector_bits_ = 256)
+        : vector_bits(vector_bits_), graph(graph_) {}
+
+    // number of vectorized loops
+    int run() {
+        PassTimer timer("vectorize", graph);
+        if (!graph || !graph->first) return 0;
+
+        std::vector<Candidate> candidates;
+        LoopAnalyzer loops(graph);
+        for (const Loop &loop : loops.loops) {
+            Candidate c;
+            if (analyze(loop, c)) candidates.push_back(c);
+        }
+        for (Candidate &c : candidates) vectorize(c);
+
+        num_vectorized = candidates.size();
+        timer.count("loops vectorized", num_vectorized);
+        if (num_vectorized) graph->version++;
+        return num_vectorized;
+    }
+
+   private:
+    struct Reduction {
+        Instruction *phi;
+        Instruction *update;  // phi op x
+        opcode_t op;
+    };
+
+    struct Candidate {
+        BasicBlock *preheader, *header, *body;
+        Instruction *iv, *iv_next;
+        Input bound = 0;
+        int step;
+        std::vector<Reduction> reductions;
+        Types::Type vector_type;
+    };
+
+    Graph *graph;
+
+    static bool is_vector_op(opcode_t op) {
+        return op == Add::opcode || op == Sub::opcode || op == Mul::opcode ||
+               op == And::opcode || op == Shr::opcode || op == Shl::opcode;
+    }
+
+    static Instruction *as_inst(const Input &inp) {
+        if (!std::holds_alternative<Instruction *>(inp.data)) return nullptr;
+        return std::get<Instruction *>(inp.data);
+    }
+
+    bool analyze(const Loop &loop, Candidate &c) {
+        if (!loop.header || !loop.inner_loops.empty() || loop.blocks.size() != 2 ||
+            loop.latches.size() != 1)
+            return false;
+        c.header = loop.header;
+        c.body = loop.latches[0];
+        if (c.body == c.header || c.body->next1 != c.header || c.body->next2) return false;
+        if (c.header->preds.size() != 2 || c.header->next2 != c.body) return false;
+        c.preheader = c.header->preds[0] == c.body ? c.header->preds[1] : c.header->preds[0];
+        if (c.preheader->next1 != c.header || c.preheader->next2) return false;
+
+        // header is phis and EQ that leaves loop when true
+        Instruction *cond = c.header->first_not_phi;
+        if (!cond || cond != c.header->last || cond->opcode != Eq::opcode) return false;
+        auto is_header_phi = [&](const Input &inp) {
+            Instruction *inst = as_inst(inp);
+            return inst && inst->bb == c.header && inst->opcode == PHI_OPCODE;
+        };
+        int iv_pos = is_header_phi(cond->inputs[0]) ? 0 : is_header_phi(cond->inputs[1]) ? 1 : -1;
+        if (iv_pos < 0 || !is_invariant(cond->inputs[1 - iv_pos], loop)) return false;
+        c.iv = as_inst(cond->inputs[iv_pos]);
+        c.bound = cond->inputs[1 - iv_pos];
+        c.vector_type = Types::vector_of(c.iv->type, vector_bits);
+        if (c.vector_type == Types::VOID_T) return false;
+
+        // iv + 1, iv - 1, iv + -1...
+        c.iv_next = phi_input(c.iv, c.body);
+        if (!c.iv_next || c.iv_next->bb != c.body || c.iv_next->inputs.size() != 2) return false;
+        int iv_in = as_inst(c.iv_next->inputs[0]) == c.iv ? 0 : 1;
+        auto step = constant_value(c.iv_next->inputs[1 - iv_in]);
+        if (as_inst(c.iv_next->inputs[iv_in]) != c.iv || !step || (*step != 1 && *step != -1))
+            return false;
+        if (c.iv_next->opcode == Add::opcode)
+            c.step = *step;
+        else if (c.iv_next->opcode == Sub::opcode && iv_in == 0)
+            c.step = -*step;
+        else
+            return false;
+
+        for (auto phi = c.header->first_phi; phi && phi->opcode == PHI_OPCODE; phi = phi->next)
+            if (phi != c.iv) {
+                Reduction r;
+                if (!reduction(phi, c, loop, r)) return false;
+                c.reductions.push_back(r);
+            }
+
+        Types::Type element = Types::element_type(c.vector_type);
+        for (auto inst = c.body->first_not_phi; inst; inst = inst->next) {
+            if (inst->type != element) return false;
+            if (inst->opcode == Const::opcode) continue;
+            if (!is_vector_op(inst->opcode)) return false;
+            for (auto &inp : inst->inputs) {
+                Instruction *def = as_inst(inp);
+                if (def && !loop.blocks.count(def->bb) && def->type != element) return false;
+            }
+            for (auto &u : inst->users)
+                if (!loop.blocks.count(u.inst->bb)) return false;
+        }
+        return true;
+    }
+
+    bool is_invariant(const Input &inp, const Loop &loop) {
+        Instruction *inst = as_inst(inp);
+        return !inst || !loop.blocks.count(inst->bb);
+    }
+
+    // phi op x in body, where phi is used only there and x doesn't depend on phi
+    bool reduction(Instruction *phi, const Candidate &c, const Loop &loop, Reduction &r) {
+        r.phi = phi;
+        r.update = phi_input(phi, c.body);
+        if (!r.update || r.update->bb != c.body || phi->type != c.iv->type) return false;
+        for (auto &u : phi->users)
+            if (u.inst != r.update && loop.blocks.count(u.inst->bb)) return false;
+        if (r.update->users.size() != 1 || r.update->inputs.size() != 2) return false;
+        Instruction *a = as_inst(r.update->inputs[0]), *b = as_inst(r.update->inputs[1]);
+        if ((a == phi) == (b == phi)) return false;
+        r.op = r.update->opcode;
+        if (r.op == Sub::opcode) return a == phi;
+        return r.op == Add::opcode || r.op == Mul::opcode || r.op == And::opcode;
+    }
+
+    static void replace_phi_input(Instruction *phi, BasicBlock *from, Instruction *value,
+                                  BasicBlock *new_from) {
+        for (auto &inp : phi->inputs) {
+            PhiInput &pi = std::get<PhiInput>(inp.data);
+            if (pi.second != from) continue;
+            auto &users = pi.first->users;
+            users.erase(std::find_if(users.begin(), users.end(),
+                                     [phi](const User &u) { return u.inst == phi; }));
+            pi = {value, new_from};
+            value->users.push_back(phi);
+            return;
+        }
+    }
+
+    static int64_t identity(opcode_t op) {
+        return op == Mul::opcode ? 1 : op == And::opcode ? -1 : 0;
+    }
+
+    static opcode_t reduce_opcode(opcode_t op) {
+        return op == Mul::opcode ? ReduceMul::opcode
+               : op == And::opcode ? ReduceAnd::opcode
+                                   : ReduceAdd::opcode;
+    }
+
+    void vectorize(Candidate &c) {
+        Types::Type element = Types::element_type(c.vector_type);
+        Types::Type vtype = c.vector_type;
+        int lanes = Types::lanes(vtype);
+        BasicBlock *pre = c.preheader;
+        Instruction *start = phi_input(c.iv, pre);
+
+        BasicBlock *vheader = add_block(graph), *vbody = add_block(graph),
+                   *vexit = add_block(graph);
+        if (c.body->exec_count >= 0) {
+            vbody->exec_count = c.body->exec_count / lanes;
+            vheader->exec_count = vbody->exec_count + pre->exec_count;
+            vexit->exec_count = pre->exec_count;
+        }
+
+        // iterations of vector loop: trip & -lanes, so iv ends at start +- that
+        Instruction *trip =
+            c.step > 0 ? pre->add_instruction(Sub::opcode, element, {c.bound, start})
+                       : pre->add_instruction(Sub::opcode, element, {start, c.bound});
+        Instruction *main_trip = pre->add_instruction(And::opcode, element, {trip, -lanes});
+        Instruction *end = pre->add_instruction(c.step > 0 ? Add::opcode : Sub::opcode, element,
+                                                {start, main_trip});
+
+        Instruction *viv = vheader->add_instruction(PHI_OPCODE, element, {});
+        std::vector<Instruction *> accs;
+        for (Reduction &r : c.reductions) {
+            Instruction *init =
+                pre->add_instruction(Const::opcode, vtype, {(int)identity(r.op)});
+            Instruction *acc = vheader->add_instruction(PHI_OPCODE, vtype, {});
+            acc->add_input(PhiInput{init, pre});
+            accs.push_back(acc);
+        }
+        vheader->add_instruction(Eq::opcode, Types::BOOL_T, {viv, end});
+
+        // body in lanes, invariants are broadcast once in preheader
+        std::unordered_map<Instruction *, Instruction *> widened;
+        std::unordered_map<Instruction *, Instruction *> broadcasts;
+        widened[c.iv] = vbody->add_instruction(Iota::opcode, vtype, {viv, c.step});
+        for (size_t i = 0; i < c.reductions.size(); i++) widened[c.reductions[i].phi] = accs[i];
+        auto widen = [&](const Input &inp) -> Input {
+            Instruction *def = as_inst(inp);
+            if (!def) return inp;
+            if (widened.count(def)) return widened[def];
+            Instruction *&b = broadcasts[def];
+            if (!b) b = pre->add_instruction(Broadcast::opcode, vtype, {def});
+            return b;
+        };
+        for (auto inst = c.body->first_not_phi; inst; inst = inst->next) {
+            if (inst == c.iv_next && inst->users.size() == 1) continue;
+            std::vector<Input> inputs;
+            for (auto &inp : inst->inputs) inputs.push_back(widen(inp));
+            widened[inst] = vbody->add_instruction(inst->opcode, vtype, inputs);
+        }
+        Instruction *viv_next =
+            vbody->add_instruction(Add::opcode, element, {viv, c.step * lanes});
+        viv->add_input(PhiInput{start, pre});
+        viv->add_input(PhiInput{viv_next, vbody});
+        for (size_t i = 0; i < c.reductions.size(); i++)
+            accs[i]->add_input(PhiInput{widened[c.reductions[i].update], vbody});
+
+        // lanes go back to one value, the rest starts from it
+        for (size_t i = 0; i < c.reductions.size(); i++) {
+            Reduction &r = c.reductions[i];
+            Instruction *init = phi_input(r.phi, pre);
+            Instruction *lanes_value =
+                vexit->add_instruction(reduce_opcode(r.op), element, {accs[i]});
+            // lanes of phi - x already hold -x, so they are added
+            opcode_t op = r.op == Sub::opcode ? Add::opcode : r.op;
+            Instruction *value = vexit->add_instruction(op, element, {init, lanes_value});
+            replace_phi_input(r.phi, pre, value, vexit);
+        }
+        replace_phi_input(c.iv, pre, viv, vexit);
+
+        pre->next1 = vheader;
+        vheader->preds = {pre};
+        vheader->add_next1(vexit);
+        vheader->add_next2(vbody);
+        vbody->add_next1(vheader);
+        vexit->next1 = c.header;
+        *std::find(c.header->preds.begin(), c.header->preds.end(), pre) = vexit;
+    }
+};
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_LOOP_VECTORIZER_HPP
@@ -9,6 +9,7 @@
 #include "doms.hpp"
 #include "graph.hpp"
 #include "instruction.hpp"
+#include "pass_stats.hpp"
 
 namespace Compiler {
 namespace IR {
@@ -25,7 +26,10 @@ class Optimizer {
             Instruction* inst = bb->first_phi ? bb->first_phi : bb->first_not_phi;
             while (inst) {
                 Instruction* next = inst->next;  // so inst change does not affect next
-                changed |= try_fold_instruction(inst);
+                if (try_fold_instruction(inst)) {
+                    changed = true;
+                    PassTimer::count_event("folds");
+                }
                 inst = next;
             }
         }
@@ -43,7 +47,10 @@ class Optimizer {
             Instruction* inst = bb->first_phi ? bb->first_phi : bb->first_not_phi;
             while (inst) {
                 Instruction* next = inst->next;
-                changed |= try_peephole_instruction(inst);
+                if (try_peephole_instruction(inst)) {
+                    changed = true;
+                    PassTimer::count_event("peepholes");
+                }
                 inst = next;
             }
         }
@@ -51,12 +58,13 @@ class Optimizer {
     }
 
     static void optimize(Graph* graph) {
+        PassTimer timer("optimize", graph);
         bool change = true;
         while (change) {
+            timer.count("iterations");
             change = peephole_pass(graph);
-            std::cout << change << '\n';
             change |= constant_folding(graph);
-            std::cout << change << '\n';
+            if (change) graph->version++;
         }
     }
 
@@ -78,10 +86,11 @@ class Optimizer {
         if (inst->opcode == Const::opcode) return false;
 
         if (inst->opcode != Sub::opcode && inst->opcode != And::opcode &&
-            inst->opcode != Shr::opcode)
+            inst->opcode != Shr::opcode && inst->opcode != Shl::opcode &&
+            inst->opcode != Mul::opcode)
             return false;
 
-        if (inst->inputs.size() != 2) throw "ill-formed sub, shr or and: not 2 args";
+        if (inst->inputs.size() != 2) throw "ill-formed sub, mul, shift or and: not 2 args";
 
         auto val1 = get_constant_value(inst->inputs[0]);
         auto val2 = get_constant_value(inst->inputs[1]);
@@ -91,6 +100,10 @@ class Optimizer {
             int64_t v2 = *val2;
             int64_t result = 0;
 
+            // shift by negative count is undefined, it is left for run time
+            if ((inst->opcode == Shr::opcode || inst->opcode == Shl::opcode) && v2 < 0)
+                return false;
+
             switch (inst->opcode) {
                 case Sub::opcode:
                     result = v1 - v2;
@@ -99,12 +112,23 @@ class Optimizer {
                     result = v1 & v2;
                     break;
                 case Shr::opcode:
-                    result = v1 >> v2;
+                    result = v2 >= 64 ? 0 : v1 >> v2;
+                    break;
+                case Shl::opcode:
+                    result = v2 >= 64 ? 0 : int64_t(uint64_t(v1) << v2);
+                    break;
+                case Mul::opcode:
+                    result = int64_t(uint64_t(v1) * uint64_t(v2));
                     break;
                 default:
                     throw "not implemented opcode:(";
             }
 
+            // const keeps only int, products and shifts easily grow out of it
+            if ((inst->opcode == Mul::opcode || inst->opcode == Shl::opcode) &&
+                result != static_cast<int>(result))
+                return false;
+
             replace_instruction_with_const(inst, result);
             return true;
         }
@@ -129,25 +153,13 @@ class Optimizer {
     }
 
     static void replace_instruction_with_input(Instruction* inst, Input target) {
-        // can't use simple logic like in replace_with_const since you can't just change
-        // instruction to its user
-
-        // make all users use target
-        for (User& user : inst->users) {
-            Instruction* user_inst = user.inst;
-            bool replaced = false;
-            for (auto& inp : user_inst->inputs) {
-                if (std::holds_alternative<Instruction*>(inp.data) &&
-                    std::get<Instruction*>(inp.data) == inst) {
-                    inp = target;
-                    replaced = true;
-                }
-            }
-
-            // make instruction know about its users
-            if (replaced && std::holds_alternative<Instruction*>(target.data))
-                std::get<Instruction*>(target.data)->users.push_back(user_inst);
+        // immediate can't be phi input, so instruction becomes constant itself
+        if (std::holds_alternative<int>(target.data)) {
+            replace_instruction_with_const(inst, std::get<int>(target.data));
+            return;
         }
+        // make all users use target, phis too
+        replace_uses(inst, std::get<Instruction*>(target.data));
 
         // make instruction dead: remove it from its inputs' users + make it nop
         for (auto& inp : inst->inputs) {
@@ -161,7 +173,6 @@ class Optimizer {
             }
         }
 
-        inst->users.clear();
         inst->inputs.clear();
         inst->opcode = Const::opcode;
         inst->inputs.emplace_back(0);
@@ -217,7 +228,7 @@ class Optimizer {
             }
         }
 
-        if (inst->opcode == Shr::opcode) {
+        if (inst->opcode == Shr::opcode || inst->opcode == Shl::opcode) {
             auto val2 = get_constant_value(inst->inputs[1]);
 
             if (val1 && *val1 == 0) {
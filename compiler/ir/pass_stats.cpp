@@ -0,0 +1,42 @@
+#include "pass_stats.hpp"
+
+#ifdef IR_COUNT_ALLOCATIONS
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#endif
+
+namespace Compiler {
+namespace IR {
+
+#ifdef IR_COUNT_ALLOCATIONS
+
+static std::atomic<int64_t> num_allocations{0};
+
+int64_t allocation_count() { return num_allocations.load(std::memory_order_relaxed); }
+
+}  // namespace IR
+}  // namespace Compiler
+
+// every new of the process goes through here, it only bumps a counter
+void *operator new(std::size_t size) {
+    Compiler::IR::num_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+#else
+
+int64_t allocation_count() { return -1; }
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif
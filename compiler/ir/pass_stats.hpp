@@ -0,0 +1,209 @@
+#ifndef COMPILER_IR_PASS_STATS_HPP
+#define COMPILER_IR_PASS_STATS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "basic_block.hpp"
+#include "graph.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// heap allocations made by the process so far, counted by operator new from
+// pass_stats.cpp when it is built with IR_COUNT_ALLOCATIONS, -1 otherwise
+int64_t allocation_count();
+
+// one run of a pass on a method
+struct PassRecord {
+    std::string pass;
+    int method = -1;  // graph id
+    int runs = 1;     // more than one in totals
+    double ms = 0;
+    int64_t allocations = 0;
+    int insts_before = 0, insts_after = 0;
+    int blocks_before = 0, blocks_after = 0;
+    std::map<std::string, int64_t> counters;  // what pass did: folds, inlines, spills...
+
+    void add(const PassRecord &other) {
+        runs += other.runs;
+        ms += other.ms;
+        allocations += other.allocations;
+        insts_before += other.insts_before;
+        insts_after += other.insts_after;
+        blocks_before += other.blocks_before;
+        blocks_after += other.blocks_after;
+        for (auto &[name, value] : other.counters) counters[name] += value;
+    }
+};
+
+// records of all passes in process. off by default, then timers only look at the flag
+class PassStats {
+   public:
+    bool enabled = false;
+    std::vector<PassRecord> records;
+
+    static PassStats &get() {
+        static PassStats stats;
+        return stats;
+    }
+
+    void clear() { records.clear(); }
+
+    // pass over all its runs, of one method or of the whole process if method is -1
+    PassRecord total(const std::string &pass, int method = -1) const {
+        PassRecord result;
+        result.pass = pass;
+        result.method = method;
+        result.runs = 0;
+        for (const PassRecord &r : records)
+            if (r.pass == pass && (method < 0 || r.method == method)) result.add(r);
+        return result;
+    }
+
+    // {"runs": [...], "methods": {"<id>": {"<pass>": {...}}}, "total": {"<pass>": {...}}}
+    std::string to_json() const {
+        std::map<int, std::map<std::string, PassRecord>> per_method;
+        std::map<std::string, PassRecord> per_process;
+        for (const PassRecord &r : records) {
+            merge(per_method[r.method], r);
+            merge(per_process, r);
+        }
+        for (auto &[name, r] : per_process) r.method = -1;
+
+        std::ostringstream out;
+        out << "{\"runs\": [";
+        for (size_t i = 0; i < records.size(); i++) {
+            if (i) out << ", ";
+            write(out, records[i]);
+        }
+        out << "], \"methods\": {";
+        bool first = true;
+        for (auto &[method, passes] : per_method) {
+            out << (first ? "" : ", ") << "\"" << method << "\": ";
+            write(out, passes);
+            first = false;
+        }
+        out << "}, \"total\": ";
+        write(out, per_process);
+        out << "}";
+        return out.str();
+    }
+
+   private:
+    static void merge(std::map<std::string, PassRecord> &passes, const PassRecord &r) {
+        auto it = passes.find(r.pass);
+        if (it == passes.end())
+            passes.emplace(r.pass, r);
+        else
+            it->second.add(r);
+    }
+
+    static void write(std::ostringstream &out, const std::string &s) {
+        out << '"';
+        for (char c : s) {
+            if (c == '"' || c == '\\') out << '\\';
+            out << c;
+        }
+        out << '"';
+    }
+
+    static void write(std::ostringstream &out, const PassRecord &r) {
+        out << "{\"pass\": ";
+        write(out, r.pass);
+        out << ", \"method\": " << r.method << ", \"runs\": " << r.runs << ", \"ms\": " << r.ms
+            << ", \"allocations\": " << r.allocations << ", \"insts_before\": "
+            << r.insts_before << ", \"insts_after\": " << r.insts_after
+            << ", \"blocks_before\": " << r.blocks_before << ", \"blocks_after\": "
+            << r.blocks_after << ", \"counters\": {";
+        bool first = true;
+        for (auto &[name, value] : r.counters) {
+            out << (first ? "" : ", ");
+            write(out, name);
+            out << ": " << value;
+            first = false;
+        }
+        out << "}}";
+    }
+
+    static void write(std::ostringstream &out, const std::map<std::string, PassRecord> &passes) {
+        out << "{";
+        bool first = true;
+        for (auto &[name, r] : passes) {
+            out << (first ? "" : ", ");
+            write(out, name);
+            out << ": ";
+            write(out, r);
+            first = false;
+        }
+        out << "}";
+    }
+};
+
+// measures pass from construction to destruction. passes call count() for what they
+// did, code deeper in the pass can count on the innermost timer through count_event()
+class PassTimer {
+   public:
+    PassTimer(const char *pass, Graph *graph_) : graph(graph_) {
+        if (!PassStats::get().enabled || !graph) return;
+        active = true;
+        record.pass = pass;
+        record.method = graph->id;
+        size(record.insts_before, record.blocks_before);
+        parent = current;
+        current = this;
+        allocations = allocation_count();
+        start = std::chrono::steady_clock::now();
+    }
+
+    ~PassTimer() {
+        if (!active) return;
+        auto end = std::chrono::steady_clock::now();
+        record.ms = std::chrono::duration<double, std::milli>(end - start).count();
+        if (allocations >= 0) record.allocations = allocation_count() - allocations;
+        size(record.insts_after, record.blocks_after);
+        current = parent;
+        PassStats::get().records.push_back(std::move(record));
+    }
+
+    PassTimer(const PassTimer &) = delete;
+    PassTimer &operator=(const PassTimer &) = delete;
+
+    void count(const char *name, int64_t n = 1) {
+        if (active) record.counters[name] += n;
+    }
+
+    static void count_event(const char *name, int64_t n = 1) {
+        if (current) current->count(name, n);
+    }
+
+   private:
+    inline static PassTimer *current = nullptr;
+
+    Graph *graph;
+    bool active = false;
+    PassTimer *parent = nullptr;
+    PassRecord record;
+    int64_t allocations = 0;
+    std::chrono::steady_clock::time_point start;
+
+    void size(int &insts, int &blocks) const {
+        insts = blocks = 0;
+        for (BasicBlock &bb : graph->basic_blocks) {
+            if (!bb.first_phi && !bb.first_not_phi) continue;
+            blocks++;
+            for (auto inst = bb.first_phi ? bb.first_phi : bb.first_not_phi; inst;
+                 inst = inst->next)
+                insts++;
+        }
+    }
+};
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_PASS_STATS_HPP
@@ -0,0 +1,57 @@
+#ifndef COMPILER_IR_PROFILE_HPP
+#define COMPILER_IR_PROFILE_HPP
+
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace Compiler {
+namespace IR {
+
+// polymorphic inline cache of one call site. first max_targets distinct callees are
+// counted one by one, calls to any other callee only make the site megamorphic
+struct CallTargetProfile {
+    static constexpr size_t max_targets = 4;
+
+    std::vector<std::pair<int, int64_t>> targets;  // callee id, number of calls
+    int64_t megamorphic_count = 0;
+
+    void record(int target) {
+        for (auto &t : targets)
+            if (t.first == target) {
+                t.second++;
+                return;
+            }
+        if (targets.size() < max_targets)
+            targets.push_back({target, 1});
+        else
+            megamorphic_count++;
+    }
+
+    int64_t total() const {
+        int64_t sum = megamorphic_count;
+        for (auto &t : targets) sum += t.second;
+        return sum;
+    }
+
+    double get_ratio(int target) const {
+        int64_t sum = total();
+        if (!sum) return 0;
+        for (auto &t : targets)
+            if (t.first == target) return double(t.second) / sum;
+        return 0;
+    }
+
+    // callee that takes at least min_ratio of all calls, if there is one
+    std::optional<int> dominant_target(double min_ratio) const {
+        for (auto &t : targets)
+            if (get_ratio(t.first) >= min_ratio) return t.first;
+        return std::nullopt;
+    }
+};
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_PROFILE_HPP
@@ -0,0 +1,223 @@
+#ifndef COMPILER_IR_REASSOCIATION_HPP
+#define COMPILER_IR_REASSOCIATION_HPP
+
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "graph.hpp"
+#include "pass_stats.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// reassociation of add, mul and and chains. chain is a tree of one op in one block where
+// every inner node has the parent as its only user. its leaves are gathered, constants
+// among them are folded into one and the rest are combined into a balanced tree, so
+// a + 1 + b + 2 + c + d becomes ((a + b) + (c + d)) + 3 with critical path of 3 instead
+// of 5. new nodes go right before the first old node that comes after both of their
+// inputs, so leaves don't live longer than before
+class Reassociation {
+   public:
+    int num_chains = 0;  // rewritten chains
+    int num_folded = 0;  // constants that went into others
+
+    explicit Reassociation(Graph *graph_) : graph(graph_) {}
+
+    // number of rewritten chains
+    int run() {
+        if (!graph || !graph->first) return 0;
+        PassTimer timer("reassociation", graph);
+
+        for (auto &bb : graph->basic_blocks) {
+            std::vector<Instruction *> roots;
+            for (auto inst = bb.first_not_phi; inst; inst = inst->next)
+                if (is_root(inst)) roots.push_back(inst);
+            for (Instruction *root : roots)
+                if (rewrite(root)) num_chains++;
+        }
+
+        timer.count("chains rewritten", num_chains);
+        timer.count("constants folded", num_folded);
+        if (num_chains) graph->version++;
+        return num_chains;
+    }
+
+    // longest chain of dependent instructions in bb, inputs from other blocks are ready
+    static int critical_path(BasicBlock *bb) {
+        std::unordered_map<Instruction *, int> depth;
+        int longest = 0;
+        for (auto inst = bb->first_not_phi; inst; inst = inst->next) {
+            int d = 0;
+            for (auto &inp : inst->inputs)
+                if (std::holds_alternative<Instruction *>(inp.data) &&
+                    depth.count(std::get<Instruction *>(inp.data)))
+                    d = std::max(d, depth[std::get<Instruction *>(inp.data)]);
+            depth[inst] = d + 1;
+            longest = std::max(longest, d + 1);
+        }
+        return longest;
+    }
+
+   private:
+    Graph *graph;
+
+    static bool is_associative(Instruction *inst) {
+        return (inst->opcode == Add::opcode || inst->opcode == Mul::opcode ||
+                inst->opcode == And::opcode) &&
+               (inst->type == Types::INT64_T || inst->type == Types::INT32_T) &&
+               inst->inputs.size() == 2;
+    }
+
+    // value is computed only for parent and can be taken apart
+    static bool is_inner(const Input &inp, Instruction *parent) {
+        if (!std::holds_alternative<Instruction *>(inp.data)) return false;
+        Instruction *value = std::get<Instruction *>(inp.data);
+        return is_associative(value) && value->opcode == parent->opcode &&
+               value->type == parent->type && value->bb == parent->bb &&
+               value->users.size() == 1 && value->users[0].inst == parent;
+    }
+
+    static bool is_root(Instruction *inst) {
+        if (!is_associative(inst)) return false;
+        return inst->users.size() != 1 || !is_inner(inst, inst->users[0].inst);
+    }
+
+    // returns depth of the tree
+    static int collect(Instruction *node, std::vector<Instruction *> &nodes,
+                       std::vector<Input> &leaves) {
+        nodes.push_back(node);
+        int depth = 0;
+        for (auto &inp : node->inputs)
+            if (is_inner(inp, node)) {
+                Instruction *inner = std::get<Instruction *>(inp.data);
+                depth = std::max(depth, collect(inner, nodes, leaves));
+            } else {
+                leaves.push_back(inp);
+            }
+        return depth + 1;
+    }
+
+    static int64_t combine(opcode_t op, int64_t a, int64_t b) {
+        if (op == Add::opcode) return int64_t(uint64_t(a) + uint64_t(b));
+        if (op == Mul::opcode) return int64_t(uint64_t(a) * uint64_t(b));
+        return a & b;
+    }
+
+    bool rewrite(Instruction *root) {
+        std::vector<Instruction *> nodes;
+        std::vector<Input> leaves;
+        int depth = collect(root, nodes, leaves);
+        if (nodes.size() < 2) return false;
+        opcode_t op = root->opcode;
+
+        // constants go into one, identity of op is dropped, zero of mul and and wins
+        std::vector<Input> values;
+        std::optional<int64_t> folded;
+        int constants = 0;
+        for (Input &leaf : leaves)
+            if (auto c = constant_value(leaf)) {
+                folded = folded ? combine(op, *folded, *c) : *c;
+                constants++;
+            } else {
+                values.push_back(leaf);
+            }
+        if (folded && *folded != static_cast<int>(*folded)) return false;
+        int64_t identity = op == Add::opcode ? 0 : op == Mul::opcode ? 1 : -1;
+        bool absorbed = folded && *folded == 0 && op != Add::opcode;
+        if (absorbed) values.clear();
+        if (folded && (*folded != identity || values.empty()))
+            values.push_back(static_cast<int>(*folded));
+
+        int balanced = 0;
+        while ((size_t(1) << balanced) < values.size()) balanced++;
+        if (constants < 2 && values.size() == leaves.size() && balanced >= depth)
+            return false;
+
+        std::unordered_set<Instruction *> dead_consts;
+        for (Input &leaf : leaves)
+            if (std::holds_alternative<Instruction *>(leaf.data) &&
+                std::get<Instruction *>(leaf.data)->opcode == Const::opcode)
+                dead_consts.insert(std::get<Instruction *>(leaf.data));
+
+        if (values.size() == 1) {
+            if (std::holds_alternative<int>(values[0].data)) {
+                set_inputs(root, {values[0]});
+                root->opcode = Const::opcode;
+            } else {
+                replace_uses(root, std::get<Instruction *>(values[0].data));
+                nodes[0] = nullptr;
+                root->bb->remove_instruction(root);
+                delete root;
+            }
+        } else {
+            build_tree(root, nodes, values);
+        }
+
+        for (size_t i = 1; i < nodes.size(); i++) {
+            nodes[i]->bb->remove_instruction(nodes[i]);
+            delete nodes[i];
+        }
+        for (Instruction *c : dead_consts)
+            if (c->users.empty()) {
+                c->bb->remove_instruction(c);
+                delete c;
+            }
+        num_folded += std::max(constants - 1, 0);
+        return true;
+    }
+
+    // pairs values in rounds, root takes the last pair
+    void build_tree(Instruction *root, std::vector<Instruction *> &nodes,
+                    std::vector<Input> &values) {
+        std::unordered_map<Instruction *, double> position;
+        int index = 0;
+        for (auto inst = root->bb->first_not_phi; inst; inst = inst->next)
+            position[inst] = index++;
+        auto position_of = [&](const Input &inp) {
+            if (!std::holds_alternative<Instruction *>(inp.data)) return -1.0;
+            auto it = position.find(std::get<Instruction *>(inp.data));
+            return it == position.end() ? -1.0 : it->second;
+        };
+
+        std::vector<Instruction *> old = nodes;
+        std::sort(old.begin(), old.end(), [&](Instruction *a, Instruction *b) {
+            return position[a] < position[b];
+        });
+        // folded constant stays last, so it is added at the top of the tree
+        auto variables_end =
+            std::holds_alternative<int>(values.back().data) ? values.end() - 1 : values.end();
+        std::stable_sort(values.begin(), variables_end,
+                         [&](const Input &a, const Input &b) {
+                             return position_of(a) < position_of(b);
+                         });
+
+        while (values.size() > 2) {
+            std::vector<Input> next;
+            for (size_t i = 0; i + 1 < values.size(); i += 2) {
+                double ready =
+                    std::max(position_of(values[i]), position_of(values[i + 1]));
+                auto after_inputs = [&](Instruction *n) { return position[n] > ready; };
+                Instruction *before = *std::find_if(old.begin(), old.end(), after_inputs);
+                Instruction *node = insert_before(before, root->opcode, root->type,
+                                                  {values[i], values[i + 1]});
+                position[node] = position[before] - 0.5;
+                next.push_back(node);
+            }
+            if (values.size() % 2) next.push_back(values.back());
+            values = next;
+        }
+        set_inputs(root, values);
+    }
+};
+
+inline int reassociate(Graph *graph) { return Reassociation(graph).run(); }
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_REASSOCIATION_HPP
@@ -0,0 +1,46 @@
+#ifndef COMPILER_IR_REGISTER_ALLOCATION_HPP
+#define COMPILER_IR_REGISTER_ALLOCATION_HPP
+
+#include "graph.hpp"
+#include "graph_coloring_allocator.hpp"
+#include "linear_order.hpp"
+#include "linear_scan_allocator.hpp"
+#include "linear_scan_rewriter.hpp"
+#include "liveness_analyzer.hpp"
+#include "local_allocator.hpp"
+#include "loop_analyser.hpp"
+#include "register_config.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// baseline is for cold code: fast to compile, keeps everything that crosses blocks on stack.
+// graph coloring is for aot, where compile time matters less than code
+enum class RegAllocMode { BASELINE, LINEAR_SCAN, GRAPH_COLORING };
+
+// allocates registers and rewrites graph, returns frame size in stack slots. blocks are
+// laid out by profile if the graph has one
+inline int allocate_registers(Graph *graph, const RegisterConfig &config,
+                              RegAllocMode mode) {
+    if (mode == RegAllocMode::BASELINE) return LocalAllocator(graph, config).next_stack_location;
+
+    LoopAnalyzer la(graph);
+    LinearOrderBuilder lin(graph, &la, BlockLayout::PROFILE);
+    LivenessAnalyzer live(lin, la, config.has_calling_convention());
+    int frame_size;
+    if (mode == RegAllocMode::GRAPH_COLORING)
+        frame_size = GraphColoringAllocator(live, config).next_stack_location;
+    else
+        frame_size = LinearScanAllocator(live, config).next_stack_location;
+    LinearScanRewriter re(graph, config, live);
+    return frame_size;
+}
+
+inline int allocate_registers(Graph *graph, int num_registers, RegAllocMode mode) {
+    return allocate_registers(graph, RegisterConfig::uniform(num_registers), mode);
+}
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_REGISTER_ALLOCATION_HPP
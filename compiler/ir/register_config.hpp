@@ -0,0 +1,73 @@
+#ifndef COMPILER_IR_REGISTER_CONFIG_HPP
+#define COMPILER_IR_REGISTER_CONFIG_HPP
+
+#include <cassert>
+#include <vector>
+
+#include "types.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// value of vector type goes only to register that holds vectors, others only to general
+// ones. a register may hold both
+enum RegisterClass : unsigned { GENERAL = 1, VECTOR = 2 };
+
+inline RegisterClass register_class(Types::Type type) {
+    return Types::is_vector(type) ? VECTOR : GENERAL;
+}
+
+// registers of target: caller saved ones are clobbered by every call, callee saved ones
+// keep their values. call arguments go in arg_regs, result comes back in return_reg,
+// they are caller saved as moves into them happen right before call
+struct RegisterConfig {
+    int num_registers = 0;
+    std::vector<unsigned> classes;  // RegisterClass mask of each register
+    std::vector<bool> caller_saved;
+    std::vector<int> arg_regs;  // i-th argument of call and of method
+    int return_reg = -1;
+
+    bool has_calling_convention() const { return return_reg >= 0; }
+
+    bool can_hold(int reg, Types::Type type) const {
+        return classes[reg] & register_class(type);
+    }
+
+    // all registers are the same, calls don't clobber anything
+    static RegisterConfig uniform(int num_registers) {
+        RegisterConfig config;
+        config.num_registers = num_registers;
+        config.classes.assign(num_registers, GENERAL | VECTOR);
+        config.caller_saved.assign(num_registers, false);
+        return config;
+    }
+
+    // num_general registers for scalars and after them num_vector ones for vectors, like
+    // x and v registers of aarch64
+    static RegisterConfig with_vectors(int num_general, int num_vector) {
+        assert(num_general > 0 && num_vector > 0);
+        RegisterConfig config = uniform(num_general + num_vector);
+        for (int i = 0; i < config.num_registers; i++)
+            config.classes[i] = i < num_general ? GENERAL : VECTOR;
+        return config;
+    }
+
+    // first num_caller_saved registers are caller saved, arguments start from register 0
+    // and result is returned in it, like on aarch64
+    static RegisterConfig with_calls(int num_registers, int num_caller_saved, int num_args) {
+        assert(num_args <= num_caller_saved && num_caller_saved > 0 &&
+               num_caller_saved <= num_registers);
+        RegisterConfig config;
+        config.num_registers = num_registers;
+        config.classes.assign(num_registers, GENERAL | VECTOR);
+        for (int i = 0; i < num_registers; i++) config.caller_saved.push_back(i < num_caller_saved);
+        for (int i = 0; i < num_args; i++) config.arg_regs.push_back(i);
+        config.return_reg = 0;
+        return config;
+    }
+};
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_REGISTER_CONFIG_HPP
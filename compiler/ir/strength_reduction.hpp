@@ -0,0 +1,233 @@
+#ifndef COMPILER_IR_STRENGTH_REDUCTION_HPP
+#define COMPILER_IR_STRENGTH_REDUCTION_HPP
+
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "doms.hpp"
+#include "graph.hpp"
+#include "loop_analyser.hpp"
+#include "pass_stats.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// strength reduction. induction variable is a header phi that the loop steps by a
+// constant: i = phi(init, i + step). i * c with loop invariant c is then a variable of
+// its own, j = phi(init * c, j + step * c), so muls of i (or of i + step) by c in the
+// loop are replaced with j (or j + step * c). after that muls by constants become
+// shifts and adds: x * 2^k = x << k, x * (2^k + 1) = (x << k) + x and
+// x * (2^k - 1) = (x << k) - x
+class StrengthReduction {
+   public:
+    int num_recurrences = 0;  // phis added
+    int num_replaced = 0;     // muls replaced with them
+    int num_reduced = 0;      // muls by constants turned into shifts, adds or consts
+
+    explicit StrengthReduction(Graph *graph_) : graph(graph_) {}
+
+    // number of muls that are gone
+    int run() {
+        if (!graph || !graph->first) return 0;
+        PassTimer timer("strength reduction", graph);
+
+        LoopAnalyzer analyzer(graph);
+        for (Loop &loop : analyzer.loops)
+            if (loop.header) reduce_inductions(loop);
+        reduce_constant_muls();
+
+        timer.count("recurrences", num_recurrences);
+        timer.count("muls replaced", num_replaced);
+        timer.count("muls reduced", num_reduced);
+        if (num_replaced || num_reduced) graph->version++;
+        return num_replaced + num_reduced;
+    }
+
+   private:
+    struct Induction {
+        Instruction *phi;
+        Instruction *init;
+        Instruction *update;  // phi + step
+        int64_t step;
+    };
+
+    Graph *graph;
+
+    static bool is_scalar_int(Types::Type type) {
+        return type == Types::INT64_T || type == Types::INT32_T;
+    }
+
+    static bool fits_int(int64_t value) { return value == static_cast<int>(value); }
+
+    // -1 if value is not a power of two
+    static int log2_exact(int64_t value) {
+        if (value <= 0 || (value & (value - 1))) return -1;
+        int k = 0;
+        while (value >> k != 1) k++;
+        return k;
+    }
+
+    void reduce_inductions(Loop &loop) {
+        BasicBlock *header = loop.header;
+        if (loop.latches.size() != 1 || header->preds.size() != 2) return;
+        BasicBlock *latch = loop.latches[0];
+        BasicBlock *preheader =
+            header->preds[0] == latch ? header->preds[1] : header->preds[0];
+        // start values are computed at the end of preheader
+        if (preheader == latch || preheader->next2) return;
+
+        for (Induction &iv : find_inductions(header, preheader, latch)) {
+            // muls of phi or update by the same factor share one recurrence
+            std::map<std::pair<Instruction *, int64_t>, std::vector<Instruction *>> groups;
+            std::unordered_set<Instruction *> seen;
+            for (Instruction *value : {iv.phi, iv.update})
+                for (auto &user : value->users) {
+                    Instruction *mul = user.inst;
+                    if (mul->opcode != Mul::opcode || mul->type != iv.phi->type ||
+                        !seen.insert(mul).second)
+                        continue;
+                    Input factor = mul->inputs[mul->inputs[0] == Input(value) ? 1 : 0];
+                    if (auto c = constant_value(factor))
+                        groups[{nullptr, *c}].push_back(mul);
+                    else if (is_invariant(std::get<Instruction *>(factor.data), header))
+                        groups[{std::get<Instruction *>(factor.data), 0}].push_back(mul);
+                }
+
+            for (auto &[factor, muls] : groups) {
+                // nothing to win if every mul is outside the loop
+                if (std::none_of(muls.begin(), muls.end(), [&](Instruction *mul) {
+                        return loop.blocks.count(mul->bb);
+                    }))
+                    continue;
+                add_recurrence(iv, factor.first, factor.second, preheader, muls);
+            }
+        }
+    }
+
+    std::vector<Induction> find_inductions(BasicBlock *header, BasicBlock *preheader,
+                                           BasicBlock *latch) {
+        std::vector<Induction> inductions;
+        for (auto phi = header->first_phi; phi && phi->opcode == PHI_OPCODE;
+             phi = phi->next) {
+            if (!is_scalar_int(phi->type) || phi->inputs.size() != 2) continue;
+            Instruction *init = nullptr, *update = nullptr;
+            for (auto &inp : phi->inputs) {
+                PhiInput pi = std::get<PhiInput>(inp.data);
+                if (pi.second == preheader) init = pi.first;
+                if (pi.second == latch) update = pi.first;
+            }
+            if (!init || !update || !dominates(header, update->bb)) continue;
+
+            std::optional<int64_t> step;
+            if (update->opcode == Add::opcode && update->inputs[0] == Input(phi))
+                step = constant_value(update->inputs[1]);
+            else if (update->opcode == Add::opcode && update->inputs[1] == Input(phi))
+                step = constant_value(update->inputs[0]);
+            else if (update->opcode == Sub::opcode && update->inputs[0] == Input(phi))
+                if (auto c = constant_value(update->inputs[1])) step = -*c;
+            if (step) inductions.push_back({phi, init, update, *step});
+        }
+        return inductions;
+    }
+
+    static bool is_invariant(Instruction *value, BasicBlock *header) {
+        return value->bb != header && dominates(value->bb, header);
+    }
+
+    // factor is either an instruction or constant c
+    void add_recurrence(Induction &iv, Instruction *factor, int64_t c,
+                        BasicBlock *preheader, std::vector<Instruction *> &muls) {
+        Types::Type type = iv.phi->type;
+        Input by = factor ? Input(factor) : Input(static_cast<int>(c));
+        opcode_t op = Add::opcode;
+        Input increment = 0;
+        if (!factor) {
+            if (!fits_int(iv.step * c)) return;
+            increment = static_cast<int>(iv.step * c);
+        } else if (iv.step == 1 || iv.step == -1) {
+            op = iv.step == 1 ? Add::opcode : Sub::opcode;
+            increment = factor;
+        } else {
+            if (!fits_int(iv.step)) return;
+            increment =
+                preheader->add_instruction(Mul::opcode, type, {factor, int(iv.step)});
+        }
+
+        Instruction *start = preheader->add_instruction(Mul::opcode, type, {iv.init, by});
+        Instruction *phi = iv.phi->bb->prepend_phi(type);
+        Instruction *next = insert_after(iv.update, op, type, {phi, increment});
+        for (BasicBlock *pred : iv.phi->bb->preds)
+            phi->add_input(PhiInput{pred == preheader ? start : next, pred});
+        num_recurrences++;
+
+        for (Instruction *mul : muls) {
+            bool of_phi = mul->inputs[0] == Input(iv.phi) || mul->inputs[1] == Input(iv.phi);
+            replace_uses(mul, of_phi ? phi : next);
+            mul->bb->remove_instruction(mul);
+            delete mul;
+            num_replaced++;
+        }
+    }
+
+    void reduce_constant_muls() {
+        for (auto &bb : graph->basic_blocks) {
+            Instruction *inst = bb.first_not_phi;
+            while (inst) {
+                Instruction *next = inst->next;
+                if (inst->opcode == Mul::opcode && is_scalar_int(inst->type) &&
+                    reduce_constant_mul(inst))
+                    num_reduced++;
+                inst = next;
+            }
+        }
+    }
+
+    bool reduce_constant_mul(Instruction *mul) {
+        auto a = constant_value(mul->inputs[0]), b = constant_value(mul->inputs[1]);
+        if (a && b) {
+            int64_t product = int64_t(uint64_t(*a) * uint64_t(*b));
+            if (!fits_int(product)) return false;
+            set_inputs(mul, {static_cast<int>(product)});
+            mul->opcode = Const::opcode;
+            return true;
+        }
+        if (!a && !b) return false;
+        int64_t c = b ? *b : *a;
+        Instruction *x = std::get<Instruction *>(mul->inputs[b ? 0 : 1].data);
+
+        if (c == 0) {
+            set_inputs(mul, {0});
+            mul->opcode = Const::opcode;
+        } else if (c == 1) {
+            replace_uses(mul, x);
+            mul->bb->remove_instruction(mul);
+            delete mul;
+        } else if (int k = log2_exact(c); k >= 0) {
+            set_inputs(mul, {x, k});
+            mul->opcode = Shl::opcode;
+        } else if (int k = log2_exact(c - 1); k >= 0) {
+            Instruction *shifted = insert_before(mul, Shl::opcode, mul->type, {x, k});
+            set_inputs(mul, {shifted, x});
+            mul->opcode = Add::opcode;
+        } else if (int k = log2_exact(c + 1); k >= 0) {
+            Instruction *shifted = insert_before(mul, Shl::opcode, mul->type, {x, k});
+            set_inputs(mul, {shifted, x});
+            mul->opcode = Sub::opcode;
+        } else {
+            return false;
+        }
+        return true;
+    }
+};
+
+inline int reduce_strength(Graph *graph) { return StrengthReduction(graph).run(); }
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_STRENGTH_REDUCTION_HPP
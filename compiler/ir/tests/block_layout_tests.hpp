@@ -0,0 +1,111 @@
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "graph.hpp"
+#include "interpreter.hpp"
+#include "ir_text.hpp"
+#include "linear_order.hpp"
+#include "loop_analyser.hpp"
+#include "register_allocation.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// sum of i + d for i < n. d == 0 at entry and overflow of the sum in the loop are check
+// failures that return -1, reverse post order puts the first one right after the entry
+inline const char *block_layout_checks =
+    "method 1 (i64, i64) {\n"
+    "bb0:\n"
+    "  v0 = i64 ARG 0\n"
+    "  v1 = i64 ARG 1\n"
+    "  v2 = i64 CNST 0\n"
+    "  v3 = bool EQ v1, 0\n"
+    "  if bb1, bb2\n"
+    "bb1 <- bb0:\n"
+    "  v4 = i64 SUB v2, 1\n"
+    "  v5 = i64 RET v4\n"
+    "bb2 <- bb0:\n"
+    "  goto bb3\n"
+    "bb3 <- bb2, bb5:\n"
+    "  v6 = i64 PHI [v2, bb2], [v12, bb5]\n"
+    "  v7 = i64 PHI [v2, bb2], [v11, bb5]\n"
+    "  v8 = bool EQ v6, v0\n"
+    "  if bb6, bb4\n"
+    "bb4 <- bb3:\n"
+    "  v9 = i64 ADD v6, v1\n"
+    "  v10 = bool EQ v9, -1\n"
+    "  if bb7, bb5\n"
+    "bb5 <- bb4:\n"
+    "  v11 = i64 ADD v7, v9\n"
+    "  v12 = i64 ADD v6, 1\n"
+    "  goto bb3\n"
+    "bb6 <- bb3:\n"
+    "  v13 = i64 RET v7\n"
+    "bb7 <- bb4:\n"
+    "  v14 = i64 SUB v2, 1\n"
+    "  v15 = i64 RET v14\n"
+    "}\n";
+
+inline void test_block_layout_profile() {
+    auto g = IrParser::parse_graph(block_layout_checks);
+    Interpreter profiler;
+    profiler.profile = true;
+    for (int64_t d = 1; d <= 10; d++) assert(profiler.run(g.get(), {100, d}) == 4950 + 100 * d);
+    assert(g->basic_blocks[1].exec_count == 0 && g->basic_blocks[3].exec_count == 1010);
+    assert(g->basic_blocks[3].next1_count == 10 && g->basic_blocks[3].next2_count == 1000);
+
+    // edge counts survive text
+    std::string text = IrPrinter::print(*g, 1);
+    assert(text.find("if bb6, bb4 count 10, 1000") != std::string::npos);
+    assert(IrPrinter::print(*IrParser::parse_graph(text), 1) == text);
+
+    LoopAnalyzer la(g.get());
+    int64_t jumps[2];
+    for (BlockLayout layout : {BlockLayout::REVERSE_POST_ORDER, BlockLayout::PROFILE}) {
+        LinearOrderBuilder lin(g.get(), &la, layout);
+        auto &order = lin.linear_order;
+        assert(order.size() == g->basic_blocks.size() && order[0] == g->first);
+        jumps[layout == BlockLayout::PROFILE] = LinearOrderBuilder::taken_jumps(order);
+        if (layout == BlockLayout::REVERSE_POST_ORDER) {
+            assert(order[1]->id == 1);
+        } else {
+            // both check failures go to the end, entry falls through to the loop
+            assert(order[1]->id == 2);
+            assert(order[order.size() - 2]->exec_count == 0 && order.back()->exec_count == 0);
+        }
+    }
+    // entry doesn't jump over the first check failure anymore
+    assert(jumps[1] == jumps[0] - 10);
+
+    // allocation works on profile order
+    auto original = IrParser::parse_graph(block_layout_checks);
+    allocate_registers(g.get(), 2, RegAllocMode::LINEAR_SCAN);
+    for (int64_t d : {0, 1, -1, 7}) {
+        Interpreter interpreter;
+        interpreter.use_locations = true;
+        assert(interpreter.run(g.get(), {20, d}) == Interpreter().run(original.get(), {20, d}));
+    }
+    std::cout << "profile block layout: " << jumps[0] << " -> " << jumps[1]
+              << " taken jumps\n";
+}
+
+// without counts profile layout is reverse post order
+inline void test_block_layout_no_profile() {
+    auto g = IrParser::parse_graph(block_layout_checks);
+    LoopAnalyzer la(g.get());
+    LinearOrderBuilder rpo(g.get(), &la);
+    LinearOrderBuilder profile(g.get(), &la, BlockLayout::PROFILE);
+    assert(rpo.linear_order == profile.linear_order);
+    std::cout << "block layout without profile test passed\n";
+}
+
+inline void run_block_layout_tests() {
+    test_block_layout_profile();
+    test_block_layout_no_profile();
+    std::cout << "all block layout tests passed successfully!\n";
+}
+
+}  // namespace IR
+}  // namespace Compiler
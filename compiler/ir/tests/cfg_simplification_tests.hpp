@@ -0,0 +1,145 @@
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "cfg_simplification.hpp"
+#include "graph.hpp"
+#include "inliner.hpp"
+#include "interpreter.hpp"
+#include "ir_text.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// caller branches on result of is_zero, after inlining the branch is on eq of a phi of
+// the constants that the returns of callee give, or on the phi itself
+inline const char *cfg_inlined_methods =
+    "method 20 (i64) {\n"
+    "bb0:\n"
+    "  v0 = i64 ARG 0\n"
+    "  v1 = bool EQ v0, 0\n"
+    "  if bb1, bb2\n"
+    "bb1 <- bb0:\n"
+    "  v2 = bool RET 1\n"
+    "bb2 <- bb0:\n"
+    "  v3 = bool RET 0\n"
+    "}\n"
+    "method 21 (i64, i64) {\n"
+    "bb0:\n"
+    "  v0 = i64 ARG 0\n"
+    "  v1 = i64 ARG 1\n"
+    "  v2 = bool CALL 20, v0\n"
+    "  v3 = bool EQ v2, 0\n"
+    "  if bb1, bb2\n"
+    "bb1 <- bb0:\n"
+    "  v4 = i64 ADD v0, v1\n"
+    "  v5 = i64 RET v4\n"
+    "bb2 <- bb0:\n"
+    "  v6 = i64 RET v1\n"
+    "}\n"
+    "method 22 (i64, i64) {\n"
+    "bb0:\n"
+    "  v0 = i64 ARG 0\n"
+    "  v1 = i64 ARG 1\n"
+    "  v2 = bool CALL 20, v0\n"
+    "  if bb1, bb2\n"
+    "bb1 <- bb0:\n"
+    "  v3 = i64 ADD v1, 100\n"
+    "  v4 = i64 RET v3\n"
+    "bb2 <- bb0:\n"
+    "  v5 = i64 RET v1\n"
+    "}\n";
+
+inline void test_cfg_inlined() {
+    ParsedMethods parsed = IrParser::parse(cfg_inlined_methods);
+    auto resolver = [&](int id) { return parsed.resolve(id); };
+    Graph *caller = parsed.resolve(21);
+    assert(Inliner(resolver).run(caller));
+    size_t blocks_before = caller->basic_blocks.size();
+    Interpreter inlined;
+    for (int64_t x : {0, 5}) assert(inlined.run(caller, {x, 7}) == (x ? x + 7 : 7));
+
+    CfgSimplification pass(caller);
+    assert(pass.run() > 0 && pass.num_threaded == 2);
+    // branch of callee and one block for each of its returns, with the caller's code
+    assert(caller->basic_blocks.size() == 3);
+    for (size_t i = 0; i < caller->basic_blocks.size(); i++)
+        assert(caller->basic_blocks[i].id == (int)i);
+    Interpreter simplified;
+    for (int64_t x : {0, 5}) assert(simplified.run(caller, {x, 7}) == (x ? x + 7 : 7));
+    assert(inlined.branches == 4 && simplified.branches == 2);
+
+    // nothing is left to do and text of it reads back
+    assert(simplify_cfg(caller) == 0);
+    std::string text = IrPrinter::print(*caller, 21);
+    assert(IrPrinter::print(*IrParser::parse_graph(text), 21) == text);
+    std::cout << "inlined is_zero: " << blocks_before << " -> "
+              << caller->basic_blocks.size() << " blocks, " << inlined.branches / 2
+              << " -> " << simplified.branches / 2 << " branches per call\n";
+
+    // caller branches on the call itself, the phi of returns becomes the condition
+    Graph *direct = parsed.resolve(22);
+    assert(Inliner(resolver).run(direct));
+    for (int64_t x : {0, 5})
+        assert(Interpreter().run(direct, {x, 7}) == (x ? 7 : 107));
+    assert(simplify_cfg(direct) > 0);
+    Interpreter threaded;
+    for (int64_t x : {0, 5}) assert(threaded.run(direct, {x, 7}) == (x ? 7 : 107));
+    assert(threaded.branches == 2);
+}
+
+// constant branch, empty blocks on both sides of a diamond and what is left unreachable
+inline void test_cfg_folding() {
+    auto g = IrParser::parse_graph(
+        "method 2 (i64) {\n"
+        "bb0:\n"
+        "  v0 = i64 ARG 0\n"
+        "  v1 = bool CNST 1\n"
+        "  if bb1, bb2\n"
+        "bb1 <- bb0:\n"
+        "  goto bb3\n"
+        "bb2 <- bb0:\n"
+        "  v2 = i64 ADD v0, 5\n"
+        "  goto bb3\n"
+        "bb3 <- bb1, bb2:\n"
+        "  v3 = i64 PHI [v0, bb1], [v2, bb2]\n"
+        "  v4 = bool EQ v3, 0\n"
+        "  if bb4, bb5\n"
+        "bb4 <- bb3:\n"
+        "  goto bb6\n"
+        "bb5 <- bb3:\n"
+        "  v5 = i64 SUB v3, 1\n"
+        "  goto bb6\n"
+        "bb6 <- bb4, bb5:\n"
+        "  v6 = i64 PHI [v3, bb4], [v5, bb5]\n"
+        "  v7 = i64 RET v6\n"
+        "}\n");
+    CfgSimplification pass(g.get());
+    pass.run();
+    assert(pass.num_folded == 1 && pass.num_unreachable == 1 && pass.num_removed == 4);
+    assert(IrPrinter::print(*g, 2) ==
+           "method 2 (i64) {\n"
+           "bb0:\n"
+           "  v0 = i64 ARG 0\n"
+           "  v1 = bool EQ v0, 0\n"
+           "  if bb2, bb1\n"
+           "bb1 <- bb0:\n"
+           "  v2 = i64 SUB v0, 1\n"
+           "  goto bb2\n"
+           "bb2 <- bb1, bb0:\n"
+           "  v3 = i64 PHI [v2, bb1], [v0, bb0]\n"
+           "  v4 = i64 RET v3\n"
+           "}\n");
+    assert(Interpreter().run(g.get(), {0}) == 0 && Interpreter().run(g.get(), {7}) == 6);
+    std::cout << "cfg folding test passed\n";
+}
+
+inline void run_cfg_simplification_tests() {
+    test_cfg_inlined();
+    test_cfg_folding();
+    std::cout << "all cfg simplification tests passed successfully!\n";
+}
+
+}  // namespace IR
+}  // namespace Compiler
@@ -105,7 +105,7 @@ inline void test_complex_graph_dominance() {
 
     assert(count_opcodes(&bb0, NullCheck::opcode) == 1);
     assert(count_opcodes(&bb1, NullCheck::opcode) == 1);
-    assert(count_opcodes(&bb2, NullCheck::opcode) == 1);
+    assert(count_opcodes(&bb2, ZeroCheck::opcode) == 1);
 
     assert(count_opcodes(&bb3, NullCheck::opcode) == 1);
     assert(count_opcodes(&bb4, NullCheck::opcode) == 0);
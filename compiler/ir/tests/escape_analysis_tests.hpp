@@ -0,0 +1,202 @@
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "escape_analysis.hpp"
+#include "graph.hpp"
+#include "inliner.hpp"
+#include "interpreter.hpp"
+#include "ir_test_helpers.hpp"
+#include "ir_text.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// point(i, n) allocates {i, n - i}, the loop sums x * y of points for i < n
+inline const char *escape_point_methods =
+    "method 10 (i64, i64) {\n"
+    "bb0:\n"
+    "  v0 = i64 ARG 0\n"
+    "  v1 = i64 ARG 1\n"
+    "  v2 = i64 NEW 2\n"
+    "  v3 = void STF v2, 0, v0\n"
+    "  v4 = i64 SUB v1, v0\n"
+    "  v5 = void STF v2, 1, v4\n"
+    "  v6 = i64 RET v2\n"
+    "}\n"
+    "method 11 (i64) {\n"
+    "bb0:\n"
+    "  v0 = i64 ARG 0\n"
+    "  v1 = i64 CNST 0\n"
+    "  goto bb1\n"
+    "bb1 <- bb0, bb2:\n"
+    "  v2 = i64 PHI [v1, bb0], [v11, bb2]\n"
+    "  v3 = i64 PHI [v1, bb0], [v10, bb2]\n"
+    "  v4 = bool EQ v2, v0\n"
+    "  if bb3, bb2\n"
+    "bb2 <- bb1:\n"
+    "  v5 = i64 CALL 10, v2, v0\n"
+    "  v6 = void NCHK v5 !2\n"
+    "  v7 = i64 LDF v5, 0\n"
+    "  v8 = i64 LDF v5, 1\n"
+    "  v9 = i64 MUL v7, v8\n"
+    "  v10 = i64 ADD v3, v9\n"
+    "  v11 = i64 ADD v2, 1\n"
+    "  goto bb1\n"
+    "bb3 <- bb1:\n"
+    "  v12 = i64 RET v3\n"
+    "}\n";
+
+// o.f0 = 5 + sum of i < n, o.f1 = 100 if c == 0, returns o.f0 + o.f1
+inline const char *escape_merges =
+    "method 1 (i64, i64) {\n"
+    "bb0:\n"
+    "  v0 = i64 ARG 0\n"
+    "  v1 = i64 ARG 1\n"
+    "  v2 = i64 NEW 2\n"
+    "  v3 = void STF v2, 0, 5\n"
+    "  v4 = i64 CNST 0\n"
+    "  goto bb1\n"
+    "bb1 <- bb0, bb2:\n"
+    "  v5 = i64 PHI [v4, bb0], [v10, bb2]\n"
+    "  v6 = bool EQ v5, v0\n"
+    "  if bb3, bb2\n"
+    "bb2 <- bb1:\n"
+    "  v7 = i64 LDF v2, 0\n"
+    "  v8 = i64 ADD v7, v5\n"
+    "  v9 = void STF v2, 0, v8\n"
+    "  v10 = i64 ADD v5, 1\n"
+    "  goto bb1\n"
+    "bb3 <- bb1:\n"
+    "  v11 = bool EQ v1, 0\n"
+    "  if bb4, bb5\n"
+    "bb4 <- bb3:\n"
+    "  v12 = void STF v2, 1, 100\n"
+    "  goto bb6\n"
+    "bb5 <- bb3:\n"
+    "  v13 = void NCHK v2 !2\n"
+    "  goto bb6\n"
+    "bb6 <- bb4, bb5:\n"
+    "  v14 = i64 LDF v2, 0\n"
+    "  v15 = i64 LDF v2, 1\n"
+    "  v16 = i64 ADD v14, v15\n"
+    "  v17 = i64 RET v16\n"
+    "}\n";
+
+// allocations per call of the loop before and after inlining point and replacing it
+inline void test_escape_inlined_point() {
+    ParsedMethods parsed = IrParser::parse(escape_point_methods);
+    auto resolver = [&](int id) { return parsed.resolve(id); };
+    Graph *loop = parsed.resolve(11);
+    const int64_t n = 50;
+
+    Interpreter before(resolver);
+    int64_t expected = before.run(loop, {n});
+    size_t allocations_before = before.heap.size();
+    assert(allocations_before == n);
+
+    assert(Inliner(resolver).run(loop));
+    EscapeAnalysis escape(loop);
+    assert(escape.run() == 1 && escape.num_checks_removed == 1);
+    assert(count_opcode(*loop, NewObject::opcode) == 0);
+    assert(count_opcode(*loop, LoadField::opcode) == 0);
+
+    Interpreter after(resolver);
+    assert(after.run(loop, {n}) == expected && after.heap.empty());
+    std::cout << "point loop: " << allocations_before << " -> " << after.heap.size()
+              << " allocations per call\n";
+}
+
+inline void test_escape_merges() {
+    auto g = IrParser::parse_graph(escape_merges);
+    assert(EscapeAnalysis(g.get()).run() == 1);
+    for (opcode_t op : {NewObject::opcode, LoadField::opcode, StoreField::opcode,
+                        NullCheck::opcode})
+        assert(count_opcode(*g, op) == 0);
+    // f0 merges at loop header, f1 after diamond, the rest are trivial
+    int phis = 0;
+    for (auto &bb : g->basic_blocks)
+        for (auto phi = bb.first_phi; phi && phi->opcode == PHI_OPCODE; phi = phi->next)
+            phis++;
+    assert(phis == 3);
+
+    for (int64_t n : {0, 1, 10})
+        for (int64_t c : {0, 1})
+            assert(Interpreter().run(g.get(), {n, c}) ==
+                   5 + n * (n - 1) / 2 + (c ? 0 : 100));
+    std::cout << "escape merges test passed\n";
+}
+
+// returned, stored, indexed by a variable, sized by one or too big: they stay
+inline void test_escape_escaping() {
+    auto g = IrParser::parse_graph(
+        "method 1 (i64) {\n"
+        "bb0:\n"
+        "  v0 = i64 ARG 0\n"
+        "  v1 = i64 NEW 1\n"
+        "  v2 = i64 NEWA 4\n"
+        "  v3 = void STA v2, v0, 1\n"
+        "  v4 = i64 NEW 1\n"
+        "  v5 = void STF v1, 0, v4\n"
+        "  v6 = i64 NEWA v0\n"
+        "  v7 = void NCHK v4 !2\n"
+        "  v8 = i64 NEWA 100000\n"
+        "  v9 = void STA v8, 7, v0\n"
+        "  v10 = i64 LDA v8, 7\n"
+        "  v11 = i64 RET v1\n"
+        "}\n");
+    EscapeAnalysis escape(g.get());
+    assert(escape.run() == 0 && escape.num_checks_removed == 1);
+    assert(count_opcode(*g, NewObject::opcode) == 2);
+    assert(count_opcode(*g, NewArray::opcode) == 3);
+    std::cout << "escape escaping test passed\n";
+}
+
+// bool field gets bool phi and bool zero, field read as other type than stored stays
+inline void test_escape_slot_types() {
+    auto g = IrParser::parse_graph(
+        "method 1 (i64) {\n"
+        "bb0:\n"
+        "  v0 = i64 ARG 0\n"
+        "  v1 = i64 NEW 1\n"
+        "  v2 = bool EQ v0, 0\n"
+        "  if bb1, bb2\n"
+        "bb1 <- bb0:\n"
+        "  v3 = void STF v1, 0, v2\n"
+        "  goto bb2\n"
+        "bb2 <- bb0, bb1:\n"
+        "  v4 = bool LDF v1, 0\n"
+        "  v5 = i64 RET v4\n"
+        "}\n");
+    assert(EscapeAnalysis(g.get()).run() == 1);
+    Instruction *phi = g->basic_blocks[2].first_phi;
+    assert(phi && phi->opcode == PHI_OPCODE && phi->type == Types::BOOL_T);
+    for (auto &inp : phi->inputs)
+        assert(std::get<PhiInput>(inp.data).first->type == Types::BOOL_T);
+    for (int64_t x : {0, 3}) assert(Interpreter().run(g.get(), {x}) == (x == 0));
+
+    auto mixed = IrParser::parse_graph(
+        "method 1 (i64) {\n"
+        "bb0:\n"
+        "  v0 = i64 ARG 0\n"
+        "  v1 = i64 NEW 1\n"
+        "  v2 = void STF v1, 0, v0\n"
+        "  v3 = bool LDF v1, 0\n"
+        "  v4 = i64 RET v3\n"
+        "}\n");
+    assert(EscapeAnalysis(mixed.get()).run() == 0);
+    assert(count_opcode(*mixed, NewObject::opcode) == 1);
+    std::cout << "escape slot types test passed\n";
+}
+
+inline void run_escape_analysis_tests() {
+    test_escape_inlined_point();
+    test_escape_merges();
+    test_escape_escaping();
+    test_escape_slot_types();
+    std::cout << "all escape analysis tests passed successfully!\n";
+}
+
+}  // namespace IR
+}  // namespace Compiler
@@ -0,0 +1,132 @@
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+
+#include "graph.hpp"
+#include "if_conversion.hpp"
+#include "interpreter.hpp"
+#include "ir_text.hpp"
+#include "register_allocation.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// s += 3 or s -= 1 depending on a bit of x = (x * 1103515245 + 12345) & (2^31 - 1), for
+// i < n. the branch goes either way at random
+inline const char *if_conversion_random =
+    "method 1 (i64, i64) {\n"
+    "bb0:\n"
+    "  v0 = i64 ARG 0\n"
+    "  v1 = i64 ARG 1\n"
+    "  v2 = i64 CNST 0\n"
+    "  goto bb1\n"
+    "bb1 <- bb0, bb5:\n"
+    "  v3 = i64 PHI [v2, bb0], [v16, bb5]\n"
+    "  v4 = i64 PHI [v1, bb0], [v9, bb5]\n"
+    "  v5 = i64 PHI [v2, bb0], [v15, bb5]\n"
+    "  v6 = bool EQ v3, v0\n"
+    "  if bb6, bb2\n"
+    "bb2 <- bb1:\n"
+    "  v7 = i64 MUL v4, 1103515245\n"
+    "  v8 = i64 ADD v7, 12345\n"
+    "  v9 = i64 AND v8, 2147483647\n"
+    "  v10 = i64 SHR v9, 16\n"
+    "  v11 = i64 AND v10, 1\n"
+    "  v12 = bool EQ v11, 0\n"
+    "  if bb3, bb4\n"
+    "bb3 <- bb2:\n"
+    "  v13 = i64 ADD v5, 3\n"
+    "  goto bb5\n"
+    "bb4 <- bb2:\n"
+    "  v14 = i64 SUB v5, 1\n"
+    "  goto bb5\n"
+    "bb5 <- bb3, bb4:\n"
+    "  v15 = i64 PHI [v13, bb3], [v14, bb4]\n"
+    "  v16 = i64 ADD v3, 1\n"
+    "  goto bb1\n"
+    "bb6 <- bb1:\n"
+    "  v17 = i64 RET v5\n"
+    "}\n";
+
+inline void test_if_conversion_random() {
+    auto g = IrParser::parse_graph(if_conversion_random);
+    auto original = IrParser::parse_graph(if_conversion_random);
+    IfConversion pass(g.get());
+    assert(pass.run() == 1 && pass.num_selects == 1);
+    // loop is header and one block now
+    assert(g->basic_blocks[2].next1 == g->first->next1 && !g->basic_blocks[2].next2);
+
+    const int64_t n = 1000;
+    Interpreter branchy, converted;
+    for (int64_t seed : {1, 42, 12345}) {
+        int64_t expected = branchy.run(original.get(), {n, seed});
+        assert(converted.run(g.get(), {n, seed}) == expected);
+    }
+    assert(branchy.mispredicts > 3 * n / 4 && converted.mispredicts <= 6);
+    assert(converted.branches == branchy.branches - 3 * n);
+
+    allocate_registers(g.get(), 3, RegAllocMode::LINEAR_SCAN);
+    Interpreter allocated;
+    allocated.use_locations = true;
+    assert(allocated.run(g.get(), {n, 42}) == Interpreter().run(original.get(), {n, 42}));
+
+    std::cout << "random branch, 3 x " << n << " iterations: " << branchy.mispredicts
+              << " -> " << converted.mispredicts << " mispredicts, " << branchy.executed
+              << " -> " << converted.executed << " instructions\n";
+}
+
+// triangle of min goes, diamond with a load and a branch that profile shows as biased
+// stay
+inline void test_if_conversion_rejected() {
+    const char *text =
+        "method 2 (i64, i64, i64) {\n"
+        "bb0:\n"
+        "  v0 = i64 ARG 0\n"
+        "  v1 = i64 ARG 1\n"
+        "  v2 = i64 ARG 2\n"
+        "  v3 = i64 SUB v0, v1\n"
+        "  v4 = i64 SHR v3, 63\n"
+        "  v5 = bool EQ v4, 0\n"
+        "  if bb1, bb2\n"
+        "bb1 <- bb0:\n"
+        "  goto bb2\n"
+        "bb2 <- bb0, bb1:\n"
+        "  v6 = i64 PHI [v0, bb0], [v1, bb1]\n"
+        "  v7 = bool EQ v2, 0\n"
+        "  if bb3, bb4\n"
+        "bb3 <- bb2:\n"
+        "  v8 = i64 LDF v2, 0\n"
+        "  goto bb5\n"
+        "bb4 <- bb2:\n"
+        "  v9 = i64 ADD v6, 1\n"
+        "  goto bb5\n"
+        "bb5 <- bb3, bb4:\n"
+        "  v10 = i64 PHI [v8, bb3], [v9, bb4]\n"
+        "  v11 = bool EQ v10, 7\n"
+        "  if bb6, bb7 count 1, 999\n"
+        "bb6 <- bb5:\n"
+        "  v12 = i64 ADD v10, 1\n"
+        "  goto bb7\n"
+        "bb7 <- bb5, bb6:\n"
+        "  v13 = i64 PHI [v10, bb5], [v12, bb6]\n"
+        "  v14 = i64 RET v13\n"
+        "}\n";
+    auto g = IrParser::parse_graph(text);
+    IfConversion pass(g.get());
+    assert(pass.run() == 1 && pass.num_selects == 1);
+    // bb2 is merged into bb0, the rest is as it was
+    assert(g->first->next1->id == 3 && g->first->next2->id == 4);
+    assert(g->basic_blocks[5].next1->id == 6 && g->basic_blocks[5].next2->id == 7);
+    assert(Interpreter().run(g.get(), {3, 5, 1}) == 4);
+    assert(Interpreter().run(g.get(), {9, 5, 1}) == 6);
+    std::cout << "if conversion rejected test passed\n";
+}
+
+inline void run_if_conversion_tests() {
+    test_if_conversion_random();
+    test_if_conversion_rejected();
+    std::cout << "all if conversion tests passed successfully!\n";
+}
+
+}  // namespace IR
+}  // namespace Compiler
@@ -1,4 +1,6 @@
 #include <cassert>
+#include <chrono>
+#include <deque>
 #include <iostream>
 
 #include "basic_block.hpp"
@@ -7,6 +9,8 @@
 #include "types.hpp"
 
 #include "inliner.hpp"
+#include "interpreter.hpp"
+#include "ir_text.hpp"
 
 using namespace Compiler::IR;
 
@@ -134,3 +138,284 @@ inline int test_inliner() {
     std::cout << "\n[SUCCESS] inlining is good!\n";
     return 0;
 }
+
+// entry -> header -> body (call in loop) -> header, header -> exit (call after loop)
+struct PriorityTestGraph {
+    Graph callee{1, {Types::INT64_T}};
+    Graph caller{4};
+    Instruction *loop_call = nullptr;
+    Instruction *exit_call = nullptr;
+
+    PriorityTestGraph() {
+        auto &cbb = callee.basic_blocks[0];
+        auto arg = cbb.add_<Arg64>({0});
+        auto sum = cbb.add_<Add64>({arg, arg});
+        cbb.add_<Ret64>({sum});
+
+        auto &entry = caller.basic_blocks[0], &header = caller.basic_blocks[1],
+             &body = caller.basic_blocks[2], &exit = caller.basic_blocks[3];
+        auto c = entry.add_<Const64>({1});
+        entry.add_next1(&header);
+
+        header.add_<EqBool>({c, c});
+        header.add_next1(&exit);
+        header.add_next2(&body);
+
+        loop_call = body.add_<Call64>({callee.id, c});
+        body.add_next1(&header);
+
+        exit_call = exit.add_<Call64>({callee.id, c});
+        exit.add_<RetVoid>({exit_call});
+    }
+
+    bool is_inlined(Instruction *call) {
+        for (auto &bb : caller.basic_blocks)
+            for (auto i = bb.first_phi ? bb.first_phi : bb.first_not_phi; i; i = i->next)
+                if (i == call) return false;
+        return true;
+    }
+};
+
+inline void test_inliner_priority() {
+    // budget is enough only for one call, it should go to the one inside the loop
+    {
+        PriorityTestGraph t;
+        Inliner inliner([&](int id) { return id == t.callee.id ? &t.callee : nullptr; });
+        inliner.max_total_size = 10;  // caller is 5, callee is 3
+        assert(inliner.run(&t.caller));
+        assert(t.is_inlined(t.loop_call) && "hot call in loop was not inlined");
+        assert(!t.is_inlined(t.exit_call) && "cold call took the budget");
+    }
+    // profile says that loop body is never executed, so call after loop is hotter
+    {
+        PriorityTestGraph t;
+        int64_t counts[] = {100, 100, 0, 100};
+        for (int i = 0; i < 4; i++) t.caller.basic_blocks[i].exec_count = counts[i];
+
+        Inliner inliner([&](int id) { return id == t.callee.id ? &t.callee : nullptr; });
+        inliner.max_total_size = 10;
+        assert(inliner.run(&t.caller));
+        assert(t.is_inlined(t.exit_call) && "profile was ignored");
+        assert(!t.is_inlined(t.loop_call));
+    }
+    // without budget limits both calls are inlined
+    {
+        PriorityTestGraph t;
+        Inliner inliner([&](int id) { return id == t.callee.id ? &t.callee : nullptr; });
+        assert(inliner.run(&t.caller));
+        assert(t.is_inlined(t.exit_call) && t.is_inlined(t.loop_call));
+    }
+
+    std::cout << "[SUCCESS] inliner priorities are good!\n";
+}
+
+inline void test_inliner_many_call_sites() {
+    const int num_calls = 400;
+
+    // leaf(x) = x + x
+    Graph leaf(1, {Types::INT64_T});
+    auto &lbb = leaf.basic_blocks[0];
+    auto larg = lbb.add_<Arg64>({0});
+    lbb.add_<Ret64>({lbb.add_<Add64>({larg, larg})});
+
+    // mid(x) = leaf(x) - x, so leaf is inlined into mid before mid goes anywhere
+    Graph mid(1, {Types::INT64_T});
+    auto &mbb = mid.basic_blocks[0];
+    auto marg = mbb.add_<Arg64>({0});
+    auto mcall = mbb.add_<Call64>({leaf.id, marg});
+    mbb.add_<Ret64>({mbb.add_<Sub64>({mcall, marg})});
+
+    Graph caller(1, {Types::INT64_T});
+    auto &bb = caller.basic_blocks[0];
+    Instruction *acc = bb.add_<Arg64>({0});
+    for (int i = 0; i < num_calls; i++)
+        acc = bb.add_<Add64>({acc, bb.add_<Call64>({mid.id, acc})});
+    bb.add_<Ret64>({acc});
+
+    int resolved_mid = 0;
+    Inliner inliner([&](int id) -> Graph * {
+        if (id == mid.id) {
+            resolved_mid++;
+            return &mid;
+        }
+        if (id == leaf.id) return &leaf;
+        return nullptr;
+    });
+    inliner.max_total_size = 100000;
+
+    auto start = std::chrono::steady_clock::now();
+    assert(inliner.run(&caller));
+    auto end = std::chrono::steady_clock::now();
+
+    int calls_left = 0;
+    for (auto &b : caller.basic_blocks)
+        for (auto i = b.first_phi ? b.first_phi : b.first_not_phi; i; i = i->next)
+            if (i->opcode == Call::opcode) calls_left++;
+    assert(calls_left == 0 && "not every call site was inlined");
+    // mid was prepared once, its own call to leaf is never seen again in caller
+    assert(resolved_mid == num_calls && "call sites were scanned more than once");
+    // leaf was inlined into a copy of mid, mid itself still calls it
+    assert(mcall->bb == &mbb && mbb.first_not_phi->next == mcall && "mid was changed");
+
+    std::cout << "inlined " << num_calls << " call sites in "
+              << std::chrono::duration<double, std::milli>(end - start).count()
+              << " ms, " << caller.basic_blocks.size() << " blocks\n";
+    std::cout << "[SUCCESS] single pass inlining is good!\n";
+}
+
+inline void test_inliner_template_cache() {
+    const int num_callers = 200;
+
+    // helper(x) = (x + x) - x
+    Graph helper(1, {Types::INT64_T});
+    auto &hbb = helper.basic_blocks[0];
+    auto harg = hbb.add_<Arg64>({0});
+    auto hret = hbb.add_<Ret64>({hbb.add_<Sub64>({hbb.add_<Add64>({harg, harg}), harg})});
+
+    std::deque<Graph> callers;
+    for (int i = 0; i < num_callers; i++) {
+        auto &caller = callers.emplace_back(1, std::vector<Types::Type>{Types::INT64_T});
+        auto &bb = caller.basic_blocks[0];
+        bb.add_<Ret64>({bb.add_<Call64>({helper.id, bb.add_<Arg64>({0})})});
+    }
+
+    Inliner inliner([&](int id) { return id == helper.id ? &helper : nullptr; });
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto &caller : callers) assert(inliner.run(&caller));
+    auto end = std::chrono::steady_clock::now();
+
+    assert(inliner.templates_built == 1 && "helper was prepared more than once");
+    // 1 split + 1 cont + 1 cloned helper block
+    assert(callers.back().basic_blocks.size() == 3);
+
+    // changed helper has to be prepared again
+    hbb.remove_instruction(hret);
+    hbb.add_<Ret64>({harg});
+    helper.version++;
+
+    Graph caller(1, {Types::INT64_T});
+    auto &bb = caller.basic_blocks[0];
+    bb.add_<Ret64>({bb.add_<Call64>({helper.id, bb.add_<Arg64>({0})})});
+    assert(inliner.run(&caller));
+    assert(inliner.templates_built == 2 && "changed helper was taken from cache");
+
+    // returned value is the argument itself now
+    Instruction *ret = caller.basic_blocks[1].first_not_phi;
+    assert(ret && ret->opcode == Ret::opcode);
+    assert(std::get<Instruction *>(ret->inputs[0].data)->opcode == GetArg::opcode);
+
+    std::cout << "inlined helper into " << num_callers << " callers in "
+              << std::chrono::duration<double, std::milli>(end - start).count()
+              << " ms\n";
+    std::cout << "[SUCCESS] callee templates are good!\n";
+}
+
+inline void test_inliner_speculative() {
+    // two possible targets: a(x) = x + x, b(x) = x - x
+    Graph a(1, {Types::INT64_T}), b(1, {Types::INT64_T});
+    auto &abb = a.basic_blocks[0];
+    auto aarg = abb.add_<Arg64>({0});
+    abb.add_<Ret64>({abb.add_<Add64>({aarg, aarg})});
+    auto &bbb = b.basic_blocks[0];
+    auto barg = bbb.add_<Arg64>({0});
+    bbb.add_<Ret64>({bbb.add_<Sub64>({barg, barg})});
+
+    auto resolver = [&](int id) -> Graph * {
+        if (id == a.id) return &a;
+        if (id == b.id) return &b;
+        return nullptr;
+    };
+
+    // caller(target, x) = target(x) + x
+    auto build_caller = [](Graph &g) {
+        auto &bb = g.basic_blocks[0];
+        auto target = bb.add_<Arg64>({0});
+        auto x = bb.add_<Arg64>({1});
+        auto call = bb.add_<Call64>({target, x});
+        bb.add_<Ret64>({bb.add_<Add64>({call, x})});
+        return call;
+    };
+
+    {
+        Graph caller(1, {Types::INT64_T, Types::INT64_T});
+        Instruction *call = build_caller(caller);
+
+        CallTargetProfile profile;
+        for (int i = 0; i < 95; i++) profile.record(a.id);
+        for (int i = 0; i < 5; i++) profile.record(b.id);
+
+        Inliner inliner(resolver);
+        inliner.call_profile = [&](Instruction *i) { return i == call ? &profile : nullptr; };
+        assert(inliner.run(&caller));
+
+        // entry ends with guard, slow path keeps indirect call, fast one is inlined
+        BasicBlock &entry = caller.basic_blocks[0];
+        assert(entry.next1 && entry.next2 && "no guard for speculation");
+        assert(entry.last->opcode == Eq::opcode);
+        assert(call->bb == entry.next2 && "indirect call is not on slow path");
+
+        int direct_calls = 0;
+        for (auto &bb : caller.basic_blocks)
+            for (auto i = bb.first_phi ? bb.first_phi : bb.first_not_phi; i; i = i->next)
+                if (i->opcode == Call::opcode && i != call) direct_calls++;
+        assert(direct_calls == 0 && "profiled target was not inlined");
+
+        // both results are merged for add
+        assert(call->users.size() == 1 && call->users[0].inst->opcode == PHI_OPCODE);
+        Instruction *phi = call->users[0].inst;
+        assert(phi->inputs.size() == 2 && phi->users[0].inst->opcode == Add::opcode);
+    }
+    {
+        // megamorphic site is left alone
+        Graph caller(1, {Types::INT64_T, Types::INT64_T});
+        Instruction *call = build_caller(caller);
+
+        CallTargetProfile profile;
+        for (int i = 0; i < 10; i++)
+            for (int target = 0; target < 6; target++) profile.record(target);
+        assert(profile.megamorphic_count == 20);
+
+        Inliner inliner(resolver);
+        inliner.call_profile = [&](Instruction *i) { return i == call ? &profile : nullptr; };
+        assert(!inliner.run(&caller));
+        assert(caller.basic_blocks.size() == 1);
+    }
+
+    std::cout << "[SUCCESS] speculative inlining is good!\n";
+}
+
+// callee(x) = x == 0 ? x + 1 : x - 0, optimizer replaces phi input x - 0 by x in the
+// template, callee itself is left as it was
+inline void test_inliner_callee_unchanged() {
+    ParsedMethods parsed = IrParser::parse(
+        "method 30 (i64) {\n"
+        "bb0:\n"
+        "  v0 = i64 ARG 0\n"
+        "  v1 = i64 SUB v0, 0\n"
+        "  v2 = bool EQ v0, 0\n"
+        "  if bb1, bb2\n"
+        "bb1 <- bb0:\n"
+        "  v3 = i64 ADD v0, 1\n"
+        "  goto bb2\n"
+        "bb2 <- bb1, bb0:\n"
+        "  v4 = i64 PHI [v3, bb1], [v1, bb0]\n"
+        "  v5 = i64 RET v4\n"
+        "}\n"
+        "method 31 (i64) {\n"
+        "bb0:\n"
+        "  v0 = i64 ARG 0\n"
+        "  v1 = i64 CALL 30, v0\n"
+        "  v2 = i64 RET v1\n"
+        "}\n");
+    Graph *callee = parsed.resolve(30);
+    Graph *caller = parsed.resolve(31);
+    std::string before = IrPrinter::print(*callee, 30);
+
+    Inliner inliner([&](int id) { return parsed.resolve(id); });
+    assert(inliner.run(caller));
+    assert(IrPrinter::print(*callee, 30) == before && "callee was changed by inlining");
+    for (int64_t x : {0, 5}) assert(Interpreter().run(caller, {x}) == (x ? x : 1));
+
+    std::cout << "[SUCCESS] inliner leaves callee as it is!\n";
+}
@@ -0,0 +1,209 @@
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "basic_block.hpp"
+#include "deopt.hpp"
+#include "graph.hpp"
+#include "instruction.hpp"
+#include "interpreter.hpp"
+#include "optimizer.hpp"
+#include "types.hpp"
+
+using namespace Compiler::IR;
+
+// sum of i * k for i in 1..n
+struct SumLoopGraph {
+    Graph graph{4, {Types::INT64_T, Types::INT64_T}};
+    BasicBlock &entry = graph.basic_blocks[0], &header = graph.basic_blocks[1],
+               &body = graph.basic_blocks[2], &exit = graph.basic_blocks[3];
+
+    SumLoopGraph() {
+        auto n = entry.add_<Arg64>({0});
+        auto k = entry.add_<Arg64>({1});
+        auto c0 = entry.add_<Const64>({0});
+        auto c1 = entry.add_<Const64>({1});
+        entry.add_next1(&header);
+
+        auto i = header.add_<Phi64>({});
+        auto acc = header.add_<Phi64>({});
+        header.add_<EqBool>({i, c0});
+        header.add_next1(&exit);
+        header.add_next2(&body);
+
+        auto mul = body.add_<Mul64>({i, k});
+        auto add = body.add_<Add64>({acc, mul});
+        auto dec = body.add_<Sub64>({i, c1});
+        body.add_next1(&header);
+
+        i->add_input(PhiInput(n, &entry));
+        i->add_input(PhiInput(dec, &body));
+        acc->add_input(PhiInput(c0, &entry));
+        acc->add_input(PhiInput(add, &body));
+
+        exit.add_<Ret64>({acc});
+    }
+};
+
+// for j in m..1, for i in n..1: acc += j * 1000 + i
+struct NestedLoopGraph {
+    Graph graph{7, {Types::INT64_T, Types::INT64_T}};
+    BasicBlock &entry = graph.basic_blocks[0], &outer = graph.basic_blocks[1],
+               &pre = graph.basic_blocks[2], &inner = graph.basic_blocks[3],
+               &body = graph.basic_blocks[4], &latch = graph.basic_blocks[5],
+               &exit = graph.basic_blocks[6];
+
+    NestedLoopGraph() {
+        auto n = entry.add_<Arg64>({0});
+        auto m = entry.add_<Arg64>({1});
+        auto c0 = entry.add_<Const64>({0});
+        auto c1 = entry.add_<Const64>({1});
+        entry.add_next1(&outer);
+
+        auto j = outer.add_<Phi64>({});
+        auto acc_o = outer.add_<Phi64>({});
+        outer.add_<EqBool>({j, c0});
+        outer.add_next1(&exit);
+        outer.add_next2(&pre);
+
+        auto base = pre.add_<Mul64>({j, 1000});
+        pre.add_next1(&inner);
+
+        auto i = inner.add_<Phi64>({});
+        auto acc = inner.add_<Phi64>({});
+        inner.add_<EqBool>({i, c0});
+        inner.add_next1(&latch);
+        inner.add_next2(&body);
+
+        auto t = body.add_<Add64>({base, i});
+        auto add = body.add_<Add64>({acc, t});
+        auto idec = body.add_<Sub64>({i, c1});
+        body.add_next1(&inner);
+
+        auto jdec = latch.add_<Sub64>({j, c1});
+        latch.add_next1(&outer);
+
+        exit.add_<Ret64>({acc_o});
+
+        j->add_input(PhiInput(m, &entry));
+        j->add_input(PhiInput(jdec, &latch));
+        acc_o->add_input(PhiInput(c0, &entry));
+        acc_o->add_input(PhiInput(acc, &latch));
+        i->add_input(PhiInput(n, &pre));
+        i->add_input(PhiInput(idec, &body));
+        acc->add_input(PhiInput(acc_o, &pre));
+        acc->add_input(PhiInput(add, &body));
+    }
+};
+
+inline void test_interpreter_profile() {
+    SumLoopGraph sum;
+    Interpreter interpreter;
+    interpreter.profile = true;
+    assert(interpreter.run(&sum.graph, {10, 3}) == 165);
+    assert(sum.body.exec_count == 10 && sum.header.exec_count == 11);
+    assert(sum.exit.exec_count == 1);
+
+    // indirect call: target is the first argument
+    Graph caller(1, {Types::INT64_T, Types::INT64_T});
+    auto target = caller.basic_blocks[0].add_<Arg64>({0});
+    auto x = caller.basic_blocks[0].add_<Arg64>({1});
+    auto call = caller.basic_blocks[0].add_<Call64>({target, x, 2});
+    caller.basic_blocks[0].add_<Ret64>({call});
+
+    auto resolver = [&](int id) { return id == sum.graph.id ? &sum.graph : nullptr; };
+    interpreter.resolve_callee = resolver;
+    for (int n = 1; n <= 4; n++)
+        assert(interpreter.run(&caller, {sum.graph.id, n}) == n * (n + 1));
+    assert(interpreter.call_profiles[call].get_ratio(sum.graph.id) == 1);
+    assert(sum.exit.exec_count == 5);
+
+    std::cout << "[SUCCESS] tier 0 profile is good!\n";
+}
+
+inline void test_deopt() {
+    // method: x == 4 ? x * 100 : x + 5
+    Graph method(3, {Types::INT64_T});
+    BasicBlock &m_entry = method.basic_blocks[0], &m_rare = method.basic_blocks[1],
+               &m_common = method.basic_blocks[2];
+    auto m_x = m_entry.add_<Arg64>({0});
+    m_entry.add_<EqBool>({m_x, 4});
+    m_entry.add_next1(&m_rare);
+    m_entry.add_next2(&m_common);
+    m_rare.add_<Ret64>({m_rare.add_<Mul64>({m_x, 100})});
+    m_common.add_<Ret64>({m_common.add_<Add64>({m_x, 5})});
+
+    // optimized code speculates that x != 4
+    Graph optimized(1, {Types::INT64_T});
+    BasicBlock &bb = optimized.basic_blocks[0];
+    auto x = bb.add_<Arg64>({0});
+    auto cond = bb.add_<EqBool>({x, 4});
+    auto deopt = add_deopt_if(&bb, cond, &method, &m_rare, [&](Instruction *v) {
+        assert(v == m_x);
+        return x;
+    });
+    bb.add_<Ret64>({bb.add_<Add64>({x, 5})});
+
+    assert(deopt->frame_state->values.size() == 1 && deopt->inputs.size() == 2);
+
+    Interpreter interpreter;
+    assert(interpreter.run(&optimized, {7}) == 12 && interpreter.deopts == 0);
+    assert(interpreter.run(&optimized, {4}) == 400 && interpreter.deopts == 1);
+
+    std::cout << "[SUCCESS] deopt is good!\n";
+}
+
+inline void test_osr() {
+    std::vector<std::unique_ptr<OsrEntry>> compiled;
+    auto compile = [&](Graph *g, BasicBlock *header) {
+        compiled.push_back(build_osr_entry(g, header));
+        Optimizer::optimize(&compiled.back()->graph);
+        return compiled.back().get();
+    };
+
+    {
+        SumLoopGraph sum;
+        Interpreter interpreter;
+        interpreter.osr_threshold = 100;
+        interpreter.compile_osr = compile;
+        assert(interpreter.run(&sum.graph, {1000, 3}) == 3 * 1000 * 1001 / 2);
+        assert(interpreter.osr_entries == 1);
+
+        // phis, k and both constants come from outside of loop
+        assert(compiled.back()->state.size() == 5);
+        assert(interpreter.run(&sum.graph, {50, 1}) == 50 * 51 / 2);
+        assert(interpreter.osr_entries == 2 && compiled.size() == 1);
+    }
+    {
+        // inner loop is entered, values of outer loop are both passed and recomputed
+        NestedLoopGraph nested;
+        Interpreter tier0;
+        int64_t expected = tier0.run(&nested.graph, {50, 20});
+        assert(expected == 50 * 1000 * 20 * 21 / 2 + 20 * 50 * 51 / 2);
+
+        Interpreter interpreter;
+        interpreter.osr_threshold = 100;
+        interpreter.compile_osr = compile;
+        assert(interpreter.run(&nested.graph, {50, 20}) == expected);
+        assert(interpreter.osr_entries == 1);
+    }
+    {
+        // osr fires in the middle of inner loop, outer values come around its latch
+        NestedLoopGraph nested;
+        int64_t expected = Interpreter().run(&nested.graph, {50, 20});
+        Interpreter interpreter;
+        interpreter.osr_threshold = 90;
+        interpreter.compile_osr = compile;
+        assert(interpreter.run(&nested.graph, {50, 20}) == expected);
+        assert(interpreter.osr_entries == 1);
+    }
+
+    std::cout << "[SUCCESS] osr is good!\n";
+}
+
+inline void run_interpreter_tests() {
+    test_interpreter_profile();
+    test_deopt();
+    test_osr();
+}
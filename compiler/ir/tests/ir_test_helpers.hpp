@@ -0,0 +1,22 @@
+#ifndef COMPILER_IR_TESTS_IR_TEST_HELPERS_HPP
+#define COMPILER_IR_TESTS_IR_TEST_HELPERS_HPP
+
+#include "graph.hpp"
+#include "instruction.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// instructions of graph with this opcode, phis are not counted
+inline int count_opcode(Graph &g, opcode_t opcode) {
+    int n = 0;
+    for (auto &bb : g.basic_blocks)
+        for (auto inst = bb.first_not_phi; inst; inst = inst->next)
+            n += inst->opcode == opcode;
+    return n;
+}
+
+}  // namespace IR
+}  // namespace Compiler
+
+#endif  // COMPILER_IR_TESTS_IR_TEST_HELPERS_HPP
@@ -0,0 +1,134 @@
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "graph.hpp"
+#include "interpreter.hpp"
+#include "ir_text.hpp"
+#include "register_allocation.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// sum of i * k for i in n..1
+inline const char *ir_text_loop =
+    "method 7 (i64, i64) {\n"
+    "bb0:\n"
+    "  v0 = i64 ARG 0\n"
+    "  v1 = i64 ARG 1\n"
+    "  v2 = i64 CNST 0\n"
+    "  v3 = void ZCHK v1 !2\n"
+    "  goto bb1\n"
+    "bb1 <- bb0, bb2 count 11:\n"
+    "  v4 = i64 PHI [v0, bb0], [v9, bb2]\n"
+    "  v5 = i64 PHI [v2, bb0], [v8, bb2]\n"
+    "  v6 = bool EQ v4, 0\n"
+    "  if bb3, bb2\n"
+    "bb2 <- bb1:\n"
+    "  v7 = i64 MUL v4, v1\n"
+    "  v8 = i64 ADD v5, v7\n"
+    "  v9 = i64 ADD v4, -1\n"
+    "  goto bb1\n"
+    "bb3 <- bb1:\n"
+    "  v10 = i64 RET v5\n"
+    "}\n";
+
+inline void test_ir_text_round_trip() {
+    std::string text = ir_text_loop;
+    int id;
+    auto g = IrParser::parse_graph(text, &id);
+    assert(id == 7 && IrPrinter::print(*g, id) == text);
+    assert(g->basic_blocks[1].exec_count == 11 && g->basic_blocks[1].preds.size() == 2);
+    assert(g->basic_blocks[0].first_not_phi->next->next->next->flags.test(IS_CHECK_FLAG));
+    assert(Interpreter().run(g.get(), {10, 3}) == 165);
+
+    // allocated code keeps locations and runs the same after reading it back
+    allocate_registers(g.get(), 2, RegAllocMode::LINEAR_SCAN);
+    std::string allocated = IrPrinter::print(*g, id);
+    assert(allocated.find(" @r") != std::string::npos);
+    auto back = IrParser::parse_graph(allocated);
+    assert(IrPrinter::print(*back, id) == allocated);
+    Interpreter interpreter;
+    interpreter.use_locations = true;
+    assert(interpreter.run(back.get(), {10, 3}) == 165);
+
+    // allocators put remat as {REMAT, 0}, so does parser
+    auto remat =
+        IrParser::parse_graph("method 1 () {\nbb0:\n  v0 = i64 CNST 1 @remat\n}\n");
+    Location loc = remat->basic_blocks[0].first_not_phi->loc;
+    assert(loc.type == LocationType::REMAT && loc.value == 0);
+    std::cout << "ir text round trip test passed\n";
+}
+
+inline void test_ir_text_calls() {
+    std::string text = std::string(ir_text_loop) +
+                       "method 8 (i64) {\n"
+                       "bb0:\n"
+                       "  v0 = i64 ARG 0\n"
+                       "  v1 = i64 CALL 7, v0, 4\n"
+                       "  v2 = i64 RET v1\n"
+                       "}\n";
+    ParsedMethods parsed = IrParser::parse(text);
+    assert(parsed.methods.size() == 2);
+    Interpreter interpreter([&](int id) { return parsed.resolve(id); });
+    assert(interpreter.run(parsed.resolve(8), {5}) == 60);
+    std::cout << "ir text calls test passed\n";
+}
+
+inline void test_ir_text_errors() {
+    const char *bad[] = {
+        "method 1 () {\nbb0:\n  v0 = i64 ADD v1, 2\n}\n",       // unknown value
+        "method 1 () {\nbb0:\n  v0 = i64 CNST 1 junk\n}\n",      // junk after inputs
+        "method 1 () {\nbb0:\n  goto bb5\n}\n",                  // unknown block
+        "method 1 () {\n  v0 = i64 CNST 1\n}\n",                 // no block
+        "method 1 () {\nbb0:\n  v0 = i128 CNST 1\n}\n",          // unknown type
+        "method 1 () {\nbb0:\n  goto bb7\nbb7 <- bb0:\n}\n",     // id is not position
+        "method 1 () {\nbb0:\n  v-5 = i64 CNST 1\n}\n",           // negative name
+        "method 1 () {\nbb0:\n  v2000000000 = i64 CNST 1\n}\n",   // name out of range
+        "method 1 () {\nbb0:\n  v0 = i64 FOO 1\n}\n",             // unknown opcode
+    };
+    for (const char *text : bad) {
+        bool thrown = false;
+        try {
+            IrParser::parse(text);
+        } catch (const char *) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+    std::cout << "ir text errors test passed\n";
+}
+
+// corpus of many methods is read back quickly
+inline void test_ir_text_corpus() {
+    const int copies = 2000;
+    std::string corpus;
+    for (int i = 0; i < copies; i++) {
+        std::string method = ir_text_loop;
+        method.replace(7, 1, std::to_string(100 + i));
+        corpus += method;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    ParsedMethods parsed = IrParser::parse(corpus);
+    auto end = std::chrono::steady_clock::now();
+    assert((int)parsed.methods.size() == copies && parsed.resolve(100 + copies - 1));
+
+    std::string printed;
+    for (int i = 0; i < copies; i++) printed += IrPrinter::print(*parsed.methods[i], parsed.ids[i]);
+    assert(printed == corpus);
+    std::cout << "parsed " << copies << " methods (" << corpus.size() / 1024 << " KiB) in "
+              << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+}
+
+inline void run_ir_text_tests() {
+    test_ir_text_round_trip();
+    test_ir_text_calls();
+    test_ir_text_errors();
+    test_ir_text_corpus();
+    std::cout << "all ir text tests passed successfully!\n";
+}
+
+}  // namespace IR
+}  // namespace Compiler
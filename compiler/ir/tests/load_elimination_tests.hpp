@@ -0,0 +1,159 @@
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "graph.hpp"
+#include "interpreter.hpp"
+#include "ir_test_helpers.hpp"
+#include "ir_text.hpp"
+#include "load_elimination.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// a[i] = i * o.f0 for i < a.length, then s += a[i] + a[i] with o.f1 = a[i] + a[i]
+// and s read back from o.f1, returns s + o.f0
+inline const char *load_elimination_loops =
+    "method 1 (i64, i64) {\n"
+    "bb0:\n"
+    "  v0 = i64 ARG 0\n"
+    "  v1 = i64 ARG 1\n"
+    "  v2 = i64 NEW 2\n"
+    "  v3 = void STF v2, 0, v1\n"
+    "  v4 = i64 NEWA v0\n"
+    "  v5 = i64 CNST 0\n"
+    "  goto bb1\n"
+    "bb1 <- bb0, bb2:\n"
+    "  v6 = i64 PHI [v5, bb0], [v12, bb2]\n"
+    "  v7 = i64 ALEN v4\n"
+    "  v8 = bool EQ v6, v7\n"
+    "  if bb3, bb2\n"
+    "bb2 <- bb1:\n"
+    "  v9 = i64 LDF v2, 0\n"
+    "  v10 = i64 MUL v6, v9\n"
+    "  v11 = void STA v4, v6, v10\n"
+    "  v12 = i64 ADD v6, 1\n"
+    "  goto bb1\n"
+    "bb3 <- bb1:\n"
+    "  goto bb4\n"
+    "bb4 <- bb3, bb5:\n"
+    "  v13 = i64 PHI [v5, bb3], [v22, bb5]\n"
+    "  v14 = i64 PHI [v5, bb3], [v21, bb5]\n"
+    "  v15 = bool EQ v13, v0\n"
+    "  if bb6, bb5\n"
+    "bb5 <- bb4:\n"
+    "  v16 = i64 LDA v4, v13\n"
+    "  v17 = i64 LDA v4, v13\n"
+    "  v18 = i64 ADD v16, v17\n"
+    "  v19 = void STF v2, 1, v18\n"
+    "  v20 = i64 LDF v2, 1\n"
+    "  v21 = i64 ADD v14, v20\n"
+    "  v22 = i64 ADD v13, 1\n"
+    "  goto bb4\n"
+    "bb6 <- bb4:\n"
+    "  v23 = i64 LDF v2, 0\n"
+    "  v24 = i64 ADD v14, v23\n"
+    "  v25 = i64 RET v24\n"
+    "}\n";
+
+// loads that may see a store in between stay: p and q, a[i] and a[j] may be the same.
+// a[0] and a[1] are not, and i64 store doesn't change i32 array b
+inline const char *load_elimination_aliasing =
+    "method 2 (i64, i64, i64, i64, i64, i64) {\n"
+    "bb0:\n"
+    "  v0 = i64 ARG 0\n"
+    "  v1 = i64 ARG 1\n"
+    "  v2 = i64 ARG 2\n"
+    "  v3 = i64 ARG 3\n"
+    "  v4 = i64 ARG 4\n"
+    "  v5 = i64 ARG 5\n"
+    "  v6 = i64 LDF v0, 0\n"
+    "  v7 = void STF v1, 0, 7\n"
+    "  v8 = i64 LDF v0, 0\n"
+    "  v9 = i64 LDA v2, v4\n"
+    "  v10 = void STA v2, v5, v8\n"
+    "  v11 = i64 LDA v2, v4\n"
+    "  v12 = i64 LDA v2, 0\n"
+    "  v13 = void STA v2, 1, v11\n"
+    "  v14 = i64 LDA v2, 0\n"
+    "  v15 = i32 LDA v3, v4\n"
+    "  v16 = void STA v2, v5, v14\n"
+    "  v17 = i32 LDA v3, v4\n"
+    "  v18 = i64 ADD v6, v8\n"
+    "  v19 = i64 ADD v18, v9\n"
+    "  v20 = i64 ADD v19, v11\n"
+    "  v21 = i64 ADD v20, v12\n"
+    "  v22 = i64 ADD v21, v14\n"
+    "  v23 = i64 ADD v22, v15\n"
+    "  v24 = i64 ADD v23, v17\n"
+    "  v25 = i64 RET v24\n"
+    "}\n";
+
+inline void test_load_elimination_loops() {
+    auto g = IrParser::parse_graph(load_elimination_loops);
+    auto original = IrParser::parse_graph(load_elimination_loops);
+    LoadEliminator rle(g.get());
+    rle.run();
+    assert(rle.num_removed == 5 && rle.num_forwarded == 4);
+    assert(count_opcode(*g, LoadField::opcode) == 0);
+    assert(count_opcode(*g, ArrayLength::opcode) == 0);
+    assert(count_opcode(*g, LoadArray::opcode) == 1);
+
+    for (int64_t n : {0, 1, 5, 100}) {
+        Interpreter before, after;
+        assert(after.run(g.get(), {n, 3}) == 3 * n * (n - 1) + 3);
+        assert(before.run(original.get(), {n, 3}) == 3 * n * (n - 1) + 3);
+        if (n) assert(after.executed < before.executed);
+    }
+    std::cout << "load elimination loops test passed\n";
+}
+
+inline void test_load_elimination_aliasing() {
+    auto g = IrParser::parse_graph(load_elimination_aliasing);
+    auto original = IrParser::parse_graph(load_elimination_aliasing);
+    LoadEliminator rle(g.get());
+    rle.run();
+    assert(rle.num_removed == 2 && rle.num_forwarded == 0);
+
+    // p == q with i == j, then different objects and indices
+    std::vector<std::vector<int64_t>> heap = {{10, 20}, {30, 40}, {1, 2, 3, 4}, {5, 6, 7}};
+    for (std::vector<int64_t> args : {std::vector<int64_t>{1, 1, 3, 4, 2, 2},
+                                      std::vector<int64_t>{1, 2, 3, 4, 2, 3}}) {
+        Interpreter before, after;
+        before.heap = after.heap = heap;
+        assert(after.run(g.get(), args) == before.run(original.get(), args));
+    }
+    std::cout << "load elimination aliasing test passed\n";
+}
+
+// calls may write any field, lengths stay
+inline void test_load_elimination_calls() {
+    auto g = IrParser::parse_graph(
+        "method 3 (i64) {\n"
+        "bb0:\n"
+        "  v0 = i64 ARG 0\n"
+        "  v1 = i64 LDF v0, 0\n"
+        "  v2 = i64 ALEN v0\n"
+        "  v3 = i64 CALL 100, v0\n"
+        "  v4 = i64 LDF v0, 0\n"
+        "  v5 = i64 ALEN v0\n"
+        "  v6 = i64 ADD v4, v5\n"
+        "  v7 = i64 RET v6\n"
+        "}\n");
+    eliminate_redundant_loads(g.get());
+    assert(count_opcode(*g, LoadField::opcode) == 2);
+    assert(count_opcode(*g, ArrayLength::opcode) == 1);
+    std::cout << "load elimination calls test passed\n";
+}
+
+inline void run_load_elimination_tests() {
+    test_load_elimination_loops();
+    test_load_elimination_aliasing();
+    test_load_elimination_calls();
+    std::cout << "all load elimination tests passed successfully!\n";
+}
+
+}  // namespace IR
+}  // namespace Compiler
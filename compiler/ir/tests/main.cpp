@@ -1,16 +1,27 @@
 #include <unordered_map>
 
 #include "basic_block.hpp"
+#include "block_layout_tests.hpp"
+#include "cfg_simplification_tests.hpp"
 #include "check_elimintaion_tests.hpp"
 #include "doms.hpp"
+#include "escape_analysis_tests.hpp"
 #include "graph.hpp"
+#include "if_conversion_tests.hpp"
 #include "inliner_test.hpp"
 #include "instruction.hpp"
+#include "interpreter_tests.hpp"
+#include "ir_text_tests.hpp"
 #include "linear_lifetime_tests.hpp"
+#include "load_elimination_tests.hpp"
 #include "loop_analyser.hpp"
 #include "optimizer.hpp"
+#include "pass_stats_tests.hpp"
+#include "reassociation_tests.hpp"
 #include "regalloc.hpp"
+#include "strength_reduction_tests.hpp"
 #include "types.hpp"
+#include "vectorizer_tests.hpp"
 
 using namespace Compiler::IR;
 
@@ -500,12 +511,17 @@ bool test_constant_folding_negative() {
     auto sub1 = bb.add_<Sub64>({Input(arg0), Input(c10)});
     auto sub2 = bb.add_<Sub64>({Input(c10), Input(arg0)});
     auto and1 = bb.add_<And64>({Input(arg0), Input(arg0)});
+    // negative count, nothing to fold it to
+    auto shl1 = bb.add_<Shl64>({Input(c10), Input(-1)});
+    auto shr1 = bb.add_<Shr64>({Input(c10), Input(-1)});
 
     Optimizer::constant_folding(&graph);
 
     if (sub1->opcode == Const::opcode) return false;
     if (sub2->opcode == Const::opcode) return false;
     if (and1->opcode == Const::opcode) return false;
+    if (shl1->opcode == Const::opcode) return false;
+    if (shr1->opcode == Const::opcode) return false;
 
     return true;
 }
@@ -709,5 +725,21 @@ int main() {
     run_linear_lifetime_tests();
     run_regalloc_unit_tests();
     test_inliner();
+    test_inliner_priority();
+    test_inliner_many_call_sites();
+    test_inliner_template_cache();
+    test_inliner_speculative();
+    test_inliner_callee_unchanged();
+    run_interpreter_tests();
     run_check_elimination_tests();
+    run_pass_stats_tests();
+    run_ir_text_tests();
+    run_vectorizer_tests();
+    run_load_elimination_tests();
+    run_escape_analysis_tests();
+    run_strength_reduction_tests();
+    run_reassociation_tests();
+    run_block_layout_tests();
+    run_if_conversion_tests();
+    run_cfg_simplification_tests();
 }
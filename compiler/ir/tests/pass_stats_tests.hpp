@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <string>
+
+#include "check_elimintaion.hpp"
+#include "graph.hpp"
+#include "instruction.hpp"
+#include "optimizer.hpp"
+#include "pass_stats.hpp"
+#include "register_allocation.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// 5 - 3 folds, second zero check goes away
+inline void build_pass_stats_graph(Graph &g) {
+    auto &bb = g.basic_blocks[0];
+    auto arg = bb.add_<Arg64>({0});
+    auto c5 = bb.add_<Const64>({5});
+    auto c3 = bb.add_<Const64>({3});
+    auto sub = bb.add_<Sub64>({c5, c3});
+    bb.add_<ZeroCheck>({arg});
+    bb.add_<ZeroCheck>({arg});
+    bb.add_<Ret64>({bb.add_<Add64>({sub, arg})});
+}
+
+inline void test_pass_stats_disabled() {
+    PassStats &stats = PassStats::get();
+    stats.clear();
+    Graph g(1, {Types::INT64_T});
+    build_pass_stats_graph(g);
+    Optimizer::optimize(&g);
+    assert(stats.records.empty());
+    std::cout << "disabled pass stats test passed\n";
+}
+
+inline void test_pass_stats_records() {
+    PassStats &stats = PassStats::get();
+    stats.clear();
+    stats.enabled = true;
+
+    Graph g(1, {Types::INT64_T});
+    build_pass_stats_graph(g);
+    Optimizer::optimize(&g);
+    optimize_dominated_checks(&g);
+    allocate_registers(&g, 4, RegAllocMode::LINEAR_SCAN);
+    stats.enabled = false;
+
+    PassRecord opt = stats.total("optimize", g.id);
+    assert(opt.runs == 1 && opt.counters["folds"] == 1 && opt.counters["iterations"] == 2);
+    PassRecord checks = stats.total("check elimination", g.id);
+    assert(checks.counters["checks removed"] == 1);
+    assert(checks.insts_after == checks.insts_before - 1 && checks.blocks_after == 1);
+    for (const char *pass : {"liveness", "linear scan", "rewrite"})
+        assert(stats.total(pass).runs == 1);
+    if (allocation_count() >= 0) assert(stats.total("liveness").allocations > 0);
+
+    std::string json = stats.to_json();
+    assert(std::count(json.begin(), json.end(), '{') == std::count(json.begin(), json.end(), '}'));
+    assert(json.find("\"check elimination\": {") != std::string::npos);
+    assert(json.find("\"checks removed\": 1") != std::string::npos);
+    assert(json.find("\"total\": {") != std::string::npos);
+    stats.clear();
+    std::cout << "pass stats records test passed\n";
+}
+
+inline void run_pass_stats_tests() {
+    test_pass_stats_disabled();
+    test_pass_stats_records();
+    std::cout << "all pass stats tests passed successfully!\n";
+}
+
+}  // namespace IR
+}  // namespace Compiler
@@ -0,0 +1,141 @@
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "graph.hpp"
+#include "interpreter.hpp"
+#include "ir_text.hpp"
+#include "reassociation.hpp"
+#include "register_allocation.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// like the high pressure kernel of regalloc tests, constants are defined first and are
+// interleaved with arguments in one long add chain
+inline const char *reassociation_pressure =
+    "method 1 (i64, i64) {\n"
+    "bb0:\n"
+    "  v0 = i64 CNST 10\n"
+    "  v1 = i64 CNST 20\n"
+    "  v2 = i64 CNST 30\n"
+    "  v3 = i64 CNST 40\n"
+    "  v4 = i64 ARG 0\n"
+    "  v5 = i64 ARG 1\n"
+    "  v6 = i64 ADD v0, v4\n"
+    "  v7 = i64 ADD v6, v1\n"
+    "  v8 = i64 ADD v7, v5\n"
+    "  v9 = i64 ADD v8, v2\n"
+    "  v10 = i64 ADD v9, v3\n"
+    "  v11 = i64 RET v10\n"
+    "}\n";
+
+// with 2 registers every constant is rematerialized next to its add, after folding
+// nothing is
+inline void test_reassociation_pressure() {
+    int64_t executed[2];
+    for (bool reassociated : {false, true}) {
+        auto g = IrParser::parse_graph(reassociation_pressure);
+        if (reassociated) {
+            Reassociation pass(g.get());
+            assert(pass.run() == 1 && pass.num_folded == 3);
+            // a + b + 100 is left
+            int count = 0;
+            for (auto inst = g->first->first_not_phi; inst; inst = inst->next) count++;
+            assert(count == 5);
+        }
+        allocate_registers(g.get(), 2, RegAllocMode::LINEAR_SCAN);
+        Interpreter interpreter;
+        interpreter.use_locations = true;
+        assert(interpreter.run(g.get(), {5, 7}) == 112);
+        executed[reassociated] = interpreter.executed;
+    }
+    assert(executed[1] == 5 && executed[0] > 2 * executed[1]);
+    std::cout << "R=2 add chain with constants: " << executed[0] << " -> " << executed[1]
+              << " instructions executed after allocation\n";
+}
+
+inline void test_reassociation_balance() {
+    const char *text =
+        "method 2 (i64, i64, i64, i64, i64, i64, i64, i64) {\n"
+        "bb0:\n"
+        "  v0 = i64 ARG 0\n"
+        "  v1 = i64 ARG 1\n"
+        "  v2 = i64 ARG 2\n"
+        "  v3 = i64 ARG 3\n"
+        "  v4 = i64 ARG 4\n"
+        "  v5 = i64 ARG 5\n"
+        "  v6 = i64 ARG 6\n"
+        "  v7 = i64 ARG 7\n"
+        "  v8 = i64 ADD v0, v1\n"
+        "  v9 = i64 ADD v8, v2\n"
+        "  v10 = i64 ADD v9, v3\n"
+        "  v11 = i64 ADD v10, v4\n"
+        "  v12 = i64 ADD v11, v5\n"
+        "  v13 = i64 ADD v12, v6\n"
+        "  v14 = i64 ADD v13, v7\n"
+        "  v15 = i64 RET v14\n"
+        "}\n";
+    auto g = IrParser::parse_graph(text);
+    int before = Reassociation::critical_path(g->first);
+    assert(reassociate(g.get()) == 1);
+    int after = Reassociation::critical_path(g->first);
+    // arguments, three levels of adds and ret
+    assert(before == 9 && after == 5);
+    assert(Interpreter().run(g.get(), {1, 2, 3, 4, 5, 6, 7, 8}) == 36);
+
+    // already balanced tree is left alone
+    assert(reassociate(g.get()) == 0);
+    std::cout << "add chain of 8: critical path " << before << " -> " << after << "\n";
+}
+
+inline void test_reassociation_mul_and() {
+    const char *text =
+        "method 3 (i64, i64) {\n"
+        "bb0:\n"
+        "  v0 = i64 ARG 0\n"
+        "  v1 = i64 ARG 1\n"
+        "  v2 = i64 MUL v0, 2\n"
+        "  v3 = i64 MUL v2, v1\n"
+        "  v4 = i64 MUL v3, 3\n"
+        "  v5 = i64 AND v0, -1\n"
+        "  v6 = i64 AND v5, v1\n"
+        "  v7 = i64 MUL v0, v1\n"
+        "  v8 = i64 MUL v7, 0\n"
+        "  v9 = i64 ADD v0, 1\n"
+        "  v10 = i64 ADD v9, 2\n"
+        "  v11 = i64 ADD v9, v10\n"
+        "  v12 = i64 ADD v4, v6\n"
+        "  v13 = i64 ADD v12, v8\n"
+        "  v14 = i64 ADD v13, v11\n"
+        "  v15 = i64 RET v14\n"
+        "}\n";
+    auto g = IrParser::parse_graph(text);
+    auto original = IrParser::parse_graph(text);
+    // x * 2 * y * 3, x & -1 & y, x * y * 0 and the final sum where 2 meets x * y * 0.
+    // v9 has two users, so it is a leaf there
+    Reassociation pass(g.get());
+    assert(pass.run() == 4 && pass.num_folded == 2);
+    int muls = 0, ands = 0;
+    for (auto inst = g->first->first_not_phi; inst; inst = inst->next) {
+        muls += inst->opcode == Mul::opcode;
+        ands += inst->opcode == And::opcode;
+    }
+    assert(muls == 2 && ands == 1);
+    for (int64_t x : {0, 1, -7, 12345})
+        for (int64_t y : {0, 3, -1})
+            assert(Interpreter().run(g.get(), {x, y}) ==
+                   Interpreter().run(original.get(), {x, y}));
+    std::cout << "reassociation mul and test passed\n";
+}
+
+inline void run_reassociation_tests() {
+    test_reassociation_pressure();
+    test_reassociation_balance();
+    test_reassociation_mul_and();
+    std::cout << "all reassociation tests passed successfully!\n";
+}
+
+}  // namespace IR
+}  // namespace Compiler
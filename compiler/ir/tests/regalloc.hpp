@@ -1,11 +1,18 @@
+#include <chrono>
+#include <memory>
+
 #include "basic_block.hpp"
 #include "graph.hpp"
 #include "instruction.hpp"
+#include "inliner.hpp"
+#include "interpreter.hpp"
 #include "linear_order.hpp"
 #include "linear_scan_allocator.hpp"
 #include "linear_scan_rewriter.hpp"
 #include "liveness_analyzer.hpp"
 #include "loop_analyser.hpp"
+#include "register_allocation.hpp"
+#include "register_config.hpp"
 
 using namespace Compiler::IR;
 
@@ -79,7 +86,8 @@ static void build_reducible_loop_with_spill(Graph &g) {
     exit->add_<RetVoid>({phi_counter});
 }
 
-static void verify_regalloc_semantics(const Graph &g, const char *test_name) {
+static void verify_regalloc_semantics(const Graph &g, const LinearScanRewriter &re,
+                                      const char *test_name) {
     for (auto &bb : g.basic_blocks) bb.dump();
 
     std::cout << "verifying " << test_name << "\n";
@@ -114,13 +122,13 @@ static void verify_regalloc_semantics(const Graph &g, const char *test_name) {
         if (bb.next1 && bb.next2)
             assert(bb.last && bb.last->loc.type == LocationType::REGISTER);
 
-    // graphs were designed to have at least one spill
+    // graphs were designed to have at least one spill, constants are rematerialized
     int spill_count = 0;
     for (const auto &bb : g.basic_blocks)
         for (Instruction *i = bb.first_not_phi; i; i = i->next)
             if (i->opcode == Spill::opcode) ++spill_count;
 
-    assert(spill_count > 0 && "High-pressure graphs must produce spills");
+    assert(spill_count + re.num_remats > 0 && "High-pressure graphs must produce spills");
 
     std::cout << "test was correct!\n";
 }
@@ -196,53 +204,840 @@ static void build_multiple_phis_with_spill(Graph &g) {
     join->add_<RetVoid>({final_res});
 }
 
+// frame size with shared slots and without them
+static void report_frame(const LinearScanAllocator &alloc) {
+    std::cout << "frame: " << alloc.next_stack_location << " slots, "
+              << alloc.num_spilled << " without sharing\n";
+    assert(alloc.next_stack_location <= alloc.num_spilled);
+}
+
+// executes allocated code, values are read from their registers and stack slots
+inline int64_t run_with_locations(Graph &g, const std::vector<int64_t> &args) {
+    Interpreter interpreter;
+    interpreter.use_locations = true;
+    return interpreter.run(&g, args);
+}
+
+// x and y are used only in cold block placed after the loop, so their intervals have
+// a hole over the loop and they should not take registers from it
+static void build_hole_across_loop(Graph &g) {
+    BasicBlock *entry = &g.basic_blocks[0];
+    BasicBlock *pre = &g.basic_blocks[1];
+    BasicBlock *header = &g.basic_blocks[2];
+    BasicBlock *body = &g.basic_blocks[3];
+    BasicBlock *exit = &g.basic_blocks[4];
+    BasicBlock *cold = &g.basic_blocks[5];
+
+    auto *n = entry->add_<Arg64>({0});
+    auto *c0 = entry->add_<Const64>({0});
+    auto *c1 = entry->add_<Const64>({1});
+    auto *x = entry->add_<Add64>({n, 7});
+    auto *y = entry->add_<Add64>({n, 9});
+    entry->add_<EqBool>({n, c0});
+    entry->add_next1(cold);
+    entry->add_next2(pre);
+
+    pre->add_next1(header);
+
+    auto *i = header->add_<Phi64>({});
+    auto *acc = header->add_<Phi64>({});
+    header->add_<EqBool>({i, c0});
+    header->add_next1(exit);
+    header->add_next2(body);
+
+    auto *m = body->add_<Mul64>({i, i});
+    auto *add = body->add_<Add64>({acc, m});
+    auto *dec = body->add_<Sub64>({i, c1});
+    body->add_next1(header);
+
+    i->add_input(PhiInput{n, pre});
+    i->add_input(PhiInput{dec, body});
+    acc->add_input(PhiInput{c0, pre});
+    acc->add_input(PhiInput{add, body});
+
+    exit->add_<Ret64>({acc});
+    cold->add_<Ret64>({cold->add_<Add64>({x, y})});
+}
+
+inline void test_hole_across_loop() {
+    Graph g(6, {Types::INT64_T});
+    build_hole_across_loop(g);
+    LoopAnalyzer la(&g);
+    LinearOrderBuilder lin(&g, &la);
+    LivenessAnalyzer live(lin, la);
+    LinearScanAllocator alloc(live, 5);
+    LinearScanRewriter re(&g, 5, live);
+
+    // loop runs without memory traffic
+    for (int b : {2, 3})
+        for (auto i = g.basic_blocks[b].first_not_phi; i; i = i->next)
+            assert(i->opcode != Spill::opcode && i->opcode != Fill::opcode &&
+                   "values live only outside of loop caused spills in it");
+
+    assert(run_with_locations(g, {0}) == 16);
+    assert(run_with_locations(g, {5}) == 55);
+    report_frame(alloc);
+    std::cout << "hole across loop was correct!\n";
+}
+
+// for j in m..1, for i in n..1: acc += (i + z) * base + j, z and w are live through
+// both loops but only z is used in the inner one
+static void build_nested_loop_kernel(Graph &g) {
+    BasicBlock *entry = &g.basic_blocks[0];
+    BasicBlock *outer = &g.basic_blocks[1];
+    BasicBlock *pre = &g.basic_blocks[2];
+    BasicBlock *inner = &g.basic_blocks[3];
+    BasicBlock *body = &g.basic_blocks[4];
+    BasicBlock *latch = &g.basic_blocks[5];
+    BasicBlock *exit = &g.basic_blocks[6];
+
+    auto *n = entry->add_<Arg64>({0});
+    auto *m = entry->add_<Arg64>({1});
+    auto *c0 = entry->add_<Const64>({0});
+    auto *c1 = entry->add_<Const64>({1});
+    auto *z = entry->add_<Add64>({n, 3});
+    auto *w = entry->add_<Add64>({m, 5});
+    entry->add_next1(outer);
+
+    auto *j = outer->add_<Phi64>({});
+    auto *acc_o = outer->add_<Phi64>({});
+    outer->add_<EqBool>({j, c0});
+    outer->add_next1(exit);
+    outer->add_next2(pre);
+
+    auto *base = pre->add_<Mul64>({j, 7});
+    pre->add_next1(inner);
+
+    auto *i = inner->add_<Phi64>({});
+    auto *acc = inner->add_<Phi64>({});
+    inner->add_<EqBool>({i, c0});
+    inner->add_next1(latch);
+    inner->add_next2(body);
+
+    auto *t = body->add_<Add64>({i, z});
+    auto *u = body->add_<Mul64>({t, base});
+    auto *v = body->add_<Add64>({u, j});
+    auto *add = body->add_<Add64>({acc, v});
+    auto *idec = body->add_<Sub64>({i, c1});
+    body->add_next1(inner);
+
+    auto *jdec = latch->add_<Sub64>({j, c1});
+    latch->add_next1(outer);
+
+    auto *r = exit->add_<Add64>({acc_o, w});
+    exit->add_<Ret64>({exit->add_<Add64>({r, z})});
+
+    j->add_input(PhiInput{m, entry});
+    j->add_input(PhiInput{jdec, latch});
+    acc_o->add_input(PhiInput{c0, entry});
+    acc_o->add_input(PhiInput{acc, latch});
+    i->add_input(PhiInput{n, pre});
+    i->add_input(PhiInput{idec, body});
+    acc->add_input(PhiInput{acc_o, pre});
+    acc->add_input(PhiInput{add, body});
+}
+
+// dynamic spill/fill count of nested loops allocated with each heuristic
+inline void test_spill_weights() {
+    int64_t traffic[2];
+    for (bool weighted : {false, true}) {
+        Graph g(7, {Types::INT64_T, Types::INT64_T});
+        build_nested_loop_kernel(g);
+        int64_t expected = Interpreter().run(&g, {30, 20});
+        LoopAnalyzer la(&g);
+        LinearOrderBuilder lin(&g, &la);
+        LivenessAnalyzer live(lin, la);
+        LinearScanAllocator alloc(live, 6, weighted);
+        LinearScanRewriter re(&g, 6, live);
+
+        Interpreter interpreter;
+        interpreter.use_locations = true;
+        assert(interpreter.run(&g, {30, 20}) == expected);
+        traffic[weighted] = interpreter.spills + interpreter.fills;
+        report_frame(alloc);
+        std::cout << (weighted ? "spill weights" : "next use") << ": " << interpreter.spills
+                  << " spills, " << interpreter.fills << " fills\n";
+    }
+    assert(traffic[1] < traffic[0]);
+    std::cout << "spill weights were correct!\n";
+}
+
+// constants and arguments are repeated at uses, nothing of them goes to stack
+inline void test_rematerialization() {
+    Graph g(7, {Types::INT64_T, Types::INT64_T});
+    build_nested_loop_kernel(g);
+    int64_t expected = Interpreter().run(&g, {30, 20});
+    LoopAnalyzer la(&g);
+    LinearOrderBuilder lin(&g, &la);
+    LivenessAnalyzer live(lin, la);
+    LinearScanAllocator alloc(live, 4);
+    LinearScanRewriter re(&g, 4, live);
+
+    assert(re.num_remats > 0);
+    for (auto &bb : g.basic_blocks)
+        for (auto i = bb.first_not_phi; i; i = i->next)
+            if (i->opcode == Spill::opcode) {
+                Instruction *src = std::get<Instruction *>(i->inputs[0].data);
+                assert(src->opcode != Const::opcode && src->opcode != GetArg::opcode &&
+                       "rematerializable value was spilled");
+            }
+    assert(run_with_locations(g, {30, 20}) == expected);
+    std::cout << "rematerialization was correct!\n";
+}
+
+// loop is a single block, its back edge is critical. phis x and y swap on every
+// iteration, u, v and w rotate
+static void build_phi_cycles(Graph &g) {
+    BasicBlock *entry = &g.basic_blocks[0];
+    BasicBlock *loop = &g.basic_blocks[1];
+    BasicBlock *exit = &g.basic_blocks[2];
+
+    auto *n = entry->add_<Arg64>({0});
+    auto *a = entry->add_<Arg64>({1});
+    auto *b = entry->add_<Add64>({a, 1});
+    auto *c = entry->add_<Add64>({a, 2});
+    auto *c0 = entry->add_<Const64>({0});
+    auto *c1 = entry->add_<Const64>({1});
+    entry->add_next1(loop);
+
+    auto *i = loop->add_<Phi64>({});
+    auto *x = loop->add_<Phi64>({});
+    auto *y = loop->add_<Phi64>({});
+    auto *u = loop->add_<Phi64>({});
+    auto *v = loop->add_<Phi64>({});
+    auto *w = loop->add_<Phi64>({});
+    auto *dec = loop->add_<Sub64>({i, c1});
+    loop->add_<EqBool>({dec, c0});
+    loop->add_next1(exit);
+    loop->add_next2(loop);
+
+    i->add_input(PhiInput{n, entry});
+    i->add_input(PhiInput{dec, loop});
+    x->add_input(PhiInput{a, entry});
+    x->add_input(PhiInput{y, loop});
+    y->add_input(PhiInput{b, entry});
+    y->add_input(PhiInput{x, loop});
+    u->add_input(PhiInput{a, entry});
+    u->add_input(PhiInput{v, loop});
+    v->add_input(PhiInput{b, entry});
+    v->add_input(PhiInput{w, loop});
+    w->add_input(PhiInput{c, entry});
+    w->add_input(PhiInput{u, loop});
+
+    // digits of result are x, y, u, v, w
+    auto *r = exit->add_<Add64>({exit->add_<Mul64>({x, 10}), y});
+    r = exit->add_<Add64>({exit->add_<Mul64>({r, 10}), u});
+    r = exit->add_<Add64>({exit->add_<Mul64>({r, 10}), v});
+    r = exit->add_<Add64>({exit->add_<Mul64>({r, 10}), w});
+    exit->add_<Ret64>({r});
+}
+
+inline void test_phi_cycles() {
+    for (int regs : {8, 4}) {
+        Graph g(3, {Types::INT64_T, Types::INT64_T});
+        build_phi_cycles(g);
+        std::vector<int64_t> expected;
+        for (int n = 1; n <= 6; n++) expected.push_back(Interpreter().run(&g, {n, 1}));
+        LoopAnalyzer la(&g);
+        LinearOrderBuilder lin(&g, &la);
+        LivenessAnalyzer live(lin, la);
+        LinearScanAllocator alloc(live, regs);
+        LinearScanRewriter re(&g, regs, live);
+
+        // moves of back edge got their own block, condition stays last in loop
+        assert(g.basic_blocks.size() == 4 && "critical edge was not split");
+        BasicBlock &loop = g.basic_blocks[1];
+        assert(loop.next2 == &g.basic_blocks[3] && loop.last->opcode == Eq::opcode);
+
+        int moves = 0;
+        for (auto i = g.basic_blocks[3].first_not_phi; i; i = i->next) moves++;
+        std::cout << "R=" << regs << ": " << moves << " moves on back edge\n";
+        // 2 + 3 copies of phis and i, one more for every cycle
+        if (regs == 8) assert(moves <= 8);
+
+        for (int n = 1; n <= 6; n++) assert(run_with_locations(g, {n, 1}) == expected[n - 1]);
+    }
+    std::cout << "phi cycles were correct!\n";
+}
+
+// k is computed together with many temporaries, so next use heuristic spills it before the
+// loop, but inside of the loop there is room for it. body reads k twice
+static void build_invariant_loop(Graph &g) {
+    BasicBlock *entry = &g.basic_blocks[0];
+    BasicBlock *header = &g.basic_blocks[1];
+    BasicBlock *body = &g.basic_blocks[2];
+    BasicBlock *exit = &g.basic_blocks[3];
+
+    auto *a = entry->add_<Arg64>({0});
+    auto *b = entry->add_<Arg64>({1});
+    auto *k = entry->add_<Mul64>({a, b});
+    auto *p1 = entry->add_<Add64>({a, 1});
+    auto *p2 = entry->add_<Add64>({b, 2});
+    auto *p3 = entry->add_<Mul64>({a, 3});
+    auto *p4 = entry->add_<Mul64>({b, 5});
+    auto *s1 = entry->add_<Add64>({p1, p2});
+    auto *s2 = entry->add_<Add64>({p3, p4});
+    auto *s = entry->add_<Add64>({s1, s2});
+    entry->add_next1(header);
+
+    auto *i = header->add_<Phi64>({});
+    auto *acc = header->add_<Phi64>({});
+    header->add_<EqBool>({i, 0});
+    header->add_next1(exit);
+    header->add_next2(body);
+
+    auto *x = body->add_<Add64>({acc, k});
+    auto *y = body->add_<Add64>({x, k});
+    auto *idec = body->add_<Sub64>({i, 1});
+    body->add_next1(header);
+
+    exit->add_<Ret64>({acc});
+
+    i->add_input(PhiInput{a, entry});
+    i->add_input(PhiInput{idec, body});
+    acc->add_input(PhiInput{s, entry});
+    acc->add_input(PhiInput{y, body});
+}
+
+// selects read three values at once, so with three registers one of a and b stays on
+// stack. both selects read it, one right after the other
+static void build_back_to_back_uses(Graph &g) {
+    BasicBlock *entry = &g.basic_blocks[0];
+    BasicBlock *header = &g.basic_blocks[1];
+    BasicBlock *body = &g.basic_blocks[2];
+    BasicBlock *exit = &g.basic_blocks[3];
+
+    auto *n = entry->add_<Arg64>({0});
+    auto *k = entry->add_<Arg64>({1});
+    entry->add_next1(header);
+
+    auto *i = header->add_<Phi64>({});
+    auto *a = header->add_<Phi64>({});
+    auto *b = header->add_<Phi64>({});
+    header->add_<EqBool>({i, 0});
+    header->add_next1(exit);
+    header->add_next2(body);
+
+    auto *odd = body->add_<And64>({i, 1});
+    auto *s1 = body->add_<Select64>({odd, a, b});
+    auto *s2 = body->add_<Select64>({odd, b, a});
+    auto *na = body->add_<Add64>({s1, k});
+    auto *nb = body->add_<Sub64>({s2, k});
+    auto *idec = body->add_<Sub64>({i, 1});
+    body->add_next1(header);
+
+    exit->add_<Ret64>({exit->add_<Add64>({a, b})});
+
+    i->add_input(PhiInput{n, entry});
+    i->add_input(PhiInput{idec, body});
+    a->add_input(PhiInput{k, entry});
+    a->add_input(PhiInput{na, body});
+    b->add_input(PhiInput{n, entry});
+    b->add_input(PhiInput{nb, body});
+}
+
+// callee(a) * 3 with callee(x) = x + 1 inlined. blocks of callee body are appended
+// after the block that continues the caller, so uses come before definitions in the
+// order of basic_blocks
+static void build_inlined_call(Graph &g) {
+    Graph callee(1, {Types::INT64_T});
+    BasicBlock &cb = callee.basic_blocks[0];
+    cb.add_<Ret64>({cb.add_<Add64>({cb.add_<Arg64>({0}), 1})});
+
+    BasicBlock *entry = &g.basic_blocks[0];
+    auto *t = entry->add_<Call64>({callee.id, entry->add_<Arg64>({0})});
+    entry->add_<Ret64>({entry->add_<Mul64>({t, 3})});
+
+    Inliner inliner([&](int id) { return id == callee.id ? &callee : nullptr; });
+    assert(inliner.run(&g));
+}
+
+// graphs that allocators are compared on
+struct RegallocKernel {
+    const char *name;
+    int bbnum;
+    void (*build)(Graph &);
+    std::vector<int64_t> args;
+};
+
+static const std::vector<RegallocKernel> regalloc_kernels = {
+    {"high pressure", 1, build_high_pressure_linear, {}},
+    {"if-else", 4, build_if_else, {}},
+    {"hole across loop", 6, build_hole_across_loop, {10}},
+    {"nested loops", 7, build_nested_loop_kernel, {30, 20}},
+    {"phi cycles", 3, build_phi_cycles, {20, 1}},
+    {"multiple phis", 4, build_multiple_phis_with_spill, {}},
+    {"invariant", 4, build_invariant_loop, {100, 7}},
+    {"back to back uses", 4, build_back_to_back_uses, {30, 3}},
+    {"inlined call", 1, build_inlined_call, {5}},
+};
+
+// highest register in locations of allocated graph, rewriter may use
+// LinearScanRewriter::NUM_SCRATCH above R
+static int max_register(const Graph &g) {
+    int reg = -1;
+    for (auto &bb : g.basic_blocks)
+        for (auto i = bb.first_phi ? bb.first_phi : bb.first_not_phi; i; i = i->next)
+            if (i->loc.type == LocationType::REGISTER) reg = std::max(reg, i->loc.value);
+    return reg;
+}
+
+// builds kernel, lets allocate rewrite it and checks that it computes the same. returns
+// interpreter that ran it, for counters of executed moves, spills and fills
+template <typename Allocate>
+static Interpreter run_allocated(const RegallocKernel &k, Allocate allocate) {
+    Graph g(k.bbnum, {Types::INT64_T, Types::INT64_T});
+    k.build(g);
+    int64_t expected = Interpreter().run(&g, k.args);
+    allocate(g);
+    Interpreter interpreter;
+    interpreter.use_locations = true;
+    assert(interpreter.run(&g, k.args) == expected);
+    return interpreter;
+}
+
+// moves of loop graphs allocated with and without register hints
+inline void test_register_hints() {
+    for (auto &k : regalloc_kernels) {
+        int64_t executed[2], moves[2];
+        for (bool hints : {false, true}) {
+            Interpreter interpreter = run_allocated(k, [&](Graph &g) {
+                LoopAnalyzer la(&g);
+                LinearOrderBuilder lin(&g, &la);
+                LivenessAnalyzer live(lin, la);
+                LinearScanAllocator alloc(live, 8, true, hints);
+                moves[hints] = LinearScanRewriter(&g, 8, live).num_moves;
+            });
+            executed[hints] = interpreter.moves + interpreter.spills + interpreter.fills;
+        }
+        std::cout << k.name << ": " << moves[0] - moves[1] << " of " << moves[0]
+                  << " moves eliminated, executed " << executed[1] << " instead of "
+                  << executed[0] << "\n";
+        assert(moves[1] <= moves[0] && executed[1] <= executed[0]);
+    }
+    std::cout << "register hints were correct!\n";
+}
+
+// for i in n..1: acc += callee(i, k), i, acc and k live across the call
+static void build_call_loop(Graph &g, int callee_id) {
+    BasicBlock *entry = &g.basic_blocks[0];
+    BasicBlock *header = &g.basic_blocks[1];
+    BasicBlock *body = &g.basic_blocks[2];
+    BasicBlock *exit = &g.basic_blocks[3];
+
+    auto *n = entry->add_<Arg64>({0});
+    auto *k = entry->add_<Arg64>({1});
+    auto *c0 = entry->add_<Const64>({0});
+    auto *c1 = entry->add_<Const64>({1});
+    entry->add_next1(header);
+
+    auto *i = header->add_<Phi64>({});
+    auto *acc = header->add_<Phi64>({});
+    header->add_<EqBool>({i, c0});
+    header->add_next1(exit);
+    header->add_next2(body);
+
+    auto *t = body->add_<Call64>({callee_id, i, k});
+    auto *sum = body->add_<Add64>({acc, t});
+    auto *dec = body->add_<Sub64>({i, c1});
+    body->add_next1(header);
+
+    i->add_input(PhiInput{n, entry});
+    i->add_input(PhiInput{dec, body});
+    acc->add_input(PhiInput{c0, entry});
+    acc->add_input(PhiInput{sum, body});
+
+    exit->add_<Ret64>({exit->add_<Add64>({acc, k})});
+}
+
+// arguments of calls are in argument registers or outgoing slots, results and returned
+// values are in return register
+static bool follows_convention(const Graph &g, const RegisterConfig &config) {
+    Location ret = {LocationType::REGISTER, config.return_reg};
+    auto loc_of = [](const Input &inp) { return std::get<Instruction *>(inp.data)->loc; };
+    for (auto &bb : g.basic_blocks)
+        for (auto i = bb.first_not_phi; i; i = i->next)
+            if (i->opcode == Call::opcode) {
+                if (i->loc != ret) return false;
+                for (size_t k = 1; k < i->inputs.size(); k++) {
+                    Location want = {LocationType::STACK, -int(k - config.arg_regs.size())};
+                    if (k - 1 < config.arg_regs.size())
+                        want = {LocationType::REGISTER, config.arg_regs[k - 1]};
+                    if (loc_of(i->inputs[k]) != want) return false;
+                }
+            } else if (i->opcode == Ret::opcode && loc_of(i->inputs[0]) != ret) {
+                return false;
+            }
+    return true;
+}
+
+inline void test_call_clobbers() {
+    // callee(p, q) = p * 3 + q
+    Graph callee(1, {Types::INT64_T, Types::INT64_T});
+    BasicBlock &cb = callee.basic_blocks[0];
+    cb.add_<Ret64>({cb.add_<Add64>({cb.add_<Mul64>({cb.add_<Arg64>({0}), 3}),
+                                    cb.add_<Arg64>({1})})});
+    auto resolver = [&](int id) { return id == callee.id ? &callee : nullptr; };
+
+    for (int regs : {6, 4}) {
+        RegisterConfig config = RegisterConfig::with_calls(regs, 2, 2);
+        // allocated code takes arguments from registers, calls clobber caller saved ones
+        auto target = [&] {
+            Interpreter interpreter(resolver);
+            interpreter.use_locations = true;
+            interpreter.arg_registers = config.arg_regs;
+            for (int r = 0; r < regs; r++)
+                if (config.caller_saved[r]) interpreter.clobbered_registers.push_back(r);
+            return interpreter;
+        };
+
+        Graph g(4, {Types::INT64_T, Types::INT64_T});
+        build_call_loop(g, callee.id);
+        int64_t expected = Interpreter(resolver).run(&g, {10, 7});
+        LoopAnalyzer la(&g);
+        LinearOrderBuilder lin(&g, &la);
+        LivenessAnalyzer live(lin, la, true);
+        LinearScanAllocator alloc(live, config);
+        LinearScanRewriter re(&g, config, live);
+
+        Interpreter interpreter = target();
+        assert(interpreter.run(&g, {10, 7}) == expected);
+        std::cout << "R=" << regs << ", 2 caller saved: " << interpreter.spills
+                  << " spills, " << interpreter.fills << " fills, " << interpreter.moves
+                  << " moves\n";
+        // i, acc and k fit callee saved registers, nothing is saved around call
+        if (regs == 6) assert(interpreter.spills == 0 && interpreter.fills == 0);
+        // with R=4 one of them goes to stack, argument k is not read again from its
+        // register after the call overwrote it
+        for (auto &bb : g.basic_blocks)
+            for (auto i = bb.first_not_phi; i; i = i->next)
+                assert(i->opcode != GetArg::opcode || bb.id == 0);
+
+        // graph coloring keeps values that live across call out of caller saved ones too
+        Graph h(4, {Types::INT64_T, Types::INT64_T});
+        build_call_loop(h, callee.id);
+        allocate_registers(&h, config, RegAllocMode::GRAPH_COLORING);
+        Interpreter colored = target();
+        assert(colored.run(&h, {10, 7}) == expected);
+        if (regs == 6) assert(colored.spills == 0 && colored.fills == 0);
+
+        // baseline keeps what is read after call in slots
+        Graph l(4, {Types::INT64_T, Types::INT64_T});
+        build_call_loop(l, callee.id);
+        allocate_registers(&l, config, RegAllocMode::BASELINE);
+        assert(target().run(&l, {10, 7}) == expected);
+        assert(follows_convention(g, config) && follows_convention(h, config) &&
+               follows_convention(l, config));
+
+        // x = a * 2 is defined in the block of call and read after it
+        Graph s(1, {Types::INT64_T, Types::INT64_T});
+        BasicBlock &sb = s.basic_blocks[0];
+        auto *a = sb.add_<Arg64>({0});
+        auto *x = sb.add_<Mul64>({a, 2});
+        auto *t = sb.add_<Call64>({callee.id, x, a});
+        sb.add_<Ret64>({sb.add_<Add64>({t, x})});
+        allocate_registers(&s, config, RegAllocMode::BASELINE);
+        assert(target().run(&s, {4, 0}) == 8 * 3 + 4 + 8 && follows_convention(s, config));
+
+        // with one argument register k is passed in outgoing slot -1
+        RegisterConfig one_arg = RegisterConfig::with_calls(regs, 2, 1);
+        for (RegAllocMode mode :
+             {RegAllocMode::BASELINE, RegAllocMode::LINEAR_SCAN, RegAllocMode::GRAPH_COLORING}) {
+            Graph o(4, {Types::INT64_T, Types::INT64_T});
+            build_call_loop(o, callee.id);
+            allocate_registers(&o, one_arg, mode);
+            assert(max_register(o) < regs + LinearScanRewriter::NUM_SCRATCH);
+            Interpreter outgoing = target();
+            outgoing.arg_registers = one_arg.arg_regs;
+            assert(outgoing.run(&o, {10, 7}) == expected && follows_convention(o, one_arg));
+        }
+    }
+
+    // with two registers i, acc and k don't fit, the one evicted for call result is saved
+    // before the call writes its register
+    for (RegisterConfig config : {RegisterConfig::uniform(2), RegisterConfig::with_calls(2, 1, 0)})
+        for (RegAllocMode mode : {RegAllocMode::LINEAR_SCAN, RegAllocMode::GRAPH_COLORING}) {
+            Graph g(4, {Types::INT64_T, Types::INT64_T});
+            build_call_loop(g, callee.id);
+            int64_t expected = Interpreter(resolver).run(&g, {10, 7});
+            allocate_registers(&g, config, mode);
+            Interpreter interpreter(resolver);
+            interpreter.use_locations = true;
+            for (int r = 0; r < config.num_registers; r++)
+                if (config.caller_saved[r]) interpreter.clobbered_registers.push_back(r);
+            assert(interpreter.run(&g, {10, 7}) == expected);
+        }
+    std::cout << "call clobbers were correct!\n";
+}
+
+// entry branches on cond, one successor returns it and the other returns x
+static void build_condition_used_later(Graph &g) {
+    BasicBlock *entry = &g.basic_blocks[0];
+    BasicBlock *yes = &g.basic_blocks[1];
+    BasicBlock *no = &g.basic_blocks[2];
+
+    auto *x = entry->add_<Arg64>({0});
+    auto *cond = entry->add_<EqBool>({x, 0});
+    entry->add_next1(yes);
+    entry->add_next2(no);
+    yes->add_<Ret64>({cond});
+    no->add_<Ret64>({x});
+}
+
+// both operands of sub are filled, c is in the other register and is used later
+static void build_filled_operands(Graph &g) {
+    BasicBlock *entry = &g.basic_blocks[0];
+    BasicBlock *bb = &g.basic_blocks[1];
+    auto *a = entry->add_<Arg64>({0});
+    auto *b = entry->add_<Arg64>({1});
+    entry->add_next1(bb);
+
+    auto *c = bb->add_<Const64>({5});
+    auto *s = bb->add_<Sub64>({a, b});
+    bb->add_<Ret64>({bb->add_<Add64>({s, c})});
+}
+
+// baseline allocator against linear scan: both give correct code, baseline compiles
+// faster
+// x comes from entry, both constants are in registers when add reads x and one of them
+static void build_operand_from_other_block(Graph &g) {
+    BasicBlock *entry = &g.basic_blocks[0];
+    BasicBlock *bb = &g.basic_blocks[1];
+    auto *x = entry->add_<Arg64>({0});
+    entry->add_next1(bb);
+
+    auto *c1 = bb->add_<Const64>({3});
+    auto *c2 = bb->add_<Const64>({4});
+    auto *s = bb->add_<Add64>({x, c1});
+    bb->add_<Ret64>({bb->add_<Add64>({s, c2})});
+}
+
+// select reads three values, two of them are in registers already
+static void build_three_operands(Graph &g) {
+    BasicBlock *entry = &g.basic_blocks[0];
+    BasicBlock *bb = &g.basic_blocks[1];
+    auto *cond = entry->add_<Arg64>({0});
+    entry->add_next1(bb);
+
+    auto *a = bb->add_<Const64>({10});
+    auto *b = bb->add_<Const64>({20});
+    bb->add_<Ret64>({bb->add_<Select64>({cond, a, b})});
+}
+
+inline void test_baseline_allocator() {
+    const int copies = 200;
+
+    for (auto &k : regalloc_kernels) {
+        double ms[2];
+        int64_t executed[2];
+        for (RegAllocMode mode : {RegAllocMode::BASELINE, RegAllocMode::LINEAR_SCAN}) {
+            std::vector<std::unique_ptr<Graph>> graphs;
+            for (int i = 0; i < copies; i++) {
+                graphs.push_back(std::make_unique<Graph>(
+                    k.bbnum, std::vector<Types::Type>{Types::INT64_T, Types::INT64_T}));
+                k.build(*graphs.back());
+            }
+            auto start = std::chrono::steady_clock::now();
+            for (auto &g : graphs) allocate_registers(g.get(), 4, mode);
+            auto end = std::chrono::steady_clock::now();
+
+            Interpreter interpreter = run_allocated(k, [&](Graph &g) {
+                allocate_registers(&g, 4, mode);
+                assert(max_register(g) < 4 + LinearScanRewriter::NUM_SCRATCH);
+            });
+            bool baseline = mode == RegAllocMode::BASELINE;
+            ms[baseline] = std::chrono::duration<double, std::milli>(end - start).count();
+            executed[baseline] =
+                interpreter.spills + interpreter.fills + interpreter.moves;
+        }
+        std::cout << k.name << ": baseline " << ms[1] << " ms, linear scan " << ms[0]
+                  << " ms for " << copies << " graphs; executed copies " << executed[1]
+                  << " vs " << executed[0] << "\n";
+    }
+    // 5 phis, swapped and rotated, go through the scratch register and one more slot
+    for (int n = 1; n <= 6; n++) {
+        Graph g(3, {Types::INT64_T, Types::INT64_T});
+        build_phi_cycles(g);
+        int64_t expected = Interpreter().run(&g, {n, 1});
+        allocate_registers(&g, 2, RegAllocMode::BASELINE);
+        assert(max_register(g) < 2 + 1);
+        assert(run_with_locations(g, {n, 1}) == expected);
+    }
+    // operand filled for sub is not taken by the other one
+    {
+        Graph g(2, {Types::INT64_T, Types::INT64_T});
+        build_filled_operands(g);
+        allocate_registers(&g, 2, RegAllocMode::BASELINE);
+        assert(run_with_locations(g, {10, 3}) == 12);
+    }
+    // operands that are in registers stay there until their instruction reads them, the
+    // third operand of select with two registers is read from scratch one
+    for (auto build : {build_operand_from_other_block, build_three_operands})
+        for (int64_t x : {0, 5}) {
+            Graph g(2, {Types::INT64_T});
+            build(g);
+            int64_t expected = Interpreter().run(&g, {x});
+            allocate_registers(&g, 2, RegAllocMode::BASELINE);
+            assert(max_register(g) < 2 + LinearScanRewriter::NUM_SCRATCH);
+            assert(run_with_locations(g, {x}) == expected);
+        }
+    // condition of a branch is also used in a successor
+    for (int64_t x : {0, 5}) {
+        Graph g(3, {Types::INT64_T});
+        build_condition_used_later(g);
+        allocate_registers(&g, 2, RegAllocMode::BASELINE);
+        Interpreter interpreter;
+        interpreter.use_locations = true;
+        assert(interpreter.run(&g, {x}) == (x ? 5 : 1));
+    }
+    std::cout << "baseline allocator was correct!\n";
+}
+
+// executed fills with spill placement and without it: one store at definition, fills
+// reused inside of block and moved out of loops. linear scan runs with spill weights and
+// with next use heuristic, the latter leaves invariant k on stack inside of its loop
+inline void test_spill_placement() {
+    const char *names[] = {"linear scan", "next use", "coloring"};
+    for (int alloc : {0, 1, 2})
+        for (int regs : {6, 4, 3})
+            for (auto &k : regalloc_kernels) {
+                int64_t fills[2], spills[2];
+                int hoisted = 0, reused = 0;
+                for (bool place : {false, true}) {
+                    Interpreter interpreter = run_allocated(k, [&](Graph &g) {
+                        LoopAnalyzer la(&g);
+                        LinearOrderBuilder lin(&g, &la);
+                        LivenessAnalyzer live(lin, la);
+                        if (alloc == 2)
+                            GraphColoringAllocator(live, regs);
+                        else
+                            LinearScanAllocator(live, regs, alloc == 0);
+                        LinearScanRewriter re(&g, regs, live, place);
+                        hoisted = re.num_hoisted;
+                        reused = re.num_reused;
+                        assert(max_register(g) < regs + LinearScanRewriter::NUM_SCRATCH);
+                    });
+                    fills[place] = interpreter.fills;
+                    spills[place] = interpreter.spills;
+                }
+                std::cout << names[alloc] << " R=" << regs
+                          << " " << k.name << ": fills " << fills[1] << " instead of "
+                          << fills[0] << ", spills " << spills[1] << " instead of "
+                          << spills[0] << " (" << hoisted << " hoisted, " << reused
+                          << " reused)\n";
+                assert(fills[1] <= fills[0]);
+                // k is filled once before the loop instead of on every iteration
+                if (alloc == 1 && regs == 4 && k.build == build_invariant_loop)
+                    assert(fills[1] * 10 < fills[0]);
+                // with spill weights temporaries of entry are cheaper than k and are
+                // spilled instead of it
+                if (alloc == 0 && regs == 4 && k.build == build_invariant_loop)
+                    assert(fills[0] < 10);
+                // second select takes the value filled for the first one
+                if (alloc == 0 && regs == 3 && k.build == build_back_to_back_uses)
+                    assert(reused > 0 && fills[1] < fills[0]);
+            }
+    std::cout << "spill placement was correct!\n";
+}
+
+// static and executed spill code of graph coloring against linear scan on the same graphs.
+// with two registers all operands of a select may be on stack
+inline void test_graph_coloring() {
+    for (int regs : {4, 3, 2})
+        for (auto &k : regalloc_kernels) {
+            int stat[2], frame[2];
+            int64_t executed[2];
+            for (bool coloring : {false, true}) {
+                Interpreter interpreter = run_allocated(k, [&](Graph &g) {
+                    frame[coloring] = allocate_registers(
+                        &g, regs, coloring ? RegAllocMode::GRAPH_COLORING
+                                           : RegAllocMode::LINEAR_SCAN);
+                    assert(max_register(g) < regs + LinearScanRewriter::NUM_SCRATCH);
+                    stat[coloring] = 0;
+                    for (auto &bb : g.basic_blocks)
+                        for (auto i = bb.first_not_phi; i; i = i->next)
+                            if (i->opcode == Spill::opcode || i->opcode == Fill::opcode)
+                                stat[coloring]++;
+                });
+                executed[coloring] = interpreter.spills + interpreter.fills;
+            }
+            std::cout << "R=" << regs << " " << k.name << ": spills and fills " << stat[1]
+                      << " vs " << stat[0] << " in code, " << executed[1] << " vs "
+                      << executed[0] << " executed, frame " << frame[1] << " vs "
+                      << frame[0] << "\n";
+        }
+    std::cout << "graph coloring was correct!\n";
+}
+
 inline void run_regalloc_unit_tests() {
     std::cout << "===  regalloc  ===\n\n";
 
     {
         Graph g(1);
         build_high_pressure_linear(g);
+        int64_t expected = Interpreter().run(&g, {});
         LoopAnalyzer la(&g);
         LinearOrderBuilder lin(&g, &la);
         LivenessAnalyzer live(lin, la);
         LinearScanAllocator alloc(live, 2);
-        LinearScanRewriter re(&g, 2);
-        verify_regalloc_semantics(g, "high-pressure linear");
+        LinearScanRewriter re(&g, 2, live);
+        verify_regalloc_semantics(g, re, "high-pressure linear");
+        assert(run_with_locations(g, {}) == expected);
+        report_frame(alloc);
     }
     {
         Graph g(4);
         build_if_else(g);
+        int64_t expected = Interpreter().run(&g, {});
         LoopAnalyzer la(&g);
         LinearOrderBuilder lin(&g, &la);
         LivenessAnalyzer live(lin, la);
         LinearScanAllocator alloc(live, 2);
-        LinearScanRewriter re(&g, 2);
-        verify_regalloc_semantics(g, "if-else");
+        LinearScanRewriter re(&g, 2, live);
+        verify_regalloc_semantics(g, re, "if-else");
+        assert(run_with_locations(g, {}) == expected);
+        report_frame(alloc);
     }
     {
         Graph g(4);
         build_reducible_loop_with_spill(g);
+        int64_t expected = Interpreter().run(&g, {});
         LoopAnalyzer la(&g);
         LinearOrderBuilder lin(&g, &la);
         LivenessAnalyzer live(lin, la);
 
         LinearScanAllocator alloc(live, 2);
-        LinearScanRewriter re(&g, 2);
+        LinearScanRewriter re(&g, 2, live);
 
-        verify_regalloc_semantics(g, "reducible loop");
+        verify_regalloc_semantics(g, re, "reducible loop");
+        assert(run_with_locations(g, {}) == expected);
+        report_frame(alloc);
     }
     {
         Graph g(4);
         build_multiple_phis_with_spill(g);
+        int64_t expected = Interpreter().run(&g, {});
         LoopAnalyzer la(&g);
         LinearOrderBuilder lin(&g, &la);
         LivenessAnalyzer live(lin, la);
 
         LinearScanAllocator alloc(live, 3);
-        LinearScanRewriter re(&g, 3);
+        LinearScanRewriter re(&g, 3, live);
 
-        verify_regalloc_semantics(g, "Multiple parallel stack-to-stack PHIs (R=3)");
+        verify_regalloc_semantics(g, re, "Multiple parallel stack-to-stack PHIs (R=3)");
+        assert(run_with_locations(g, {}) == expected);
+        report_frame(alloc);
     }
 
+    test_hole_across_loop();
+    test_spill_weights();
+    test_rematerialization();
+    test_phi_cycles();
+    test_register_hints();
+    test_call_clobbers();
+    test_baseline_allocator();
+    test_graph_coloring();
+    test_spill_placement();
+
     std::cout << "\nALL REGALLOC TESTS PASSED\n";
 }
@@ -0,0 +1,157 @@
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "graph.hpp"
+#include "interpreter.hpp"
+#include "ir_text.hpp"
+#include "loop_analyser.hpp"
+#include "strength_reduction.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// s += i * stride + 12 * i + (i + 1) * 8 for i < n, returns s * 7
+inline const char *strength_reduction_loop =
+    "method 1 (i64, i64) {\n"
+    "bb0:\n"
+    "  v0 = i64 ARG 0\n"
+    "  v1 = i64 ARG 1\n"
+    "  v2 = i64 CNST 0\n"
+    "  goto bb1\n"
+    "bb1 <- bb0, bb2:\n"
+    "  v3 = i64 PHI [v2, bb0], [v9, bb2]\n"
+    "  v4 = i64 PHI [v2, bb0], [v12, bb2]\n"
+    "  v5 = bool EQ v3, v0\n"
+    "  if bb3, bb2\n"
+    "bb2 <- bb1:\n"
+    "  v6 = i64 MUL v3, v1\n"
+    "  v7 = i64 MUL 12, v3\n"
+    "  v8 = i64 ADD v6, v7\n"
+    "  v9 = i64 ADD v3, 1\n"
+    "  v10 = i64 MUL v9, 8\n"
+    "  v11 = i64 ADD v8, v10\n"
+    "  v12 = i64 ADD v4, v11\n"
+    "  goto bb1\n"
+    "bb3 <- bb1:\n"
+    "  v13 = i64 MUL v4, 7\n"
+    "  v14 = i64 RET v13\n"
+    "}\n";
+
+// instructions and muls that one iteration of the loop at header bb1 executes
+inline std::pair<int, int> strength_reduction_per_iteration(Graph &g) {
+    LoopAnalyzer analyzer(&g);
+    std::pair<int, int> counts = {0, 0};
+    for (auto &loop : analyzer.loops)
+        if (loop.header && loop.header->id == 1)
+            for (BasicBlock *bb : loop.blocks)
+                for (auto inst = bb->first_not_phi; inst; inst = inst->next) {
+                    counts.first++;
+                    counts.second += inst->opcode == Mul::opcode;
+                }
+    return counts;
+}
+
+inline void test_strength_reduction_loop() {
+    auto g = IrParser::parse_graph(strength_reduction_loop);
+    auto original = IrParser::parse_graph(strength_reduction_loop);
+    auto before = strength_reduction_per_iteration(*g);
+
+    StrengthReduction sr(g.get());
+    sr.run();
+    // i * stride, 12 * i and (i + 1) * 8 get phis, starts and the exit mul get reduced
+    assert(sr.num_recurrences == 3 && sr.num_replaced == 3);
+    auto after = strength_reduction_per_iteration(*g);
+    assert(after.second == 0 && after.first == before.first);
+    for (auto &bb : g->basic_blocks)
+        for (auto inst = bb.first_not_phi; inst; inst = inst->next)
+            assert(inst->opcode != Mul::opcode);
+
+    for (int64_t n : {0, 1, 7, 100})
+        for (int64_t stride : {0, 3, -5}) {
+            int64_t expected =
+                7 * (stride * n * (n - 1) / 2 + 12 * n * (n - 1) / 2 + 8 * n * (n + 1) / 2);
+            Interpreter reduced, plain;
+            assert(reduced.run(g.get(), {n, stride}) == expected);
+            assert(plain.run(original.get(), {n, stride}) == expected);
+            assert(reduced.executed <= plain.executed + 4);
+        }
+    std::cout << "strength reduction loop: " << before.first << " instructions, "
+              << before.second << " muls -> " << after.first << " instructions, "
+              << after.second << " muls per iteration\n";
+}
+
+inline void test_strength_reduction_constants() {
+    auto g = IrParser::parse_graph(
+        "method 2 (i64) {\n"
+        "bb0:\n"
+        "  v0 = i64 ARG 0\n"
+        "  v1 = i64 MUL v0, 0\n"
+        "  v2 = i64 MUL v0, 1\n"
+        "  v3 = i64 MUL 16, v0\n"
+        "  v4 = i64 MUL v0, 9\n"
+        "  v5 = i64 MUL v0, 7\n"
+        "  v6 = i64 MUL v0, 10\n"
+        "  v7 = i64 MUL v0, -4\n"
+        "  v8 = i64 MUL v0, v0\n"
+        "  v9 = i64 ADD v1, v2\n"
+        "  v10 = i64 ADD v9, v3\n"
+        "  v11 = i64 ADD v10, v4\n"
+        "  v12 = i64 ADD v11, v5\n"
+        "  v13 = i64 ADD v12, v6\n"
+        "  v14 = i64 ADD v13, v7\n"
+        "  v15 = i64 ADD v14, v8\n"
+        "  v16 = i64 RET v15\n"
+        "}\n");
+    // x * 10, x * -4 and x * x stay
+    StrengthReduction sr(g.get());
+    assert(sr.run() == 5 && sr.num_recurrences == 0);
+    int muls = 0, shifts = 0;
+    for (auto inst = g->first->first_not_phi; inst; inst = inst->next) {
+        muls += inst->opcode == Mul::opcode;
+        shifts += inst->opcode == Shl::opcode;
+    }
+    assert(muls == 3 && shifts == 3);
+    for (int64_t x : std::vector<int64_t>{0, 1, -3, 1000, int64_t(1) << 40})
+        assert(Interpreter().run(g.get(), {x}) == x * (1 + 16 + 9 + 7 + 10 - 4) + x * x);
+    std::cout << "strength reduction constants test passed\n";
+}
+
+// i * i and muls of a phi that is not stepped by a constant stay
+inline void test_strength_reduction_rejected() {
+    auto g = IrParser::parse_graph(
+        "method 3 (i64) {\n"
+        "bb0:\n"
+        "  v0 = i64 ARG 0\n"
+        "  v1 = i64 CNST 1\n"
+        "  goto bb1\n"
+        "bb1 <- bb0, bb2:\n"
+        "  v2 = i64 PHI [v1, bb0], [v8, bb2]\n"
+        "  v3 = i64 PHI [v1, bb0], [v6, bb2]\n"
+        "  v4 = bool EQ v2, v0\n"
+        "  if bb3, bb2\n"
+        "bb2 <- bb1:\n"
+        "  v5 = i64 MUL v2, v2\n"
+        "  v6 = i64 MUL v3, v0\n"
+        "  v7 = i64 ADD v6, v5\n"
+        "  v8 = i64 ADD v2, v3\n"
+        "  goto bb1\n"
+        "bb3 <- bb1:\n"
+        "  v9 = i64 RET v3\n"
+        "}\n");
+    StrengthReduction sr(g.get());
+    assert(sr.run() == 0 && sr.num_recurrences == 0);
+    assert(strength_reduction_per_iteration(*g).second == 2);
+    std::cout << "strength reduction rejected test passed\n";
+}
+
+inline void run_strength_reduction_tests() {
+    test_strength_reduction_loop();
+    test_strength_reduction_constants();
+    test_strength_reduction_rejected();
+    std::cout << "all strength reduction tests passed successfully!\n";
+}
+
+}  // namespace IR
+}  // namespace Compiler
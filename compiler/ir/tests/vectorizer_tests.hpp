@@ -0,0 +1,182 @@
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "graph.hpp"
+#include "interpreter.hpp"
+#include "ir_text.hpp"
+#include "loop_vectorizer.hpp"
+#include "register_allocation.hpp"
+
+namespace Compiler {
+namespace IR {
+
+// s += ((i * k) & 255) + (i >> 1), d -= i for i in 0..n-1, returns s + d
+inline const char *vectorizer_sum_loop =
+    "method 1 (i64, i64) {\n"
+    "bb0:\n"
+    "  v0 = i64 ARG 0\n"
+    "  v1 = i64 ARG 1\n"
+    "  v2 = i64 CNST 0\n"
+    "  goto bb1\n"
+    "bb1 <- bb0, bb2:\n"
+    "  v3 = i64 PHI [v2, bb0], [v13, bb2]\n"
+    "  v4 = i64 PHI [v2, bb0], [v11, bb2]\n"
+    "  v5 = i64 PHI [v1, bb0], [v12, bb2]\n"
+    "  v6 = bool EQ v3, v0\n"
+    "  if bb3, bb2\n"
+    "bb2 <- bb1:\n"
+    "  v7 = i64 MUL v3, v1\n"
+    "  v8 = i64 AND v7, 255\n"
+    "  v9 = i64 SHR v3, 1\n"
+    "  v10 = i64 ADD v8, v9\n"
+    "  v11 = i64 ADD v4, v10\n"
+    "  v12 = i64 SUB v5, v3\n"
+    "  v13 = i64 ADD v3, 1\n"
+    "  goto bb1\n"
+    "bb3 <- bb1:\n"
+    "  v14 = i64 ADD v4, v5\n"
+    "  v15 = i64 RET v14\n"
+    "}\n";
+
+inline int64_t vectorizer_sum_expected(int64_t n, int64_t k) {
+    int64_t s = 0, d = k;
+    for (int64_t i = 0; i < n; i++) {
+        s += ((i * k) & 255) + (i >> 1);
+        d -= i;
+    }
+    return s + d;
+}
+
+// p *= (i & 3) + 1, a &= x - i for i in n..1 on i32, returns p + a
+inline const char *vectorizer_product_loop =
+    "method 2 (i32, i32) {\n"
+    "bb0:\n"
+    "  v0 = i32 ARG 0\n"
+    "  v1 = i32 ARG 1\n"
+    "  v2 = i32 CNST 1\n"
+    "  v3 = i32 CNST -1\n"
+    "  goto bb1\n"
+    "bb1 <- bb0, bb2:\n"
+    "  v4 = i32 PHI [v0, bb0], [v13, bb2]\n"
+    "  v5 = i32 PHI [v2, bb0], [v10, bb2]\n"
+    "  v6 = i32 PHI [v3, bb0], [v12, bb2]\n"
+    "  v7 = bool EQ 0, v4\n"
+    "  if bb3, bb2\n"
+    "bb2 <- bb1:\n"
+    "  v8 = i32 AND v4, 3\n"
+    "  v9 = i32 ADD v8, 1\n"
+    "  v10 = i32 MUL v5, v9\n"
+    "  v11 = i32 SUB v1, v4\n"
+    "  v12 = i32 AND v6, v11\n"
+    "  v13 = i32 SUB v4, 1\n"
+    "  goto bb1\n"
+    "bb3 <- bb1:\n"
+    "  v14 = i32 ADD v5, v6\n"
+    "  v15 = i32 RET v14\n"
+    "}\n";
+
+inline int64_t vectorizer_product_expected(int64_t n, int64_t x) {
+    int64_t p = 1, a = -1;
+    for (int64_t i = n; i != 0; i--) {
+        p *= (i & 3) + 1;
+        a &= x - i;
+    }
+    return p + a;
+}
+
+inline void test_vectorize_sum() {
+    for (int bits : {128, 256}) {
+        auto g = IrParser::parse_graph(vectorizer_sum_loop);
+        assert(LoopVectorizer(g.get(), bits).run() == 1);
+        std::string text = IrPrinter::print(*g, 1);
+        assert(text.find(bits == 128 ? "v2i64 IOTA" : "v4i64 IOTA") != std::string::npos);
+        assert(IrPrinter::print(*IrParser::parse_graph(text), 1) == text);
+
+        // lengths around lanes check scalar epilogue
+        for (int64_t n : {0, 1, 2, 3, 4, 5, 7, 8, 9, 1003})
+            assert(Interpreter().run(g.get(), {n, 37}) == vectorizer_sum_expected(n, 37));
+    }
+    std::cout << "vectorize sum test passed\n";
+}
+
+inline void test_vectorize_product() {
+    auto g = IrParser::parse_graph(vectorizer_product_loop);
+    assert(LoopVectorizer(g.get(), 256).run() == 1);
+    assert(IrPrinter::print(*g).find("v8i32 MUL") != std::string::npos);
+    for (int64_t n : {0, 1, 7, 8, 9, 17, 19})
+        assert(Interpreter().run(g.get(), {n, 1000}) == vectorizer_product_expected(n, 1000));
+    std::cout << "vectorize product test passed\n";
+}
+
+// checks in body and phis that are not reductions stay scalar
+inline void test_vectorize_rejected() {
+    std::string check = vectorizer_sum_loop;
+    check.insert(check.find("  v13 = "), "  v16 = void ZCHK v1 !2\n");
+    std::string recurrence = vectorizer_sum_loop;
+    recurrence.replace(recurrence.find("SUB v5, v3"), 10, "SUB v5, v4");
+    for (const std::string &text : {check, recurrence}) {
+        auto g = IrParser::parse_graph(text);
+        auto original = IrParser::parse_graph(text);
+        assert(LoopVectorizer(g.get()).run() == 0);
+        assert(Interpreter().run(g.get(), {9, 37}) == Interpreter().run(original.get(), {9, 37}));
+    }
+    std::cout << "vectorize rejected test passed\n";
+}
+
+// vector values go through both allocators and run the same from their locations
+inline void test_vectorize_regalloc() {
+    for (RegAllocMode mode : {RegAllocMode::LINEAR_SCAN, RegAllocMode::GRAPH_COLORING}) {
+        auto g = IrParser::parse_graph(vectorizer_sum_loop);
+        LoopVectorizer(g.get()).run();
+        allocate_registers(g.get(), 4, mode);
+        Interpreter interpreter;
+        interpreter.use_locations = true;
+        assert(interpreter.run(g.get(), {1003, 37}) == vectorizer_sum_expected(1003, 37));
+    }
+    // vectors go only to vector registers and scalars only to general ones
+    RegisterConfig config = RegisterConfig::with_vectors(4, 2);
+    for (RegAllocMode mode :
+         {RegAllocMode::BASELINE, RegAllocMode::LINEAR_SCAN, RegAllocMode::GRAPH_COLORING}) {
+        auto g = IrParser::parse_graph(vectorizer_sum_loop);
+        LoopVectorizer(g.get()).run();
+        allocate_registers(g.get(), config, mode);
+        for (auto &bb : g->basic_blocks)
+            for (auto i = bb.first_phi ? bb.first_phi : bb.first_not_phi; i; i = i->next)
+                assert(i->loc.type != LocationType::REGISTER ||
+                       i->loc.value >= config.num_registers ||
+                       config.can_hold(i->loc.value, i->type));
+        Interpreter interpreter;
+        interpreter.use_locations = true;
+        assert(interpreter.run(g.get(), {1003, 37}) == vectorizer_sum_expected(1003, 37));
+    }
+    std::cout << "vectorize regalloc test passed\n";
+}
+
+// executed instructions of the kernel before and after
+inline void test_vectorize_speedup() {
+    const int64_t n = 10000;
+    auto scalar = IrParser::parse_graph(vectorizer_sum_loop);
+    auto vector = IrParser::parse_graph(vectorizer_sum_loop);
+    LoopVectorizer(vector.get()).run();
+
+    Interpreter scalar_run, vector_run;
+    assert(scalar_run.run(scalar.get(), {n, 37}) == vector_run.run(vector.get(), {n, 37}));
+    std::cout << "sum kernel, n = " << n << ": " << scalar_run.executed << " scalar vs "
+              << vector_run.executed << " vector instructions ("
+              << (double)scalar_run.executed / vector_run.executed << "x)\n";
+    assert(vector_run.executed * 3 < scalar_run.executed);
+}
+
+inline void run_vectorizer_tests() {
+    test_vectorize_sum();
+    test_vectorize_product();
+    test_vectorize_rejected();
+    test_vectorize_regalloc();
+    test_vectorize_speedup();
+    std::cout << "all vectorizer tests passed successfully!\n";
+}
+
+}  // namespace IR
+}  // namespace Compiler
@@ -5,12 +5,28 @@ namespace Compiler {
 namespace IR {
 
 namespace Types {
+// vectors keep number of lanes in bits above 8 and lane type in low bits
 enum Type {
     INT64_T = 64,
     INT32_T = 32,
     BOOL_T = 1,
     VOID_T = 0,
+    VEC2_INT64_T = (2 << 8) | INT64_T,
+    VEC4_INT64_T = (4 << 8) | INT64_T,
+    VEC8_INT32_T = (8 << 8) | INT32_T,
 };
+
+inline bool is_vector(Type type) { return type >> 8; }
+inline int lanes(Type type) { return is_vector(type) ? type >> 8 : 1; }
+inline Type element_type(Type type) { return Type(type & 0xff); }
+
+// vector of elements that fills register of that many bits, VOID_T if there is none
+inline Type vector_of(Type element, int bits) {
+    if (element != INT64_T && element != INT32_T) return VOID_T;
+    Type type = Type(((bits / element) << 8) | element);
+    if (type == VEC2_INT64_T || type == VEC4_INT64_T || type == VEC8_INT32_T) return type;
+    return VOID_T;
+}
 }
 
 }  // namespace IR